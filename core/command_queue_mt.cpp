@@ -32,71 +32,47 @@
 
 #include "core/os/os.h"
 
-void CommandQueueMT::lock() {
+#include <thread>
 
-	mutex.lock();
+void CommandQueueMT::wait_for_flush() {
+
+	// wait one millisecond for a flush to happen
+	OS::get_singleton()->delay_usec(1000);
 }
 
-void CommandQueueMT::unlock() {
+void CommandQueueMT::wait_for_command() {
 
-	mutex.unlock();
+	// The writer only has the arguments left to copy, so don't sleep.
+	std::this_thread::yield();
 }
 
-void CommandQueueMT::wait_for_flush() {
+void CommandQueueMT::_wake_reader() {
 
-	// wait one millisecond for a flush to happen
-	OS::get_singleton()->delay_usec(1000);
+	if (!sync) {
+		return;
+	}
+
+	// Pairs with the fence in wait_and_flush_one(): either the reader sees the command, or this sees it sleeping.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (reader_sleeping.load(std::memory_order_relaxed) && reader_sleeping.exchange(false)) {
+		sync->post();
+	}
 }
 
 CommandQueueMT::SyncSemaphore *CommandQueueMT::_alloc_sync_sem() {
 
-	int idx = -1;
-
 	while (true) {
 
-		lock();
 		for (int i = 0; i < SYNC_SEMAPHORES; i++) {
 
-			if (!sync_sems[i].in_use) {
-				sync_sems[i].in_use = true;
-				idx = i;
-				break;
+			bool expected = false;
+			if (sync_sems[i].in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+				return &sync_sems[i];
 			}
 		}
-		unlock();
 
-		if (idx == -1) {
-			wait_for_flush();
-		} else {
-			break;
-		}
-	}
-
-	return &sync_sems[idx];
-}
-
-bool CommandQueueMT::dealloc_one() {
-tryagain:
-	if (dealloc_ptr == write_ptr) {
-		// The queue is empty
-		return false;
+		wait_for_flush();
 	}
-
-	uint32_t size = *(uint32_t *)&command_mem[dealloc_ptr];
-
-	if (size == 0) {
-		// End of command buffer wrap down
-		dealloc_ptr = 0;
-		goto tryagain;
-	}
-
-	if (size & 1) {
-		// Still used, nothing can be deallocated
-		return false;
-	}
-
-	dealloc_ptr += (size >> 1) + 8;
-	return true;
 }
 
 CommandQueueMT::CommandQueueMT(bool p_sync) {
@@ -104,7 +80,9 @@ CommandQueueMT::CommandQueueMT(bool p_sync) {
 	read_ptr = 0;
 	write_ptr = 0;
 	dealloc_ptr = 0;
+	reader_sleeping = false;
 	command_mem = (uint8_t *)memalloc(COMMAND_MEM_SIZE);
+	memset(command_mem, 0, COMMAND_MEM_SIZE);
 
 	for (int i = 0; i < SYNC_SEMAPHORES; i++) {
 
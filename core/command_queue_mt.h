@@ -37,6 +37,9 @@
 #include "core/simple_type.h"
 #include "core/typedefs.h"
 
+#include <atomic>
+#include <string.h>
+
 #define COMMA(N) _COMMA_##N
 #define _COMMA_0
 #define _COMMA_1 ,
@@ -248,12 +251,11 @@
 #define DECL_PUSH(N)                                                         \
 	template <class T, class M COMMA(N) COMMA_SEP_LIST(TYPE_PARAM, N)>       \
 	void push(T *p_instance, M p_method COMMA(N) COMMA_SEP_LIST(PARAM, N)) { \
-		CMD_TYPE(N) *cmd = allocate_and_lock<CMD_TYPE(N)>();                 \
+		CMD_TYPE(N) *cmd = allocate_and_wait<CMD_TYPE(N)>();                 \
 		cmd->instance = p_instance;                                          \
 		cmd->method = p_method;                                              \
 		SEMIC_SEP_LIST(CMD_ASSIGN_PARAM, N);                                 \
-		unlock();                                                            \
-		if (sync) sync->post();                                              \
+		commit(cmd);                                                         \
 	}
 
 #define CMD_RET_TYPE(N) CommandRet##N<T, M, COMMA_SEP_LIST(TYPE_ARG, N) COMMA(N) R>
@@ -262,16 +264,15 @@
 	template <class T, class M, COMMA_SEP_LIST(TYPE_PARAM, N) COMMA(N) class R>                \
 	void push_and_ret(T *p_instance, M p_method, COMMA_SEP_LIST(PARAM, N) COMMA(N) R *r_ret) { \
 		SyncSemaphore *ss = _alloc_sync_sem();                                                 \
-		CMD_RET_TYPE(N) *cmd = allocate_and_lock<CMD_RET_TYPE(N)>();                           \
+		CMD_RET_TYPE(N) *cmd = allocate_and_wait<CMD_RET_TYPE(N)>();                           \
 		cmd->instance = p_instance;                                                            \
 		cmd->method = p_method;                                                                \
 		SEMIC_SEP_LIST(CMD_ASSIGN_PARAM, N);                                                   \
 		cmd->ret = r_ret;                                                                      \
 		cmd->sync_sem = ss;                                                                    \
-		unlock();                                                                              \
-		if (sync) sync->post();                                                                \
+		commit(cmd);                                                                           \
 		ss->sem.wait();                                                                        \
-		ss->in_use = false;                                                                    \
+		ss->in_use.store(false, std::memory_order_release);                                    \
 	}
 
 #define CMD_SYNC_TYPE(N) CommandSync##N<T, M COMMA(N) COMMA_SEP_LIST(TYPE_ARG, N)>
@@ -280,25 +281,30 @@
 	template <class T, class M COMMA(N) COMMA_SEP_LIST(TYPE_PARAM, N)>                \
 	void push_and_sync(T *p_instance, M p_method COMMA(N) COMMA_SEP_LIST(PARAM, N)) { \
 		SyncSemaphore *ss = _alloc_sync_sem();                                        \
-		CMD_SYNC_TYPE(N) *cmd = allocate_and_lock<CMD_SYNC_TYPE(N)>();                \
+		CMD_SYNC_TYPE(N) *cmd = allocate_and_wait<CMD_SYNC_TYPE(N)>();                \
 		cmd->instance = p_instance;                                                   \
 		cmd->method = p_method;                                                       \
 		SEMIC_SEP_LIST(CMD_ASSIGN_PARAM, N);                                          \
 		cmd->sync_sem = ss;                                                           \
-		unlock();                                                                     \
-		if (sync) sync->post();                                                       \
+		commit(cmd);                                                                  \
 		ss->sem.wait();                                                               \
-		ss->in_use = false;                                                           \
+		ss->in_use.store(false, std::memory_order_release);                           \
 	}
 
 #define MAX_CMD_PARAMS 15
 
+// Commands pushed by any number of threads and run by a single reader thread, without locks.
+//
+// Writers reserve room in the ring buffer by moving write_ptr forward with a compare and swap, fill in the command,
+// and then mark it as ready in its header. The reader runs the commands in the order they were reserved, so the
+// commands of each writer run in the order they were pushed. The reader is only woken up when it went to sleep
+// because the queue was empty, so writers don't touch the semaphore while it is busy.
 class CommandQueueMT {
 
 	struct SyncSemaphore {
 
 		Semaphore sem;
-		bool in_use;
+		std::atomic<bool> in_use;
 	};
 
 	struct CommandBase {
@@ -337,128 +343,133 @@ class CommandQueueMT {
 	};
 
 	uint8_t *command_mem;
+	// Only used by the reader.
 	uint32_t read_ptr;
-	uint32_t write_ptr;
-	uint32_t dealloc_ptr;
+	// Where the next command is reserved.
+	std::atomic<uint32_t> write_ptr;
+	// Everything from here up to write_ptr is in use, the rest is free and zeroed.
+	std::atomic<uint32_t> dealloc_ptr;
+	std::atomic<bool> reader_sleeping;
 	SyncSemaphore sync_sems[SYNC_SEMAPHORES];
-	Mutex mutex;
 	Semaphore *sync;
 
+	// Every command starts with an 8 byte header. The first 4 bytes hold the size of the command, shifted left by one.
+	// The first bit is set once the command is ready to run. A ready header with size zero marks the end of the ring
+	// buffer, and that the reader has to go back to the beginning.
+	enum {
+		HEADER_READY = 1,
+		HEADER_WRAP = HEADER_READY,
+	};
+
+	_FORCE_INLINE_ std::atomic<uint32_t> *_get_header(uint32_t p_pos) {
+
+		return reinterpret_cast<std::atomic<uint32_t> *>(&command_mem[p_pos]);
+	}
+
 	template <class T>
 	T *allocate() {
 
 		// alloc size is size+T+safeguard
-		uint32_t alloc_size = ((sizeof(T) + 8 - 1) & ~(8 - 1)) + 8;
+		uint32_t size = (sizeof(T) + 8 - 1) & ~(8 - 1);
+		uint32_t alloc_size = size + 8;
 
-	tryagain:
+		uint32_t write = write_ptr.load(std::memory_order_relaxed);
 
-		if (write_ptr < dealloc_ptr) {
-			// behind dealloc_ptr, check that there is room
-			if ((dealloc_ptr - write_ptr) <= alloc_size) {
+		while (true) {
 
-				// There is no more room, try to deallocate something
-				if (dealloc_one()) {
-					goto tryagain;
+			// A stale dealloc_ptr can only make the free room look smaller than it is.
+			uint32_t dealloc = dealloc_ptr.load(std::memory_order_acquire);
+			uint32_t pos = write;
+
+			if (write < dealloc) {
+				// behind dealloc_ptr, check that there is room
+				if ((dealloc - write) <= alloc_size) {
+					return nullptr;
+				}
+			} else if ((COMMAND_MEM_SIZE - write) < alloc_size + sizeof(uint32_t)) {
+				// no room at the end, wrap down, but don't let write_ptr become dealloc_ptr
+				if (dealloc <= alloc_size) {
+					return nullptr;
 				}
-				return nullptr;
+				pos = 0;
 			}
-		} else {
-			// ahead of dealloc_ptr, check that there is room
 
-			if ((COMMAND_MEM_SIZE - write_ptr) < alloc_size + sizeof(uint32_t)) {
-				// no room at the end, wrap down;
+			if (write_ptr.compare_exchange_weak(write, pos + alloc_size, std::memory_order_relaxed)) {
 
-				if (dealloc_ptr == 0) { // don't want write_ptr to become dealloc_ptr
-
-					// There is no more room, try to deallocate something
-					if (dealloc_one()) {
-						goto tryagain;
-					}
-					return nullptr;
+				if (pos != write) {
+					_get_header(write)->store(HEADER_WRAP, std::memory_order_release);
 				}
 
-				// if this happens, it's a bug
-				ERR_FAIL_COND_V((COMMAND_MEM_SIZE - write_ptr) < 8, nullptr);
-				// zero means, wrap to beginning
-
-				uint32_t *p = (uint32_t *)&command_mem[write_ptr];
-				*p = 0;
-				write_ptr = 0;
-				goto tryagain;
+				return memnew_placement(&command_mem[pos + 8], T);
 			}
 		}
-		// Allocate the size and the 'in use' bit.
-		// First bit used to mark if command is still in use (1)
-		// or if it has been destroyed and can be deallocated (0).
-		uint32_t size = (sizeof(T) + 8 - 1) & ~(8 - 1);
-		uint32_t *p = (uint32_t *)&command_mem[write_ptr];
-		*p = (size << 1) | 1;
-		write_ptr += 8;
-		// allocate the command
-		T *cmd = memnew_placement(&command_mem[write_ptr], T);
-		write_ptr += size;
-		return cmd;
 	}
 
 	template <class T>
-	T *allocate_and_lock() {
+	T *allocate_and_wait() {
 
-		lock();
 		T *ret;
 
 		while ((ret = allocate<T>()) == nullptr) {
 
-			unlock();
 			// sleep a little until fetch happened and some room is made
 			wait_for_flush();
-			lock();
 		}
 
 		return ret;
 	}
 
-	bool flush_one(bool p_lock = true) {
-		if (p_lock) lock();
+	template <class T>
+	void commit(T *p_cmd) {
+
+		uint32_t size = (sizeof(T) + 8 - 1) & ~(8 - 1);
+		_get_header((uint8_t *)p_cmd - command_mem - 8)->store((size << 1) | HEADER_READY, std::memory_order_release);
+		_wake_reader();
+	}
+
+	bool flush_one() {
 	tryagain:
 
 		// tried to read an empty queue
-		if (read_ptr == write_ptr) {
-			if (p_lock) unlock();
+		if (read_ptr == write_ptr.load(std::memory_order_acquire)) {
 			return false;
 		}
 
-		uint32_t size_ptr = read_ptr;
-		uint32_t size = *(uint32_t *)&command_mem[read_ptr] >> 1;
+		uint32_t header = _get_header(read_ptr)->load(std::memory_order_acquire);
+		while (!(header & HEADER_READY)) {
+			// reserved, but the writer is still filling it in
+			wait_for_command();
+			header = _get_header(read_ptr)->load(std::memory_order_acquire);
+		}
+
+		uint32_t size = header >> 1;
 
 		if (size == 0) {
 			//end of ringbuffer, wrap
+			_get_header(read_ptr)->store(0, std::memory_order_relaxed);
 			read_ptr = 0;
+			dealloc_ptr.store(0, std::memory_order_release);
 			goto tryagain;
 		}
 
-		read_ptr += 8;
-
-		CommandBase *cmd = reinterpret_cast<CommandBase *>(&command_mem[read_ptr]);
+		CommandBase *cmd = reinterpret_cast<CommandBase *>(&command_mem[read_ptr + 8]);
 
-		read_ptr += size;
-
-		if (p_lock) unlock();
 		cmd->call();
-		if (p_lock) lock();
-
 		cmd->post();
 		cmd->~CommandBase();
-		*(uint32_t *)&command_mem[size_ptr] &= ~1;
 
-		if (p_lock) unlock();
+		// Writers expect free room to be zeroed, so they never see a stale header as ready.
+		memset(&command_mem[read_ptr], 0, size + 8);
+		read_ptr += size + 8;
+		dealloc_ptr.store(read_ptr, std::memory_order_release);
+
 		return true;
 	}
 
-	void lock();
-	void unlock();
 	void wait_for_flush();
+	void wait_for_command();
+	void _wake_reader();
 	SyncSemaphore *_alloc_sync_sem();
-	bool dealloc_one();
 
 public:
 	/* NORMAL PUSH COMMANDS */
@@ -475,6 +486,19 @@ public:
 
 	void wait_and_flush_one() {
 		ERR_FAIL_COND(!sync);
+
+		if (flush_one()) {
+			return;
+		}
+
+		// Nothing to run, tell the writers to wake us up and check again, in case one pushed meanwhile.
+		reader_sleeping.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (flush_one()) {
+			reader_sleeping.store(false);
+			return;
+		}
+
 		sync->wait();
 		flush_one();
 	}
@@ -482,10 +506,8 @@ public:
 	void flush_all() {
 
 		//ERR_FAIL_COND(sync);
-		lock();
-		while (flush_one(false))
+		while (flush_one())
 			;
-		unlock();
 	}
 
 	CommandQueueMT(bool p_sync);
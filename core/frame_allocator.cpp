@@ -0,0 +1,167 @@
+/*************************************************************************/
+/*  frame_allocator.cpp                                                  */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "frame_allocator.h"
+
+#include <atomic>
+
+static std::atomic<uint32_t> frame_count(0);
+
+struct FrameAllocator::Arena {
+
+	Block *block = nullptr;
+	// Allocations not given back yet.
+	uint32_t live = 0;
+	// The frame the blocks were last compacted in.
+	uint32_t frame = 0;
+
+	~Arena() {
+
+		while (block) {
+			Block *prev = block->prev;
+			memfree(block);
+			block = prev;
+		}
+	}
+};
+
+FrameAllocator::Arena &FrameAllocator::_get_arena() {
+
+	static thread_local Arena arena;
+	return arena;
+}
+
+FrameAllocator::Block *FrameAllocator::_add_block(Arena &p_arena, uint32_t p_size) {
+
+	uint32_t size = MAX((uint32_t)MIN_BLOCK_SIZE, p_size);
+	if (p_arena.block) {
+		size = MAX(size, p_arena.block->size * 2);
+	}
+
+	Block *block = (Block *)memalloc(_align(sizeof(Block)) + size);
+	block->prev = p_arena.block;
+	block->size = size;
+	block->used = 0;
+
+	p_arena.block = block;
+	return block;
+}
+
+void FrameAllocator::_compact(Arena &p_arena) {
+
+	Block *block = p_arena.block;
+	if (!block || !block->prev) {
+		return;
+	}
+
+	// Several blocks were needed, replace them with one that fits all of them.
+	uint32_t size = 0;
+	while (block) {
+		Block *prev = block->prev;
+		size += block->size;
+		memfree(block);
+		block = prev;
+	}
+
+	p_arena.block = nullptr;
+	_add_block(p_arena, size);
+}
+
+void *FrameAllocator::alloc(uint32_t p_size) {
+
+	Arena &arena = _get_arena();
+
+	uint32_t frame = frame_count.load(std::memory_order_relaxed);
+	if (arena.frame != frame && arena.live == 0) {
+		_compact(arena);
+		arena.frame = frame;
+	}
+
+	p_size = _align(p_size);
+
+	Block *block = arena.block;
+	if (!block || block->size - block->used < p_size) {
+		block = _add_block(arena, p_size);
+	}
+
+	void *ptr = _get_data(block) + block->used;
+	block->used += p_size;
+	arena.live++;
+
+	return ptr;
+}
+
+void FrameAllocator::free(void *p_ptr, uint32_t p_size) {
+
+	Arena &arena = _get_arena();
+	ERR_FAIL_COND(arena.live == 0);
+
+	arena.live--;
+
+	Block *block = arena.block;
+	if (arena.live == 0) {
+		// Nothing taken from the block is in use anymore.
+		block->used = 0;
+		return;
+	}
+
+	p_size = _align(p_size);
+	if ((uint8_t *)p_ptr + p_size == _get_data(block) + block->used) {
+		block->used -= p_size;
+	}
+}
+
+void *FrameAllocator::realloc(void *p_ptr, uint32_t p_old_size, uint32_t p_size) {
+
+	if (!p_ptr) {
+		return alloc(p_size);
+	}
+
+	Arena &arena = _get_arena();
+	Block *block = arena.block;
+
+	uint32_t old_size = _align(p_old_size);
+	uint32_t new_size = _align(p_size);
+	if ((uint8_t *)p_ptr + old_size == _get_data(block) + block->used && block->used - old_size + new_size <= block->size) {
+		block->used = block->used - old_size + new_size;
+		return p_ptr;
+	}
+
+	void *ptr = alloc(p_size);
+	memcpy(ptr, p_ptr, MIN(p_old_size, p_size));
+	free(p_ptr, p_old_size);
+
+	return ptr;
+}
+
+void FrameAllocator::end_frame() {
+
+	frame_count.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,186 @@
+/*************************************************************************/
+/*  frame_allocator.h                                                    */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#ifndef FRAME_ALLOCATOR_H
+#define FRAME_ALLOCATOR_H
+
+#include "core/error_macros.h"
+#include "core/os/memory.h"
+#include "core/typedefs.h"
+#include "core/vector.h"
+
+#include <string.h>
+
+// Hands out short-lived memory from a block that belongs to the calling thread, by bumping a pointer.
+//
+// Memory given back in the reverse order it was taken is reused right away, and the whole block is reused once
+// nothing taken from it is in use anymore, so nested scopes don't make it grow. When a block runs out another one is
+// chained to it, and at the end of the frame the chain is replaced by a single block large enough for all of it,
+// so the heap only sees a few allocations of settled sizes instead of many small ones every frame.
+class FrameAllocator {
+
+	enum {
+		ALIGN = 16,
+		MIN_BLOCK_SIZE = 64 * 1024,
+	};
+
+	struct Block {
+		Block *prev;
+		uint32_t size;
+		uint32_t used;
+	};
+
+	struct Arena;
+
+	static Arena &_get_arena();
+	static Block *_add_block(Arena &p_arena, uint32_t p_size);
+	static void _compact(Arena &p_arena);
+
+	_FORCE_INLINE_ static uint32_t _align(uint32_t p_size) {
+
+		return (p_size + ALIGN - 1) & ~(ALIGN - 1);
+	}
+
+	_FORCE_INLINE_ static uint8_t *_get_data(Block *p_block) {
+
+		return (uint8_t *)p_block + _align(sizeof(Block));
+	}
+
+public:
+	// The memory must be given back with free() by the same thread, before the frame ends.
+	static void *alloc(uint32_t p_size);
+	static void free(void *p_ptr, uint32_t p_size);
+	// Grows the memory in place when it was the last taken, otherwise moves it.
+	static void *realloc(void *p_ptr, uint32_t p_old_size, uint32_t p_size);
+
+	// Called once per frame by the main loop, each thread compacts its blocks the next time it allocates.
+	static void end_frame();
+};
+
+// A vector for temporary arrays that don't outlive the scope that creates them, taking its memory from the
+// FrameAllocator of the calling thread instead of the heap. Like Vector, elements are moved around with memcpy.
+template <class T>
+class FrameVector {
+
+	T *data = nullptr;
+	uint32_t count = 0;
+	uint32_t capacity = 0;
+
+	void _reserve(uint32_t p_capacity) {
+
+		if (p_capacity <= capacity) {
+			return;
+		}
+		// Grows in place only while the data is the last allocation of the thread. Otherwise it is moved, and the
+		// space it leaves behind isn't reclaimed until nothing taken from the FrameAllocator is in use anymore.
+		// Vectors that grow while others are taken after them should reserve upfront.
+		data = (T *)FrameAllocator::realloc(data, capacity * sizeof(T), p_capacity * sizeof(T));
+		capacity = p_capacity;
+	}
+
+	FrameVector(const FrameVector &p_from);
+	void operator=(const FrameVector &p_from);
+
+public:
+	_FORCE_INLINE_ uint32_t size() const { return count; }
+	_FORCE_INLINE_ bool empty() const { return count == 0; }
+	_FORCE_INLINE_ T *ptrw() { return data; }
+	_FORCE_INLINE_ const T *ptr() const { return data; }
+
+	_FORCE_INLINE_ T &operator[](uint32_t p_index) {
+		CRASH_BAD_UNSIGNED_INDEX(p_index, count);
+		return data[p_index];
+	}
+	_FORCE_INLINE_ const T &operator[](uint32_t p_index) const {
+		CRASH_BAD_UNSIGNED_INDEX(p_index, count);
+		return data[p_index];
+	}
+
+	void push_back(const T &p_elem) {
+
+		if (count == capacity) {
+			_reserve(MAX(capacity * 2, 4u));
+		}
+		memnew_placement(&data[count++], T(p_elem));
+	}
+
+	void resize(uint32_t p_size) {
+
+		if (p_size < count) {
+			if (!__has_trivial_destructor(T)) {
+				for (uint32_t i = p_size; i < count; i++) {
+					data[i].~T();
+				}
+			}
+		} else if (p_size > count) {
+			_reserve(p_size);
+			if (!__has_trivial_constructor(T)) {
+				for (uint32_t i = count; i < p_size; i++) {
+					memnew_placement(&data[i], T);
+				}
+			}
+		}
+		count = p_size;
+	}
+
+	void clear() {
+
+		resize(0);
+	}
+
+	FrameVector() {}
+
+	explicit FrameVector(const Vector<T> &p_from) {
+
+		if (p_from.empty()) {
+			return;
+		}
+
+		_reserve(p_from.size());
+		if (__has_trivial_copy(T)) {
+			memcpy(data, p_from.ptr(), p_from.size() * sizeof(T));
+		} else {
+			for (int i = 0; i < p_from.size(); i++) {
+				memnew_placement(&data[i], T(p_from[i]));
+			}
+		}
+		count = p_from.size();
+	}
+
+	~FrameVector() {
+
+		clear();
+		if (data) {
+			FrameAllocator::free(data, capacity * sizeof(T));
+		}
+	}
+};
+
+#endif // FRAME_ALLOCATOR_H
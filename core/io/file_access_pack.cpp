@@ -328,7 +328,15 @@ bool FileAccessPack::file_exists(const String &p_name) {
 
 FileAccessPack::FileAccessPack(const String &p_path, const PackedData::PackedFile &p_file) :
 		pf(p_file),
-		f(FileAccess::open(pf.pack, FileAccess::READ)) {
+		f(nullptr) {
+
+	// Every file of a pack reads from the pack itself, so going through the file cache lets them share its pages.
+	if (FileAccess::get_cached_open_func()) {
+		f = FileAccess::get_cached_open_func()(pf.pack, true);
+	}
+	if (!f) {
+		f = FileAccess::open(pf.pack, FileAccess::READ);
+	}
 
 	ERR_FAIL_COND_MSG(!f, "Can't open pack-referenced file '" + String(pf.pack) + "'.");
 
@@ -0,0 +1,210 @@
+/*************************************************************************/
+/*  job_graph.cpp                                                        */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "job_graph.h"
+
+void JobGraph::Job::finish() {
+
+	Vector<Job *> ready;
+	{
+		MutexLock lock(mutex);
+		completed = true;
+		ready = continuations;
+	}
+
+	for (int i = 0; i < ready.size(); i++) {
+		release(ready[i]);
+	}
+
+	done.post();
+}
+
+void JobGraph::release(Job *p_job) {
+
+	if (atomic_decrement(&p_job->pending) == 0) {
+		ThreadWorkPool::get_singleton()->push_work(p_job, 0, 1);
+	}
+}
+
+JobGraph::JobID JobGraph::add(Job *p_job) {
+
+	p_job->id = jobs.size();
+	p_job->grain = 1;
+	p_job->remaining = 1;
+	p_job->pending = 1;
+	p_job->dependencies = 0;
+	p_job->completed = false;
+	p_job->waited = false;
+
+	jobs.push_back(p_job);
+	return p_job->id;
+}
+
+bool JobGraph::has_cycle() const {
+
+	uint32_t count = jobs.size() - submitted;
+
+	// Kahn's algorithm: jobs whose dependencies were all taken are taken in turn.
+	// Whatever is left over once no job can be taken is on a cycle, or waits for one.
+	Vector<uint32_t> in_degree;
+	in_degree.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		in_degree.write[i] = 0;
+	}
+
+	for (uint32_t i = submitted; i < (uint32_t)jobs.size(); i++) {
+		const Vector<Job *> &continuations = jobs[i]->continuations;
+		for (int j = 0; j < continuations.size(); j++) {
+			in_degree.write[continuations[j]->id - submitted]++;
+		}
+	}
+
+	Vector<JobID> ready;
+	for (uint32_t i = 0; i < count; i++) {
+		if (in_degree[i] == 0) {
+			ready.push_back(submitted + i);
+		}
+	}
+
+	uint32_t taken = 0;
+	while (ready.size()) {
+		JobID job = ready[ready.size() - 1];
+		ready.resize(ready.size() - 1);
+		taken++;
+
+		const Vector<Job *> &continuations = jobs[job]->continuations;
+		for (int j = 0; j < continuations.size(); j++) {
+			if (--in_degree.write[continuations[j]->id - submitted] == 0) {
+				ready.push_back(continuations[j]->id);
+			}
+		}
+	}
+
+	return taken < count;
+}
+
+void JobGraph::add_dependency(JobID p_job, JobID p_dependency) {
+
+	ERR_FAIL_INDEX(p_job, (uint32_t)jobs.size());
+	ERR_FAIL_INDEX(p_dependency, (uint32_t)jobs.size());
+	ERR_FAIL_COND_MSG(p_job < submitted, "Can't add a dependency to a job that was already submitted.");
+	ERR_FAIL_COND_MSG(p_job == p_dependency, "A job can't depend on itself.");
+
+	Job *dependency = jobs[p_dependency];
+
+	MutexLock lock(dependency->mutex);
+
+	// A dependency that is done already doesn't hold the job back this time, but it will after reset().
+	jobs[p_job]->dependencies++;
+	dependency->continuations.push_back(jobs[p_job]);
+	if (!dependency->completed) {
+		atomic_increment(&jobs[p_job]->pending);
+	}
+
+	acyclic = false;
+}
+
+void JobGraph::submit() {
+
+	if (!acyclic) {
+		ERR_FAIL_COND_MSG(has_cycle(), "The jobs depend on each other in a cycle, so none of them was submitted.");
+		acyclic = true;
+	}
+
+	for (uint32_t i = submitted; i < (uint32_t)jobs.size(); i++) {
+		release(jobs[i]);
+	}
+
+	submitted = jobs.size();
+}
+
+bool JobGraph::is_done(JobID p_job) const {
+
+	ERR_FAIL_INDEX_V(p_job, (uint32_t)jobs.size(), false);
+
+	return jobs[p_job]->remaining == 0;
+}
+
+void JobGraph::wait(JobID p_job) {
+
+	ERR_FAIL_INDEX(p_job, (uint32_t)jobs.size());
+	ERR_FAIL_COND_MSG(p_job >= submitted, "Can't wait for a job that was not submitted.");
+
+	Job *job = jobs[p_job];
+
+	// Each job posts its semaphore once, so it can only be waited for once.
+	if (!job->waited) {
+		ThreadWorkPool::get_singleton()->wait_work(job);
+		job->waited = true;
+	}
+}
+
+void JobGraph::wait_all() {
+
+	// Jobs that were never submitted can't run, they are submitted now so that none is left behind.
+	// Jobs on a cycle are never submitted, and can't be waited for.
+	submit();
+
+	for (uint32_t i = 0; i < submitted; i++) {
+		wait(i);
+	}
+}
+
+void JobGraph::reset() {
+
+	wait_all();
+	ERR_FAIL_COND_MSG(submitted < (uint32_t)jobs.size(), "Can't reset a graph whose jobs depend on each other in a cycle.");
+
+	// Nothing runs anymore, so the jobs can be changed without their locks.
+	for (int i = 0; i < jobs.size(); i++) {
+		Job *job = jobs[i];
+		job->remaining = 1;
+		job->pending = job->dependencies + 1;
+		job->completed = false;
+		job->waited = false;
+	}
+
+	submitted = 0;
+}
+
+JobGraph::JobGraph() {
+
+	submitted = 0;
+	acyclic = true;
+}
+
+JobGraph::~JobGraph() {
+
+	wait_all();
+
+	for (int i = 0; i < jobs.size(); i++) {
+		memdelete(jobs[i]);
+	}
+}
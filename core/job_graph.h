@@ -0,0 +1,127 @@
+/*************************************************************************/
+/*  job_graph.h                                                          */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#ifndef JOB_GRAPH_H
+#define JOB_GRAPH_H
+
+#include "core/thread_work_pool.h"
+
+// A set of jobs run by the ThreadWorkPool, each job starting once the jobs it depends on are done.
+//
+// Jobs are added, along with their dependencies, and then submitted. From then on, each job is queued in the pool as
+// soon as its last dependency is done, so independent jobs run at the same time. A continuation is a job that depends
+// on a single other job. The jobs can be waited for one by one, at the points where their results are needed, and
+// are all waited for when the graph is destroyed.
+//
+// A graph that runs the same jobs over and over, like once per frame, is built once and reset() after each run.
+//
+// The graph itself must only be used by the thread that created it. Jobs can start loops or graphs of their own.
+class JobGraph {
+public:
+	typedef uint32_t JobID;
+
+private:
+	struct Job : public ThreadWorkPool::BaseWork {
+		JobID id;
+		// The dependencies that are not done yet, plus one until the job is submitted.
+		volatile uint32_t pending;
+		// The number of jobs this one depends on, which pending starts from again on reset().
+		uint32_t dependencies;
+		// Guards completed and continuations, so that a job can't gain a continuation once it has released them.
+		BinaryMutex mutex;
+		bool completed;
+		bool waited;
+		// The jobs that depend on this one. Kept once released, for reset().
+		Vector<Job *> continuations;
+
+		virtual void finish();
+	};
+
+	template <class F>
+	struct FunctionJob : public Job {
+		F function;
+
+		virtual void run(uint32_t p_from, uint32_t p_to) {
+			function();
+		}
+
+		FunctionJob(const F &p_function) :
+				function(p_function) {}
+	};
+
+	Vector<Job *> jobs;
+	// The jobs before this one were submitted.
+	uint32_t submitted;
+	// Cleared when a dependency is added, until submit() has checked the jobs for cycles.
+	bool acyclic;
+
+	// Drops one of the pending dependencies of the job, and queues it if that was the last one.
+	static void release(Job *p_job);
+	JobID add(Job *p_job);
+	// Returns true if some of the jobs that were not submitted yet depend on each other in a cycle.
+	// Submitted jobs can't gain dependencies, so any cycle is among those.
+	bool has_cycle() const;
+
+public:
+	// Adds a job that calls p_function(). It is not queued before submit().
+	template <class F>
+	JobID add_job(F p_function) {
+		return add(memnew(FunctionJob<F>(p_function)));
+	}
+
+	// Makes the job wait for p_dependency to be done. Must be called before the job is submitted.
+	void add_dependency(JobID p_job, JobID p_dependency);
+
+	// Adds a job that calls p_function() once p_after is done.
+	template <class F>
+	JobID add_continuation(JobID p_after, F p_function) {
+		JobID job = add_job(p_function);
+		add_dependency(job, p_after);
+		return job;
+	}
+
+	// Queues the jobs added since the last submit() whose dependencies are done. The others are queued once they are.
+	// Fails without queuing any of them if they depend on each other in a cycle, as they could never run.
+	void submit();
+
+	bool is_done(JobID p_job) const;
+
+	// Runs queued work until the job is done. The job must have been submitted.
+	void wait(JobID p_job);
+	void wait_all();
+
+	// Waits for all the jobs, then makes them ready to run again, with the same dependencies, on the next submit().
+	void reset();
+
+	JobGraph();
+	~JobGraph();
+};
+
+#endif // JOB_GRAPH_H
@@ -35,12 +35,151 @@
 #include "core/script_language.h"
 
 MessageQueue *MessageQueue::singleton = nullptr;
+uint32_t MessageQueue::last_queue_id = 0;
+
+struct MessageQueueThreadBuffer {
+
+	MessageQueue::ThreadBuffer *buffer = nullptr;
+	uint32_t queue_id = 0;
+
+	~MessageQueueThreadBuffer() {
+
+		// Only give the buffer back if it still belongs to a live queue.
+		if (buffer && MessageQueue::singleton && MessageQueue::singleton->queue_id == queue_id) {
+			MessageQueue::_release_thread_buffer(buffer);
+		}
+	}
+};
+
+static thread_local MessageQueueThreadBuffer thread_buffer;
 
 MessageQueue *MessageQueue::get_singleton() {
 
 	return singleton;
 }
 
+MessageQueue::ThreadBuffer *MessageQueue::_get_thread_buffer() {
+
+	if (thread_buffer.buffer && thread_buffer.queue_id == queue_id) {
+		return thread_buffer.buffer;
+	}
+
+	ThreadBuffer *tb = nullptr;
+
+	// Take over the buffer of a thread that exited, so short-lived threads don't keep adding buffers.
+	for (ThreadBuffer *E = buffers.load(std::memory_order_acquire); E; E = E->next) {
+		bool expected = true;
+		if (E->orphaned.compare_exchange_strong(expected, false, std::memory_order_acq_rel)) {
+			tb = E;
+			break;
+		}
+	}
+
+	if (!tb) {
+		uint32_t size = MIN((uint32_t)FIRST_CHUNK_SIZE_KB * 1024, buffer_size);
+		tb = memnew(ThreadBuffer);
+		tb->first = _create_chunk(size);
+		tb->last = tb->first;
+		tb->allocated.store(size, std::memory_order_relaxed);
+		tb->max_used = 0;
+		tb->orphaned.store(false, std::memory_order_relaxed);
+		tb->next = buffers.load(std::memory_order_relaxed);
+		while (!buffers.compare_exchange_weak(tb->next, tb, std::memory_order_release, std::memory_order_relaxed)) {
+		}
+	}
+
+	thread_buffer.buffer = tb;
+	thread_buffer.queue_id = queue_id;
+	return tb;
+}
+
+void MessageQueue::_release_thread_buffer(ThreadBuffer *p_buffer) {
+
+	// Messages still in the buffer are delivered as usual, the buffer just gets a new owner.
+	p_buffer->orphaned.store(true, std::memory_order_release);
+}
+
+MessageQueue::Chunk *MessageQueue::_create_chunk(uint32_t p_size) {
+
+	Chunk *chunk = memnew(Chunk);
+	chunk->buffer = memnew_arr(uint8_t, p_size);
+	chunk->size = p_size;
+	chunk->read.store(0, std::memory_order_relaxed);
+	chunk->end.store(0, std::memory_order_relaxed);
+	chunk->next.store(nullptr, std::memory_order_relaxed);
+	return chunk;
+}
+
+void MessageQueue::_free_chunk(Chunk *p_chunk) {
+
+	memdelete_arr(p_chunk->buffer);
+	memdelete(p_chunk);
+}
+
+uint8_t *MessageQueue::_alloc_message(ThreadBuffer *p_buffer, uint32_t p_size) {
+
+	Chunk *chunk = p_buffer->last;
+
+	// Only the owning thread writes end.
+	uint32_t end = chunk->end.load(std::memory_order_relaxed);
+
+	if (end > 0 && chunk->read.load(std::memory_order_acquire) == end) {
+		// Everything was delivered, so start over from the beginning of the chunk.
+		// end goes back before read, flush() checks read did not change while it loaded end.
+		chunk->end.store(0, std::memory_order_release);
+		chunk->read.store(0, std::memory_order_release);
+		end = 0;
+	}
+
+	if ((end + p_size) < chunk->size) {
+		return &chunk->buffer[end];
+	}
+
+	// flush() may be freeing chunks meanwhile, which only leaves more room.
+	uint32_t allocated = p_buffer->allocated.load(std::memory_order_acquire);
+	uint32_t size = MAX(chunk->size * 2, next_power_of_2(p_size + 1));
+	size = MIN(size, buffer_size - MIN(allocated, buffer_size));
+	if (p_size >= size) {
+		return nullptr;
+	}
+
+	Chunk *next = _create_chunk(size);
+	p_buffer->allocated.fetch_add(size, std::memory_order_relaxed);
+	// Publishes the final end of the full chunk along with the new one.
+	chunk->next.store(next, std::memory_order_release);
+	p_buffer->last = next;
+
+	return next->buffer;
+}
+
+void MessageQueue::_commit_message(ThreadBuffer *p_buffer, uint32_t p_size) {
+
+	Chunk *chunk = p_buffer->last;
+
+	uint32_t end = chunk->end.load(std::memory_order_relaxed) + p_size;
+	uint32_t used = p_buffer->allocated.load(std::memory_order_relaxed) - chunk->size + end;
+	if (used > p_buffer->max_used) {
+		p_buffer->max_used = used;
+	}
+	chunk->end.store(end, std::memory_order_release);
+}
+
+void MessageQueue::_destroy_message(uint8_t *p_message, uint32_t &r_advance) {
+
+	Message *message = (Message *)p_message;
+
+	r_advance = sizeof(Message);
+	if ((message->type & FLAG_MASK) != TYPE_NOTIFICATION) {
+		Variant *args = (Variant *)(message + 1);
+		for (int i = 0; i < message->args; i++) {
+			args[i].~Variant();
+		}
+		r_advance += sizeof(Variant) * message->args;
+	}
+
+	message->~Message();
+}
+
 Error MessageQueue::push_call(ObjectID p_id, const StringName &p_method, const Variant **p_args, int p_argcount, bool p_show_error) {
 
 	return push_callable(Callable(p_id, p_method), p_args, p_argcount, p_show_error);
@@ -63,55 +202,60 @@ Error MessageQueue::push_call(ObjectID p_id, const StringName &p_method, VARIANT
 
 Error MessageQueue::push_set(ObjectID p_id, const StringName &p_prop, const Variant &p_value) {
 
-	_THREAD_SAFE_METHOD_
+	ThreadBuffer *tb = _get_thread_buffer();
 
-	uint8_t room_needed = sizeof(Message) + sizeof(Variant);
+	uint32_t room_needed = sizeof(Message) + sizeof(Variant);
+	uint8_t *ptr = _alloc_message(tb, room_needed);
 
-	if ((buffer_end + room_needed) >= buffer_size) {
+	if (!ptr) {
 		String type;
 		if (ObjectDB::get_instance(p_id))
 			type = ObjectDB::get_instance(p_id)->get_class();
 		print_line("Failed set: " + type + ":" + p_prop + " target ID: " + itos(p_id));
-		statistics();
+		if (!flushing) {
+			statistics();
+		}
 		ERR_FAIL_V_MSG(ERR_OUT_OF_MEMORY, "Message queue out of memory. Try increasing 'memory/limits/message_queue/max_size_kb' in project settings.");
 	}
 
-	Message *msg = memnew_placement(&buffer[buffer_end], Message);
+	Message *msg = memnew_placement(ptr, Message);
 	msg->args = 1;
 	msg->callable = Callable(p_id, p_prop);
 	msg->type = TYPE_SET;
 
-	buffer_end += sizeof(Message);
-
-	Variant *v = memnew_placement(&buffer[buffer_end], Variant);
-	buffer_end += sizeof(Variant);
+	Variant *v = memnew_placement(ptr + sizeof(Message), Variant);
 	*v = p_value;
 
+	_commit_message(tb, room_needed);
+
 	return OK;
 }
 
 Error MessageQueue::push_notification(ObjectID p_id, int p_notification) {
 
-	_THREAD_SAFE_METHOD_
-
 	ERR_FAIL_COND_V(p_notification < 0, ERR_INVALID_PARAMETER);
 
-	uint8_t room_needed = sizeof(Message);
+	ThreadBuffer *tb = _get_thread_buffer();
 
-	if ((buffer_end + room_needed) >= buffer_size) {
+	uint32_t room_needed = sizeof(Message);
+	uint8_t *ptr = _alloc_message(tb, room_needed);
+
+	if (!ptr) {
 		print_line("Failed notification: " + itos(p_notification) + " target ID: " + itos(p_id));
-		statistics();
+		if (!flushing) {
+			statistics();
+		}
 		ERR_FAIL_V_MSG(ERR_OUT_OF_MEMORY, "Message queue out of memory. Try increasing 'memory/limits/message_queue/max_size_kb' in project settings.");
 	}
 
-	Message *msg = memnew_placement(&buffer[buffer_end], Message);
+	Message *msg = memnew_placement(ptr, Message);
 
 	msg->type = TYPE_NOTIFICATION;
 	msg->callable = Callable(p_id, CoreStringNames::get_singleton()->notification); //name is meaningless but callable needs it
 	//msg->target;
 	msg->notification = p_notification;
 
-	buffer_end += sizeof(Message);
+	_commit_message(tb, room_needed);
 
 	return OK;
 }
@@ -132,92 +276,107 @@ Error MessageQueue::push_set(Object *p_object, const StringName &p_prop, const V
 
 Error MessageQueue::push_callable(const Callable &p_callable, const Variant **p_args, int p_argcount, bool p_show_error) {
 
-	_THREAD_SAFE_METHOD_
+	ThreadBuffer *tb = _get_thread_buffer();
 
-	int room_needed = sizeof(Message) + sizeof(Variant) * p_argcount;
+	uint32_t room_needed = sizeof(Message) + sizeof(Variant) * p_argcount;
+	uint8_t *ptr = _alloc_message(tb, room_needed);
 
-	if ((buffer_end + room_needed) >= buffer_size) {
+	if (!ptr) {
 		print_line("Failed method: " + p_callable);
-		statistics();
+		if (!flushing) {
+			statistics();
+		}
 		ERR_FAIL_V_MSG(ERR_OUT_OF_MEMORY, "Message queue out of memory. Try increasing 'memory/limits/message_queue/max_size_kb' in project settings.");
 	}
 
-	Message *msg = memnew_placement(&buffer[buffer_end], Message);
+	Message *msg = memnew_placement(ptr, Message);
 	msg->args = p_argcount;
 	msg->callable = p_callable;
 	msg->type = TYPE_CALL;
 	if (p_show_error)
 		msg->type |= FLAG_SHOW_ERROR;
 
-	buffer_end += sizeof(Message);
-
+	Variant *args = (Variant *)(msg + 1);
 	for (int i = 0; i < p_argcount; i++) {
 
-		Variant *v = memnew_placement(&buffer[buffer_end], Variant);
-		buffer_end += sizeof(Variant);
+		Variant *v = memnew_placement(&args[i], Variant);
 		*v = *p_args[i];
 	}
 
+	_commit_message(tb, room_needed);
+
 	return OK;
 }
 
+// Reads messages other threads may still be pushing past, but must not run while the queue is flushed.
 void MessageQueue::statistics() {
 
 	Map<StringName, int> set_count;
 	Map<int, int> notify_count;
 	Map<Callable, int> call_count;
 	int null_count = 0;
+	uint32_t total_bytes = 0;
 
-	uint32_t read_pos = 0;
-	while (read_pos < buffer_end) {
-		Message *message = (Message *)&buffer[read_pos];
+	for (ThreadBuffer *tb = buffers.load(std::memory_order_acquire); tb; tb = tb->next) {
+		for (Chunk *chunk = tb->first; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
 
-		Object *target = message->callable.get_object();
+			uint32_t read_pos = chunk->read.load(std::memory_order_acquire);
+			uint32_t end = chunk->end.load(std::memory_order_acquire);
+			if (read_pos < end) {
+				total_bytes += end - read_pos;
+			}
 
-		if (target != nullptr) {
+			while (read_pos < end) {
+				Message *message = (Message *)&chunk->buffer[read_pos];
 
-			switch (message->type & FLAG_MASK) {
+				Object *target = message->callable.get_object();
 
-				case TYPE_CALL: {
+				if (target != nullptr) {
 
-					if (!call_count.has(message->callable))
-						call_count[message->callable] = 0;
+					switch (message->type & FLAG_MASK) {
 
-					call_count[message->callable]++;
+						case TYPE_CALL: {
 
-				} break;
-				case TYPE_NOTIFICATION: {
+							if (!call_count.has(message->callable))
+								call_count[message->callable] = 0;
 
-					if (!notify_count.has(message->notification))
-						notify_count[message->notification] = 0;
+							call_count[message->callable]++;
 
-					notify_count[message->notification]++;
+						} break;
+						case TYPE_NOTIFICATION: {
 
-				} break;
-				case TYPE_SET: {
+							if (!notify_count.has(message->notification))
+								notify_count[message->notification] = 0;
 
-					StringName t = message->callable.get_method();
-					if (!set_count.has(t))
-						set_count[t] = 0;
+							notify_count[message->notification]++;
 
-					set_count[t]++;
+						} break;
+						case TYPE_SET: {
 
-				} break;
-			}
+							StringName t = message->callable.get_method();
+							if (!set_count.has(t))
+								set_count[t] = 0;
 
-		} else {
-			//object was deleted
-			print_line("Object was deleted while awaiting a callback");
+							set_count[t]++;
 
-			null_count++;
-		}
+						} break;
+					}
 
-		read_pos += sizeof(Message);
-		if ((message->type & FLAG_MASK) != TYPE_NOTIFICATION)
-			read_pos += sizeof(Variant) * message->args;
+				} else {
+					//object was deleted
+					print_line("Object was deleted while awaiting a callback");
+
+					null_count++;
+				}
+
+				read_pos += sizeof(Message);
+				if ((message->type & FLAG_MASK) != TYPE_NOTIFICATION)
+					read_pos += sizeof(Variant) * message->args;
+			}
+		}
 	}
 
-	print_line("TOTAL BYTES: " + itos(buffer_end));
+	print_line("TOTAL BYTES: " + itos(total_bytes));
 	print_line("NULL count: " + itos(null_count));
 
 	for (Map<StringName, int>::Element *E = set_count.front(); E; E = E->next()) {
@@ -235,7 +394,13 @@ void MessageQueue::statistics() {
 
 int MessageQueue::get_max_buffer_usage() const {
 
-	return buffer_max_used;
+	uint32_t max_used = 0;
+	for (ThreadBuffer *tb = buffers.load(std::memory_order_acquire); tb; tb = tb->next) {
+		if (tb->max_used > max_used) {
+			max_used = tb->max_used;
+		}
+	}
+	return max_used;
 }
 
 void MessageQueue::_call_function(const Callable &p_callable, const Variant *p_args, int p_argcount, bool p_show_error) {
@@ -259,86 +424,90 @@ void MessageQueue::_call_function(const Callable &p_callable, const Variant *p_a
 
 void MessageQueue::flush() {
 
-	if (buffer_end > buffer_max_used) {
-		buffer_max_used = buffer_end;
-	}
+	ERR_FAIL_COND(flushing.exchange(true, std::memory_order_acquire)); //already flushing, you did something odd
 
-	uint32_t read_pos = 0;
+	// Messages can push more messages, to any buffer, so go over the buffers until a pass delivers nothing.
+	bool delivered = true;
+	while (delivered) {
 
-	//using reverse locking strategy
-	_THREAD_SAFE_LOCK_
+		delivered = false;
 
-	if (flushing) {
-		_THREAD_SAFE_UNLOCK_
-		ERR_FAIL_COND(flushing); //already flushing, you did something odd
-	}
-	flushing = true;
+		for (ThreadBuffer *tb = buffers.load(std::memory_order_acquire); tb; tb = tb->next) {
 
-	while (read_pos < buffer_end) {
+			while (true) {
 
-		//lock on each iteration, so a call can re-add itself to the message queue
+				Chunk *chunk = tb->first;
 
-		Message *message = (Message *)&buffer[read_pos];
+				uint32_t read_pos = chunk->read.load(std::memory_order_acquire);
+				uint32_t end = chunk->end.load(std::memory_order_acquire);
+				if (chunk->read.load(std::memory_order_acquire) != read_pos) {
+					continue; // The owner started over from the beginning of the chunk meanwhile.
+				}
+				if (read_pos >= end) {
+					Chunk *next = chunk->next.load(std::memory_order_acquire);
+					if (!next) {
+						break;
+					}
+					// The owner moved on to the next chunk, so end can't change anymore, but it may have grown
+					// since it was loaded.
+					if (chunk->end.load(std::memory_order_acquire) > read_pos) {
+						continue;
+					}
 
-		uint32_t advance = sizeof(Message);
-		if ((message->type & FLAG_MASK) != TYPE_NOTIFICATION)
-			advance += sizeof(Variant) * message->args;
+					tb->first = next;
+					tb->allocated.fetch_sub(chunk->size, std::memory_order_release);
+					_free_chunk(chunk);
+					continue;
+				}
 
-		//pre-advance so this function is reentrant
-		read_pos += advance;
+				Message *message = (Message *)&chunk->buffer[read_pos];
 
-		_THREAD_SAFE_UNLOCK_
+				Object *target = message->callable.get_object();
 
-		Object *target = message->callable.get_object();
+				if (target != nullptr) {
 
-		if (target != nullptr) {
+					switch (message->type & FLAG_MASK) {
+						case TYPE_CALL: {
 
-			switch (message->type & FLAG_MASK) {
-				case TYPE_CALL: {
+							Variant *args = (Variant *)(message + 1);
 
-					Variant *args = (Variant *)(message + 1);
+							// messages don't expect a return value
 
-					// messages don't expect a return value
+							_call_function(message->callable, args, message->args, message->type & FLAG_SHOW_ERROR);
 
-					_call_function(message->callable, args, message->args, message->type & FLAG_SHOW_ERROR);
+						} break;
+						case TYPE_NOTIFICATION: {
 
-				} break;
-				case TYPE_NOTIFICATION: {
+							// messages don't expect a return value
+							target->notification(message->notification);
 
-					// messages don't expect a return value
-					target->notification(message->notification);
+						} break;
+						case TYPE_SET: {
 
-				} break;
-				case TYPE_SET: {
+							Variant *arg = (Variant *)(message + 1);
+							// messages don't expect a return value
+							target->set(message->callable.get_method(), *arg);
 
-					Variant *arg = (Variant *)(message + 1);
-					// messages don't expect a return value
-					target->set(message->callable.get_method(), *arg);
+						} break;
+					}
+				}
 
-				} break;
-			}
-		}
+				// Only hand the space back to the owner once the message is gone.
+				uint32_t advance;
+				_destroy_message((uint8_t *)message, advance);
+				chunk->read.store(read_pos + advance, std::memory_order_release);
 
-		if ((message->type & FLAG_MASK) != TYPE_NOTIFICATION) {
-			Variant *args = (Variant *)(message + 1);
-			for (int i = 0; i < message->args; i++) {
-				args[i].~Variant();
+				delivered = true;
 			}
 		}
-
-		message->~Message();
-
-		_THREAD_SAFE_LOCK_
 	}
 
-	buffer_end = 0; // reset buffer
-	flushing = false;
-	_THREAD_SAFE_UNLOCK_
+	flushing.store(false, std::memory_order_release);
 }
 
 bool MessageQueue::is_flushing() const {
 
-	return flushing;
+	return flushing.load(std::memory_order_acquire);
 }
 
 MessageQueue::MessageQueue() {
@@ -346,35 +515,39 @@ MessageQueue::MessageQueue() {
 	ERR_FAIL_COND_MSG(singleton != nullptr, "A MessageQueue singleton already exists.");
 	singleton = this;
 	flushing = false;
+	buffers = nullptr;
+	queue_id = ++last_queue_id;
 
-	buffer_end = 0;
-	buffer_max_used = 0;
+	// The limit applies to the chunks of each thread.
 	buffer_size = GLOBAL_DEF_RST("memory/limits/message_queue/max_size_kb", DEFAULT_QUEUE_SIZE_KB);
 	ProjectSettings::get_singleton()->set_custom_property_info("memory/limits/message_queue/max_size_kb", PropertyInfo(Variant::INT, "memory/limits/message_queue/max_size_kb", PROPERTY_HINT_RANGE, "1024,4096,1,or_greater"));
 	buffer_size *= 1024;
-	buffer = memnew_arr(uint8_t, buffer_size);
 }
 
 MessageQueue::~MessageQueue() {
 
-	uint32_t read_pos = 0;
+	singleton = nullptr;
 
-	while (read_pos < buffer_end) {
+	ThreadBuffer *tb = buffers.exchange(nullptr);
+	while (tb) {
+
+		Chunk *chunk = tb->first;
+		while (chunk) {
+			uint32_t read_pos = chunk->read.load(std::memory_order_acquire);
+			uint32_t end = chunk->end.load(std::memory_order_acquire);
+			while (read_pos < end) {
+				uint32_t advance;
+				_destroy_message(&chunk->buffer[read_pos], advance);
+				read_pos += advance;
+			}
 
-		Message *message = (Message *)&buffer[read_pos];
-		Variant *args = (Variant *)(message + 1);
-		int argc = message->args;
-		if ((message->type & FLAG_MASK) != TYPE_NOTIFICATION) {
-			for (int i = 0; i < argc; i++)
-				args[i].~Variant();
+			Chunk *next_chunk = chunk->next.load(std::memory_order_acquire);
+			_free_chunk(chunk);
+			chunk = next_chunk;
 		}
-		message->~Message();
 
-		read_pos += sizeof(Message);
-		if ((message->type & FLAG_MASK) != TYPE_NOTIFICATION)
-			read_pos += sizeof(Variant) * message->args;
+		ThreadBuffer *next = tb->next;
+		memdelete(tb);
+		tb = next;
 	}
-
-	singleton = nullptr;
-	memdelete_arr(buffer);
 }
@@ -34,13 +34,22 @@
 #include "core/object.h"
 #include "core/os/thread_safe.h"
 
+#include <atomic>
+
+// Calls, notifications and property sets deferred until the main thread flushes the queue.
+//
+// Every thread that pushes messages gets a buffer of its own, which only it appends to, so threads never wait
+// for each other to push. flush() goes through the buffers one after the other. The messages of each thread
+// are delivered in the order they were pushed, but there is no order between the messages of different threads.
+//
+// A buffer starts as one small chunk, and grows by chunks twice as large as the last one, so threads that only
+// push a few messages don't hold max_size_kb each. max_size_kb bounds the chunks of each thread.
 class MessageQueue {
 
-	_THREAD_SAFE_CLASS_
-
 	enum {
 
-		DEFAULT_QUEUE_SIZE_KB = 1024
+		DEFAULT_QUEUE_SIZE_KB = 1024,
+		FIRST_CHUNK_SIZE_KB = 16
 	};
 
 	enum {
@@ -62,16 +71,59 @@ class MessageQueue {
 		};
 	};
 
-	uint8_t *buffer;
-	uint32_t buffer_end;
-	uint32_t buffer_max_used;
+	// Part of the messages pushed by one thread. The thread appends at end, and flush() consumes from read.
+	struct Chunk {
+		uint8_t *buffer;
+		uint32_t size;
+		std::atomic<uint32_t> read;
+		std::atomic<uint32_t> end;
+		// Set by the thread when the chunk is full. Nothing is appended to the chunk after that.
+		std::atomic<Chunk *> next;
+	};
+
+	// The messages pushed by one thread, in a list of chunks. The thread appends to the last chunk, and
+	// flush() frees the chunks before it once it has consumed them. The thread moves back to the start
+	// of the last chunk once flush() has consumed everything.
+	struct ThreadBuffer {
+		// Only moved by flush().
+		Chunk *first;
+		// Only moved by the owning thread.
+		Chunk *last;
+		// The size of the chunks of the thread, at most buffer_size.
+		std::atomic<uint32_t> allocated;
+		uint32_t max_used;
+		// Set when the thread exits, so that the next new thread takes over the buffer.
+		std::atomic<bool> orphaned;
+		ThreadBuffer *next;
+	};
+
+	// Every buffer ever given to a thread, newest first. Buffers are only added, until the queue is destroyed.
+	std::atomic<ThreadBuffer *> buffers;
+	// max_size_kb, in bytes.
 	uint32_t buffer_size;
+	// Tells the buffers of this queue apart from those of a queue that was destroyed before it.
+	uint32_t queue_id;
+	static uint32_t last_queue_id;
+
+	// Returns the buffer of the calling thread, taking over an orphaned buffer or creating one the first time.
+	ThreadBuffer *_get_thread_buffer();
+	static void _release_thread_buffer(ThreadBuffer *p_buffer);
+	static Chunk *_create_chunk(uint32_t p_size);
+	static void _free_chunk(Chunk *p_chunk);
+	// Returns where a message of p_size bytes can be written to the buffer, starting a new chunk if the last one
+	// is full, or nullptr if the thread has used up its max_size_kb.
+	// The message is only seen by flush() once _commit_message() is called.
+	uint8_t *_alloc_message(ThreadBuffer *p_buffer, uint32_t p_size);
+	void _commit_message(ThreadBuffer *p_buffer, uint32_t p_size);
+	void _destroy_message(uint8_t *p_message, uint32_t &r_advance);
 
 	void _call_function(const Callable &p_callable, const Variant *p_args, int p_argcount, bool p_show_error);
 
 	static MessageQueue *singleton;
 
-	bool flushing;
+	std::atomic<bool> flushing;
+
+	friend struct MessageQueueThreadBuffer;
 
 public:
 	static MessageQueue *get_singleton();
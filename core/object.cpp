@@ -32,6 +32,7 @@
 
 #include "core/class_db.h"
 #include "core/core_string_names.h"
+#include "core/frame_allocator.h"
 #include "core/message_queue.h"
 #include "core/os/os.h"
 #include "core/print_string.h"
@@ -1158,7 +1159,7 @@ Error Object::emit_signal(const StringName &p_name, const Variant **p_args, int
 
 	OBJ_DEBUG_LOCK
 
-	Vector<const Variant *> bind_mem;
+	FrameVector<const Variant *> bind_mem;
 
 	Error err = OK;
 
@@ -1180,10 +1181,10 @@ Error Object::emit_signal(const StringName &p_name, const Variant **p_args, int
 			bind_mem.resize(p_argcount + c.binds.size());
 
 			for (int j = 0; j < p_argcount; j++) {
-				bind_mem.write[j] = p_args[j];
+				bind_mem[j] = p_args[j];
 			}
 			for (int j = 0; j < c.binds.size(); j++) {
-				bind_mem.write[p_argcount + j] = &c.binds[j];
+				bind_mem[p_argcount + j] = &c.binds[j];
 			}
 
 			args = (const Variant **)bind_mem.ptr();
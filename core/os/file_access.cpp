@@ -40,6 +40,8 @@ FileAccess::CreateFunc FileAccess::create_func[ACCESS_MAX] = { nullptr, nullptr
 
 FileAccess::FileCloseFailNotify FileAccess::close_fail_notify = nullptr;
 
+FileAccess::CachedOpenFunc FileAccess::cached_open_func = nullptr;
+
 bool FileAccess::backup_save = false;
 
 FileAccess *FileAccess::create(AccessType p_access) {
@@ -105,6 +107,15 @@ FileAccess *FileAccess::open(const String &p_path, int p_mode_flags, Error *r_er
 		}
 	}
 
+	if (p_mode_flags == READ && cached_open_func && p_path.begins_with("res://")) {
+		ret = cached_open_func(p_path, false);
+		if (ret) {
+			if (r_error)
+				*r_error = OK;
+			return ret;
+		}
+	}
+
 	ret = create_for_path(p_path);
 	Error err = ret->_open(p_path, p_mode_flags);
 
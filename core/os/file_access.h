@@ -52,6 +52,10 @@ public:
 
 	typedef void (*FileCloseFailNotify)(const String &);
 
+	// Lets a file cache serve read-only opens of resources and of the files inside packs.
+	// p_is_pack is true when the file is a resource pack. Returns nullptr to leave the file to the regular open.
+	typedef FileAccess *(*CachedOpenFunc)(const String &p_path, bool p_is_pack);
+
 	typedef FileAccess *(*CreateFunc)();
 	bool endian_swap;
 	bool real_is_double;
@@ -65,6 +69,7 @@ protected:
 	virtual uint64_t _get_modified_time(const String &p_file) = 0;
 
 	static FileCloseFailNotify close_fail_notify;
+	static CachedOpenFunc cached_open_func;
 
 private:
 	static bool backup_save;
@@ -79,6 +84,8 @@ private:
 
 public:
 	static void set_file_close_fail_notify_callback(FileCloseFailNotify p_cbk) { close_fail_notify = p_cbk; }
+	static void set_cached_open_func(CachedOpenFunc p_func) { cached_open_func = p_func; }
+	static CachedOpenFunc get_cached_open_func() { return cached_open_func; }
 
 	virtual void _set_access_type(AccessType p_access);
 
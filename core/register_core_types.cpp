@@ -67,6 +67,7 @@
 #include "core/packed_data_container.h"
 #include "core/path_remap.h"
 #include "core/project_settings.h"
+#include "core/thread_work_pool.h"
 #include "core/translation.h"
 #include "core/undo_redo.h"
 
@@ -90,6 +91,8 @@ static IP *ip = nullptr;
 
 static _Geometry *_geometry = nullptr;
 
+static ThreadWorkPool *thread_work_pool = nullptr;
+
 extern Mutex _global_mutex;
 
 extern void register_global_constants();
@@ -215,6 +218,9 @@ void register_core_types() {
 
 	ip = IP::create();
 
+	thread_work_pool = memnew(ThreadWorkPool);
+	thread_work_pool->init();
+
 	_geometry = memnew(_Geometry);
 
 	_resource_loader = memnew(_ResourceLoader);
@@ -281,6 +287,8 @@ void unregister_core_types() {
 
 	memdelete(_geometry);
 
+	memdelete(thread_work_pool);
+
 	ResourceLoader::remove_resource_format_loader(resource_format_image);
 	resource_format_image.unref();
 
@@ -29,55 +29,225 @@
 /*************************************************************************/
 
 #include "thread_work_pool.h"
+
 #include "core/os/os.h"
 
-void ThreadWorkPool::_thread_function(ThreadData *p_thread) {
+ThreadWorkPool *ThreadWorkPool::singleton = nullptr;
+
+// Set by each worker when it starts, so that a thread finds its deque without searching for itself.
+// The pool is kept along with the index, as a worker of one pool may start a loop on another.
+static thread_local const ThreadWorkPool *current_pool = nullptr;
+static thread_local uint32_t current_deque = 0;
+
+void ThreadWorkPool::_thread_function(Worker *p_worker) {
+
+	Worker &worker = *p_worker;
+	ThreadWorkPool &pool = *worker.pool;
+
+	current_pool = &pool;
+	current_deque = worker.index;
 
 	while (true) {
-		p_thread->start.wait();
-		if (p_thread->exit.load()) {
+		pool.task_available.wait();
+
+		if (pool.exit_threads) {
 			break;
 		}
-		p_thread->work->work();
-		p_thread->completed.post();
+
+		// The task that woke the worker may have been taken already by another thread, which is fine.
+		Task task;
+		while (pool.pop_task(worker.index, task) || pool.steal_task(worker.index, task)) {
+			pool.run_task(worker.index, task);
+		}
+	}
+}
+
+uint32_t ThreadWorkPool::get_deque_index() const {
+
+	return current_pool == this ? current_deque : worker_count;
+}
+
+void ThreadWorkPool::push_task(uint32_t p_deque, const Task &p_task) {
+
+	{
+		MutexLock lock(deques[p_deque].mutex);
+		deques[p_deque].tasks.push_back(p_task);
 	}
+
+	task_available.post();
+}
+
+bool ThreadWorkPool::pop_task(uint32_t p_deque, Task &r_task) {
+
+	MutexLock lock(deques[p_deque].mutex);
+
+	int size = deques[p_deque].tasks.size();
+	if (size == 0) {
+		return false;
+	}
+
+	r_task = deques[p_deque].tasks[size - 1];
+	deques[p_deque].tasks.resize(size - 1);
+	return true;
+}
+
+bool ThreadWorkPool::steal_task(uint32_t p_deque, Task &r_task) {
+
+	// Starting from the next deque spreads the thieves over the victims.
+	for (uint32_t i = 1; i <= worker_count; i++) {
+
+		TaskDeque &victim = deques[(p_deque + i) % (worker_count + 1)];
+		MutexLock lock(victim.mutex);
+
+		// The front holds the oldest task, which is also the largest range.
+		if (victim.tasks.size()) {
+			r_task = victim.tasks[0];
+			victim.tasks.remove(0);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadWorkPool::run_task(uint32_t p_deque, Task p_task) {
+
+	BaseWork *work = p_task.work;
+
+	while (p_task.to - p_task.from > work->grain) {
+		uint32_t middle = p_task.from + (p_task.to - p_task.from) / 2;
+
+		Task upper = { work, middle, p_task.to };
+		push_task(p_deque, upper);
+
+		p_task.to = middle;
+	}
+
+	work->run(p_task.from, p_task.to);
+
+	if (atomic_sub(&work->remaining, p_task.to - p_task.from) == 0) {
+		work->finish();
+	}
+}
+
+void ThreadWorkPool::process(BaseWork *p_work, uint32_t p_begin, uint32_t p_end) {
+
+	if (p_end <= p_begin) {
+		return;
+	}
+
+	uint32_t elements = p_end - p_begin;
+
+	if (p_work->grain == 0) {
+		p_work->grain = MAX(elements / (get_thread_count() * 8), 1u);
+	}
+
+	// Small loops, and all of them without threads, are run right away.
+	if (worker_count == 0 || elements <= p_work->grain) {
+		p_work->run(p_begin, p_end);
+		return;
+	}
+
+	p_work->remaining = elements;
+
+	Task task = { p_work, p_begin, p_end };
+	run_task(get_deque_index(), task);
+
+	wait_work(p_work);
+}
+
+void ThreadWorkPool::push_work(BaseWork *p_work, uint32_t p_begin, uint32_t p_end) {
+
+	Task task = { p_work, p_begin, p_end };
+	push_task(get_deque_index(), task);
+}
+
+void ThreadWorkPool::wait_work(BaseWork *p_work) {
+
+	uint32_t deque = get_deque_index();
+	Task task;
+
+	// Helps with the rest of the work, or with any other work, until there is nothing left to take.
+	while (p_work->remaining > 0 && (pop_task(deque, task) || steal_task(deque, task))) {
+		run_task(deque, task);
+	}
+
+	// The thread that processes the last elements posts done, even when it is this one.
+	// Returning without waiting for it could free the work while it is being posted.
+	p_work->done.wait();
 }
 
 void ThreadWorkPool::init(int p_thread_count) {
-	ERR_FAIL_COND(threads != nullptr);
+
+	ERR_FAIL_COND(workers != nullptr);
+
+#ifdef NO_THREADS
+	p_thread_count = 0;
+#else
 	if (p_thread_count < 0) {
-		p_thread_count = OS::get_singleton()->get_processor_count();
+		// The thread that starts a loop takes part in it, so it doesn't need a worker of its own.
+		p_thread_count = OS::get_singleton()->get_processor_count() - 1;
+	}
+#endif
+
+	if (p_thread_count <= 0) {
+		return;
 	}
 
-	thread_count = p_thread_count;
-	threads = memnew_arr(ThreadData, thread_count);
+	// The last deque is shared by the threads that are not workers.
+	memdelete_arr(deques);
+	worker_count = p_thread_count;
+	deques = memnew_arr(TaskDeque, worker_count + 1);
+	workers = memnew_arr(Worker, worker_count);
+	exit_threads = false;
 
-	for (uint32_t i = 0; i < thread_count; i++) {
-		threads[i].exit.store(false);
-		threads[i].thread = memnew(std::thread(ThreadWorkPool::_thread_function, &threads[i]));
+	for (uint32_t i = 0; i < worker_count; i++) {
+		workers[i].pool = this;
+		workers[i].index = i;
+		workers[i].thread = memnew(std::thread(ThreadWorkPool::_thread_function, &workers[i]));
 	}
 }
 
 void ThreadWorkPool::finish() {
 
-	if (threads == nullptr) {
+	if (workers == nullptr) {
 		return;
 	}
 
-	for (uint32_t i = 0; i < thread_count; i++) {
-		threads[i].exit.store(true);
-		threads[i].start.post();
+	exit_threads = true;
+
+	for (uint32_t i = 0; i < worker_count; i++) {
+		task_available.post();
 	}
-	for (uint32_t i = 0; i < thread_count; i++) {
-		threads[i].thread->join();
-		memdelete(threads[i].thread);
+
+	for (uint32_t i = 0; i < worker_count; i++) {
+		workers[i].thread->join();
+		memdelete(workers[i].thread);
 	}
 
-	memdelete_arr(threads);
-	threads = nullptr;
+	memdelete_arr(workers);
+	workers = nullptr;
+	worker_count = 0;
+}
+
+ThreadWorkPool::ThreadWorkPool() {
+
+	if (!singleton) {
+		singleton = this;
+	}
+
+	worker_count = 0;
+	deques = memnew_arr(TaskDeque, 1);
+	workers = nullptr;
+	exit_threads = false;
 }
 
 ThreadWorkPool::~ThreadWorkPool() {
 
 	finish();
+	memdelete_arr(deques);
+
+	if (singleton == this) {
+		singleton = nullptr;
+	}
 }
@@ -32,80 +32,144 @@
 #define THREAD_WORK_POOL_H
 
 #include "core/os/memory.h"
+#include "core/os/mutex.h"
 #include "core/os/semaphore.h"
-#include <atomic>
+#include "core/safe_refcount.h"
+#include "core/vector.h"
+
 #include <thread>
+
+// A pool of persistent worker threads, for splitting loops over many elements between the cores.
+//
+// Each worker has its own deque of tasks, every task being a range of elements of a loop. A worker takes its tasks
+// from the back of its deque, and steals from the front of the other deques when it runs out. A range larger than
+// the grain of its loop is split in two: the worker keeps the lower half and pushes the upper half for others to
+// steal, so big ranges are split where there are idle workers to take them, and not upfront.
+//
+// The thread that starts a loop runs tasks as well until none are left, then waits for the workers to finish theirs.
+// Loops can be started from inside a loop. Until init() is called, and if it is given no threads,
+// loops are run by the thread that starts them.
+//
+// The engine-wide pool is set up along with the core types, and is returned by get_singleton().
 class ThreadWorkPool {
 
-	std::atomic<uint32_t> index;
+	friend class JobGraph;
 
+	// A loop being processed, or a job of a JobGraph. Loops live on the stack of the thread that started them.
 	struct BaseWork {
-		std::atomic<uint32_t> *index;
-		uint32_t max_elements;
-		virtual void work() = 0;
-		virtual ~BaseWork() = default;
+		uint32_t grain;
+		// The elements that are not processed yet. The thread that brings it to 0 calls finish().
+		volatile uint32_t remaining;
+		Semaphore done;
+
+		virtual void run(uint32_t p_from, uint32_t p_to) = 0;
+		virtual void finish() { done.post(); }
+		virtual ~BaseWork() {}
 	};
 
 	template <class C, class M, class U>
-	struct Work : public BaseWork {
+	struct MethodWork : public BaseWork {
 		C *instance;
 		M method;
 		U userdata;
-		virtual void work() {
-
-			while (true) {
-				uint32_t work_index = index->fetch_add(1, std::memory_order_relaxed);
-				if (work_index >= max_elements) {
-					break;
-				}
-				(instance->*method)(work_index, userdata);
+
+		virtual void run(uint32_t p_from, uint32_t p_to) {
+			for (uint32_t i = p_from; i < p_to; i++) {
+				(instance->*method)(i, userdata);
 			}
 		}
 	};
 
-	struct ThreadData {
-		std::thread *thread;
-		Semaphore start;
-		Semaphore completed;
-		std::atomic<bool> exit;
-		BaseWork *work;
-	};
-
-	ThreadData *threads = nullptr;
-	uint32_t thread_count = 0;
+	template <class F>
+	struct FunctionWork : public BaseWork {
+		F *function;
 
-	static void _thread_function(ThreadData *p_thread);
+		virtual void run(uint32_t p_from, uint32_t p_to) {
+			for (uint32_t i = p_from; i < p_to; i++) {
+				(*function)(i);
+			}
+		}
+	};
 
-public:
-	template <class C, class M, class U>
-	void do_work(uint32_t p_elements, C *p_instance, M p_method, U p_userdata) {
+	struct Task {
+		BaseWork *work;
+		uint32_t from;
+		uint32_t to;
+	};
 
-		ERR_FAIL_COND(!threads); //never initialized
+	struct TaskDeque {
+		BinaryMutex mutex;
+		Vector<Task> tasks;
+	};
 
-		index.store(0);
+	struct Worker {
+		ThreadWorkPool *pool;
+		std::thread *thread;
+		uint32_t index;
+	};
 
-		Work<C, M, U> *w = memnew((Work<C, M, U>));
-		w->instance = p_instance;
-		w->userdata = p_userdata;
-		w->method = p_method;
-		w->index = &index;
-		w->max_elements = p_elements;
+	static ThreadWorkPool *singleton;
+
+	// One deque per worker, and a last one for the threads that are not workers.
+	TaskDeque *deques;
+	Worker *workers;
+	uint32_t worker_count;
+	// Posted once for every task pushed, so that a sleeping worker wakes up to take it.
+	Semaphore task_available;
+	volatile bool exit_threads;
+
+	static void _thread_function(Worker *p_worker);
+
+	// The deque of the calling thread: its worker's deque, or the shared one for threads outside the pool.
+	uint32_t get_deque_index() const;
+	void push_task(uint32_t p_deque, const Task &p_task);
+	bool pop_task(uint32_t p_deque, Task &r_task);
+	bool steal_task(uint32_t p_deque, Task &r_task);
+	// Runs the task, pushing the upper half of it back to the deque as long as it is larger than its grain.
+	void run_task(uint32_t p_deque, Task p_task);
+	void process(BaseWork *p_work, uint32_t p_begin, uint32_t p_end);
+
+	// Queues the elements from p_begin to p_end of the work, without waiting for them.
+	// The remaining elements of the work must be set first.
+	void push_work(BaseWork *p_work, uint32_t p_begin, uint32_t p_end);
+	// Runs queued tasks until the work is done, or until there is nothing left to take and only
+	// waiting is left. Returns once the work is finished.
+	void wait_work(BaseWork *p_work);
 
-		for (uint32_t i = 0; i < thread_count; i++) {
-			threads[i].work = w;
-			threads[i].start.post();
-		}
-		for (uint32_t i = 0; i < thread_count; i++) {
-			threads[i].completed.wait();
-			threads[i].work = nullptr;
-		}
+public:
+	static ThreadWorkPool *get_singleton() { return singleton; }
+
+	// The number of threads that process a loop, counting the one that started it.
+	uint32_t get_thread_count() const { return worker_count + 1; }
+
+	// Calls p_function(i) for every i from p_begin to p_end, and returns once all the calls are done.
+	// The calls are made from several threads, in no particular order. A task covers at most p_grain elements,
+	// which are processed in a row by the same thread. If p_grain is 0, the range is split into about 8 tasks per thread.
+	template <class F>
+	void parallel_for(uint32_t p_begin, uint32_t p_end, F p_function, uint32_t p_grain = 0) {
+		FunctionWork<F> work;
+		work.function = &p_function;
+		work.grain = p_grain;
+		process(&work, p_begin, p_end);
+	}
 
-		memdelete(w);
+	// Calls (p_instance->*p_method)(i, p_userdata) for every i below p_elements, like the former thread_process_array().
+	template <class C, class M, class U>
+	void do_work(uint32_t p_elements, C *p_instance, M p_method, U p_userdata, uint32_t p_grain = 0) {
+		MethodWork<C, M, U> work;
+		work.instance = p_instance;
+		work.method = p_method;
+		work.userdata = p_userdata;
+		work.grain = p_grain;
+		process(&work, 0, p_elements);
 	}
 
+	// Starts the worker threads. By default, there is one per core except for the calling thread.
 	void init(int p_thread_count = -1);
 	void finish();
+
+	ThreadWorkPool();
 	~ThreadWorkPool();
 };
 
-#endif // THREAD_POOL_H
+#endif // THREAD_WORK_POOL_H
@@ -32,6 +32,7 @@
 
 #include "core/crypto/crypto.h"
 #include "core/debugger/engine_debugger.h"
+#include "core/frame_allocator.h"
 #include "core/input/input.h"
 #include "core/input/input_map.h"
 #include "core/io/file_access_network.h"
@@ -40,6 +41,7 @@
 #include "core/io/image_loader.h"
 #include "core/io/ip.h"
 #include "core/io/resource_loader.h"
+#include "core/job_graph.h"
 #include "core/message_queue.h"
 #include "core/os/dir_access.h"
 #include "core/os/os.h"
@@ -159,6 +161,11 @@ static bool debug_navigation = false;
 static int frame_delay = 0;
 static bool disable_render_loop = false;
 static int fixed_fps = -1;
+static bool parallel_physics_step = false;
+// Steps the 2D and 3D physics servers at the same time, when parallel_physics_step is enabled and allowed.
+// Built once, and reset after each step.
+static JobGraph *physics_jobs = nullptr;
+static float physics_jobs_step = 0;
 static bool print_fps = false;
 
 /* Helper methods */
@@ -201,10 +208,34 @@ void initialize_physics() {
 	}
 	ERR_FAIL_COND(!physics_2d_server);
 	physics_2d_server->init();
+
+	if (parallel_physics_step) {
+		// Only the built-in servers are known to share no state while stepping: step() only touches their own spaces,
+		// and they call back into scenes and scripts from flush_queries(). With the multi-threaded 2D server, the
+		// 2D step is only queued for its own thread anyway.
+		if (!physics_server->is_class("PhysicsServer3DSW") || !physics_2d_server->is_class("PhysicsServer2DSW")) {
+			print_verbose("Physics: Parallel step disabled, it is only supported by the built-in physics servers on the main thread.");
+			return;
+		}
+
+		physics_jobs = memnew(JobGraph);
+		physics_jobs->add_job([]() {
+			PhysicsServer3D::get_singleton()->step(physics_jobs_step);
+		});
+		physics_jobs->add_job([]() {
+			PhysicsServer2D::get_singleton()->end_sync();
+			PhysicsServer2D::get_singleton()->step(physics_jobs_step);
+		});
+	}
 }
 
 void finalize_physics() {
 
+	if (physics_jobs) {
+		memdelete(physics_jobs);
+		physics_jobs = nullptr;
+	}
+
 	physics_server->finish();
 	memdelete(physics_server);
 
@@ -1159,6 +1190,7 @@ Error Main::setup(const char *execpath, int argc, char *argv[], bool p_second_ph
 	Engine::get_singleton()->set_iterations_per_second(GLOBAL_DEF("physics/common/physics_fps", 60));
 	ProjectSettings::get_singleton()->set_custom_property_info("physics/common/physics_fps", PropertyInfo(Variant::INT, "physics/common/physics_fps", PROPERTY_HINT_RANGE, "1,120,1,or_greater"));
 	Engine::get_singleton()->set_physics_jitter_fix(GLOBAL_DEF("physics/common/physics_jitter_fix", 0.5));
+	parallel_physics_step = GLOBAL_DEF("physics/common/parallel_step", false);
 	Engine::get_singleton()->set_target_fps(GLOBAL_DEF("debug/settings/fps/force_fps", 0));
 	ProjectSettings::get_singleton()->set_custom_property_info("debug/settings/fps/force_fps", PropertyInfo(Variant::INT, "debug/settings/fps/force_fps", PROPERTY_HINT_RANGE, "0,120,1,or_greater"));
 
@@ -2157,10 +2189,18 @@ bool Main::iteration() {
 
 		message_queue->flush();
 
-		PhysicsServer3D::get_singleton()->step(frame_slice * time_scale);
+		if (physics_jobs) {
+			// See initialize_physics() for why the servers can step at the same time.
+			// Both are done before the message queue is flushed, so nothing else sees them mid-step.
+			physics_jobs_step = frame_slice * time_scale;
+			physics_jobs->submit();
+			physics_jobs->reset();
+		} else {
+			PhysicsServer3D::get_singleton()->step(frame_slice * time_scale);
 
-		PhysicsServer2D::get_singleton()->end_sync();
-		PhysicsServer2D::get_singleton()->step(frame_slice * time_scale);
+			PhysicsServer2D::get_singleton()->end_sync();
+			PhysicsServer2D::get_singleton()->step(frame_slice * time_scale);
+		}
 
 		message_queue->flush();
 
@@ -2209,6 +2249,7 @@ bool Main::iteration() {
 
 	frames++;
 	Engine::get_singleton()->_idle_frames++;
+	FrameAllocator::end_frame();
 
 	if (frame > 1000000) {
 
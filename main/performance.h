@@ -31,6 +31,7 @@
 #ifndef PERFORMANCE_H
 #define PERFORMANCE_H
 
+#include "core/hash_map.h"
 #include "core/object.h"
 
 #define PERF_WARN_OFFLINE_FUNCTION
@@ -48,6 +49,19 @@ class Performance : public Object {
 	float _process_time;
 	float _physics_process_time;
 
+	class MonitorCall {
+		Callable _callable;
+		Vector<Variant> _arguments;
+
+	public:
+		MonitorCall(Callable p_callable, Vector<Variant> p_arguments);
+		MonitorCall();
+		Variant call(bool &r_error, String &r_error_message);
+	};
+
+	HashMap<StringName, MonitorCall> _monitor_map;
+	uint64_t _monitor_modification_time;
+
 public:
 	enum Monitor {
 
@@ -93,6 +107,15 @@ public:
 
 	MonitorType get_monitor_type(Monitor p_monitor) const;
 
+	// Custom monitors are read by calling p_callable with p_args, and should return a number.
+	void add_custom_monitor(const StringName &p_id, const Callable &p_callable, const Array &p_args = Array());
+	void remove_custom_monitor(const StringName &p_id);
+	bool has_custom_monitor(const StringName &p_id);
+	Variant get_custom_monitor(const StringName &p_id);
+	Array get_custom_monitor_names();
+	// Changes whenever a custom monitor is added or removed.
+	uint64_t get_monitor_modification_time();
+
 	void set_process_time(float p_pt);
 	void set_physics_process_time(float p_pt);
 
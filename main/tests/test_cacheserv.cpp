@@ -0,0 +1,553 @@
+/*************************************************************************/
+/*  test_cacheserv.cpp                                                   */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "test_cacheserv.h"
+
+#include "core/math/random_number_generator.h"
+#include "core/os/dir_access.h"
+#include "core/os/file_access.h"
+#include "core/os/os.h"
+#include "core/os/thread.h"
+
+#include "modules/modules_enabled.gen.h"
+
+#ifdef MODULE_CACHESERV_ENABLED
+
+#include "modules/cacheserv/file_cache_manager.h"
+
+namespace TestCacheserv {
+
+struct PolicyInfo {
+	int policy;
+	const char *name;
+};
+
+static const PolicyInfo policies[] = {
+	{ _FileCacheManager::LRU, "LRU" },
+	{ _FileCacheManager::FIFO, "FIFO" },
+	{ _FileCacheManager::CLOCK, "CLOCK" },
+	{ _FileCacheManager::ARC, "ARC" },
+};
+
+// Builds a trace of page indices where a hot set that fits in half the cache is read at random,
+// interrupted by sequential scans over pages that are never read again.
+static Vector<uint32_t> make_scan_and_hot_set_trace(uint32_t p_num_frames, int p_rounds, uint32_t &r_num_pages) {
+
+	RandomNumberGenerator rng;
+	rng.set_seed(1234);
+
+	uint32_t hot_pages = p_num_frames / 2;
+	uint32_t scan_pages = p_num_frames * 2;
+	uint32_t next_cold_page = hot_pages;
+
+	Vector<uint32_t> trace;
+
+	for (int round = 0; round < p_rounds; ++round) {
+
+		for (uint32_t i = 0; i < hot_pages * 4; ++i) {
+			trace.push_back(rng.randi() % hot_pages);
+		}
+
+		for (uint32_t i = 0; i < scan_pages; ++i) {
+			trace.push_back(next_cold_page++);
+		}
+	}
+
+	r_num_pages = next_cold_page;
+	return trace;
+}
+
+// Reads one byte from each page of the trace and returns the fraction of reads that found their page in the cache.
+static float replay_trace(const String &p_path, int p_policy, const Vector<uint32_t> &p_trace) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID rid = fcm->open(p_path, FileAccess::READ, p_policy);
+	ERR_FAIL_COND_V(!rid.is_valid(), 0);
+
+	uint32_t hits = 0;
+	uint8_t byte;
+
+	for (int i = 0; i < p_trace.size(); ++i) {
+
+		size_t offset = (size_t)p_trace[i] * CS_PAGE_SIZE;
+		fcm->seek(rid, offset);
+
+		if (fcm->has_page(rid, offset)) {
+			hits += 1;
+		}
+
+		fcm->check_cache(rid, 1);
+		fcm->read(rid, &byte, 1);
+	}
+
+	fcm->permanent_close(rid);
+
+	return (float)hits / p_trace.size();
+}
+
+// Pins a range over several pages and checks that the spans hold the file data,
+// and that the pinned pages stay in the cache while the rest of the file is read through it.
+static bool test_pinning(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID rid = fcm->open(p_path, FileAccess::READ, _FileCacheManager::LRU);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	size_t offset = CS_PAGE_SIZE / 2;
+	size_t length = CS_PAGE_SIZE * 4;
+	FileCacheManager::PinnedRange range;
+	bool ok = fcm->pin(rid, offset, length, range) == OK && range.length == length;
+
+	size_t pos = offset;
+	for (int i = 0; i < range.spans.size(); ++i) {
+		for (size_t j = 0; j < range.spans[i].size; ++j, ++pos) {
+			ok = ok && range.spans[i].ptr[j] == ((pos / CS_PAGE_SIZE) & 0xFF);
+		}
+	}
+
+	uint8_t byte;
+	for (uint32_t i = 8; i < p_num_pages; ++i) {
+		fcm->seek(rid, (size_t)i * CS_PAGE_SIZE);
+		fcm->check_cache(rid, 1);
+		fcm->read(rid, &byte, 1);
+	}
+
+	for (size_t i = CS_GET_PAGE(offset); i < offset + length; i += CS_PAGE_SIZE) {
+		ok = ok && fcm->has_page(rid, i);
+	}
+
+	fcm->unpin(range);
+	fcm->permanent_close(rid);
+
+	return ok;
+}
+
+// Reads the file through a memory mapping and checks a byte from each page.
+static bool test_mmap(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID rid = fcm->open(p_path, FileAccess::READ, _FileCacheManager::FIFO, true);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	bool ok = true;
+	uint8_t byte;
+	for (uint32_t i = 0; i < p_num_pages; ++i) {
+		fcm->seek(rid, (size_t)i * CS_PAGE_SIZE + 1);
+		ok = ok && fcm->read(rid, &byte, 1) == 1 && byte == (i & 0xFF);
+	}
+
+	fcm->permanent_close(rid);
+
+	return ok;
+}
+
+// Saves a manifest while a file is cached, and checks that it lists the cached pages of that file.
+static bool test_manifest(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID rid = fcm->open(p_path, FileAccess::READ, _FileCacheManager::LRU);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	uint8_t byte;
+	for (uint32_t i = 0; i < MIN(p_num_pages, 8u); ++i) {
+		fcm->read_at(rid, (size_t)i * CS_PAGE_SIZE, &byte, 1);
+	}
+
+	String manifest_path = p_path + ".csm";
+	bool ok = fcm->save_manifest(manifest_path) == OK;
+
+	fcm->permanent_close(rid);
+
+	FileAccess *f = FileAccess::open(manifest_path, FileAccess::READ);
+	ERR_FAIL_COND_V(!f, false);
+
+	ok = ok && f->get_32() == CS_MANIFEST_MAGIC && f->get_32() == CS_MANIFEST_VERSION;
+
+	bool found = false;
+	uint32_t file_count = f->get_32();
+	for (uint32_t i = 0; ok && i < file_count; ++i) {
+		String path = f->get_pascal_string();
+		f->get_64();
+		f->get_64();
+		f->get_32();
+		uint32_t page_count = f->get_32();
+		for (uint32_t j = 0; j < page_count; ++j) {
+			f->get_64();
+			f->get_32();
+		}
+		found = found || (path == p_path && page_count >= MIN(p_num_pages, 8u));
+	}
+
+	f->close();
+	memdelete(f);
+
+	DirAccess *da = DirAccess::create(DirAccess::ACCESS_FILESYSTEM);
+	da->remove(manifest_path);
+	memdelete(da);
+
+	return ok && found;
+}
+
+// Stores more pages than the compressed tier can hold, and checks that the newest ones come back intact
+// while the oldest ones were dropped to make room for them.
+static bool test_compressed_tier() {
+
+	CompressedTier tier;
+	if (tier.init(CS_PAGE_SIZE, Compression::MODE_ZSTD) != OK) {
+		return false;
+	}
+
+	Vector<uint8_t> page;
+	page.resize(CS_PAGE_SIZE);
+
+	const uint32_t num_pages = 64;
+	bool ok = true;
+	for (uint32_t i = 0; i < num_pages; ++i) {
+		for (uint32_t j = 0; j < CS_PAGE_SIZE; ++j) {
+			page.write[j] = (j / 64 + i) & 0xFF;
+		}
+		ok = ok && tier.store(i, page.ptr(), CS_PAGE_SIZE);
+	}
+
+	ok = ok && tier.get_page_count() < num_pages && tier.get_dropped() > 0;
+	ok = ok && tier.take(0, page.ptrw()) == -1;
+
+	uint32_t last = num_pages - 1;
+	ok = ok && tier.take(last, page.ptrw()) == (int)CS_PAGE_SIZE;
+	for (uint32_t j = 0; j < CS_PAGE_SIZE; ++j) {
+		ok = ok && page[j] == ((j / 64 + last) & 0xFF);
+	}
+
+	// A page is handed out only once.
+	ok = ok && tier.take(last, page.ptrw()) == -1;
+
+	return ok;
+}
+
+struct ConcurrentReader {
+	RID rid;
+	uint32_t num_pages;
+	uint32_t seed;
+	bool ok;
+};
+
+// Queues prefetch loads for the whole file and cancels them right away, then checks that every page
+// still reads back correctly, whether its load ran, was skipped, or was queued again.
+static bool test_cancellation(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID rid = fcm->open(p_path, FileAccess::READ, _FileCacheManager::LRU);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	fcm->set_io_priority(rid, _FileCacheManager::IO_PRIORITY_PREFETCH);
+	bool ok = fcm->get_io_priority(rid) == _FileCacheManager::IO_PRIORITY_PREFETCH;
+
+	uint32_t pages = MIN(p_num_pages, (uint32_t)CS_NUM_FRAMES / 2);
+	fcm->seek(rid, 0);
+	fcm->check_cache(rid, (size_t)pages * CS_PAGE_SIZE);
+	fcm->cancel_loads(rid);
+
+	uint8_t byte;
+	for (uint32_t i = 0; i < pages; ++i) {
+		ok = ok && fcm->read_at(rid, (size_t)i * CS_PAGE_SIZE + 1, &byte, 1) == 1 && byte == (i & 0xFF);
+	}
+
+	fcm->permanent_close(rid);
+
+	return ok;
+}
+
+// Opens the file for reading twice, like two files inside the same pack, and checks that both opens
+// share the cached file, which stays readable until the last of them is closed.
+static bool test_shared_open(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID first = fcm->open(p_path, FileAccess::READ, _FileCacheManager::LRU);
+	RID second = fcm->open(p_path, FileAccess::READ, _FileCacheManager::LRU);
+	ERR_FAIL_COND_V(!first.is_valid(), false);
+
+	bool ok = second == first;
+	fcm->close(second);
+
+	uint8_t byte;
+	for (uint32_t i = 0; i < p_num_pages; i += 7) {
+		ok = ok && fcm->read_at(first, (size_t)i * CS_PAGE_SIZE, &byte, 1) == 1 && byte == (i & 0xFF);
+	}
+
+	fcm->permanent_close(first);
+
+	return ok;
+}
+
+// Reads the file with direct IO, which falls back to regular reads where the file system doesn't support it.
+static bool test_direct_io(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	bool use_direct_io = fcm->get_use_direct_io();
+	fcm->set_use_direct_io(true);
+
+	RID rid = fcm->open(p_path, FileAccess::READ, _FileCacheManager::FIFO);
+	fcm->set_use_direct_io(use_direct_io);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	bool ok = true;
+	uint8_t byte;
+	for (uint32_t i = 0; i < p_num_pages; ++i) {
+		ok = ok && fcm->read_at(rid, (size_t)i * CS_PAGE_SIZE + CS_PAGE_SIZE - 1, &byte, 1) == 1 && byte == (i & 0xFF);
+	}
+
+	fcm->permanent_close(rid);
+
+	return ok;
+}
+
+struct AsyncReadResult {
+	volatile bool done;
+	Error error;
+	size_t length;
+};
+
+static void async_read_callback(void *p_udata, Error p_error, size_t p_length) {
+	AsyncReadResult *result = (AsyncReadResult *)p_udata;
+	result->error = p_error;
+	result->length = p_length;
+	result->done = true;
+}
+
+// Makes several async reads at once, one of them past the end of the file, and checks that each gets its data.
+static bool test_async_reads(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID rid = fcm->open(p_path, FileAccess::READ, _FileCacheManager::LRU);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	const int count = 4;
+	size_t offsets[count] = { 0, (size_t)(p_num_pages / 2) * CS_PAGE_SIZE + 3, (size_t)(p_num_pages / 3) * CS_PAGE_SIZE, (size_t)(p_num_pages - 1) * CS_PAGE_SIZE };
+	Vector<uint8_t> buffers[count];
+	AsyncReadResult results[count];
+	bool ok = true;
+
+	for (int i = 0; i < count; ++i) {
+		buffers[i].resize(CS_PAGE_SIZE * 2);
+		results[i].done = false;
+		ok = ok && fcm->read_async(rid, offsets[i], buffers[i].ptrw(), CS_PAGE_SIZE * 2, async_read_callback, &results[i]) == OK;
+	}
+
+	// Closing the file waits for its async reads.
+	fcm->close(rid);
+
+	for (int i = 0; i < count; ++i) {
+		size_t expected = MIN((size_t)CS_PAGE_SIZE * 2, (size_t)p_num_pages * CS_PAGE_SIZE - offsets[i]);
+		ok = ok && results[i].done && results[i].error == OK && results[i].length == expected;
+
+		for (size_t j = 0; ok && j < results[i].length; j += 512) {
+			ok = buffers[i][j] == (((offsets[i] + j) / CS_PAGE_SIZE) & 0xFF);
+		}
+	}
+
+	fcm->permanent_close(rid);
+
+	return ok;
+}
+
+// Dirties more frames than the high watermark and checks that the background flusher writes them back
+// while the file is still open, and that the file holds the written data once it is closed.
+static bool test_background_flush(const String &p_path) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	if (fcm->get_dirty_high_watermark() <= 0 || fcm->get_dirty_high_watermark() >= 1) {
+		return true;
+	}
+
+	RID rid = fcm->open(p_path, FileAccess::WRITE_READ, _FileCacheManager::LRU);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	uint64_t background_write_backs = fcm->get_stats()["background_write_backs"];
+	uint32_t num_pages = (fcm->get_dirty_high_watermark() + 1) / 2 * CS_NUM_FRAMES;
+
+	Vector<uint8_t> page;
+	page.resize(CS_PAGE_SIZE);
+	for (uint32_t i = 0; i < num_pages; ++i) {
+		memset(page.ptrw(), (i * 3) & 0xFF, CS_PAGE_SIZE);
+		fcm->seek(rid, (size_t)i * CS_PAGE_SIZE);
+		fcm->check_cache(rid, CS_PAGE_SIZE);
+		fcm->write(rid, page.ptr(), CS_PAGE_SIZE);
+	}
+
+	bool flushed = false;
+	for (int i = 0; i < 40 && !flushed; ++i) {
+		OS::get_singleton()->delay_usec(CS_FLUSHER_INTERVAL_USEC);
+		flushed = (uint64_t)fcm->get_stats()["background_write_backs"] > background_write_backs;
+	}
+
+	fcm->permanent_close(rid);
+
+	FileAccess *f = FileAccess::open(p_path, FileAccess::READ);
+	ERR_FAIL_COND_V(!f, false);
+
+	bool ok = flushed && f->get_len() == (size_t)num_pages * CS_PAGE_SIZE;
+	for (uint32_t i = 0; i < num_pages && ok; ++i) {
+		f->seek((size_t)i * CS_PAGE_SIZE + CS_PAGE_SIZE / 2);
+		ok = f->get_8() == ((i * 3) & 0xFF);
+	}
+
+	f->close();
+	memdelete(f);
+
+	DirAccess *da = DirAccess::create(DirAccess::ACCESS_FILESYSTEM);
+	da->remove(p_path);
+	memdelete(da);
+
+	return ok;
+}
+
+static void concurrent_reader_func(void *p_udata) {
+
+	ConcurrentReader *reader = (ConcurrentReader *)p_udata;
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+
+	RandomNumberGenerator rng;
+	rng.set_seed(reader->seed);
+
+	uint8_t buf[16];
+	for (int i = 0; i < 4096; ++i) {
+		uint32_t page = rng.randi() % reader->num_pages;
+		size_t offset = (size_t)page * CS_PAGE_SIZE + rng.randi() % (CS_PAGE_SIZE - sizeof(buf));
+		bool ok = fcm->read_at(reader->rid, offset, buf, sizeof(buf)) == sizeof(buf);
+		for (uint32_t j = 0; j < sizeof(buf); ++j) {
+			ok = ok && buf[j] == (page & 0xFF);
+		}
+		reader->ok = reader->ok && ok;
+	}
+}
+
+// Reads random offsets of one file from several threads at once, through a cache smaller than the file.
+static bool test_concurrent_reads(const String &p_path, uint32_t p_num_pages) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	RID rid = fcm->open(p_path, FileAccess::READ, _FileCacheManager::LRU);
+	ERR_FAIL_COND_V(!rid.is_valid(), false);
+
+	const int num_threads = 4;
+	ConcurrentReader readers[num_threads];
+	Thread *threads[num_threads];
+
+	for (int i = 0; i < num_threads; ++i) {
+		readers[i].rid = rid;
+		readers[i].num_pages = p_num_pages;
+		readers[i].seed = 1000 + i;
+		readers[i].ok = true;
+		threads[i] = Thread::create(concurrent_reader_func, &readers[i]);
+	}
+
+	bool ok = true;
+	for (int i = 0; i < num_threads; ++i) {
+		Thread::wait_to_finish(threads[i]);
+		memdelete(threads[i]);
+		ok = ok && readers[i].ok;
+	}
+
+	fcm->permanent_close(rid);
+
+	return ok;
+}
+
+MainLoop *test() {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	ERR_FAIL_COND_V_MSG(!fcm, nullptr, "The file cache manager is not initialized.");
+
+	uint32_t num_pages;
+	Vector<uint32_t> trace = make_scan_and_hot_set_trace(CS_NUM_FRAMES, 4, num_pages);
+
+	String path = OS::get_singleton()->get_user_data_dir().plus_file("test_cacheserv.bin");
+
+	{
+		FileAccess *f = FileAccess::open(path, FileAccess::WRITE);
+		ERR_FAIL_COND_V_MSG(!f, nullptr, "Could not create " + path + ".");
+
+		Vector<uint8_t> page;
+		page.resize(CS_PAGE_SIZE);
+		for (uint32_t i = 0; i < num_pages; ++i) {
+			memset(page.ptrw(), i & 0xFF, CS_PAGE_SIZE);
+			f->store_buffer(page.ptr(), CS_PAGE_SIZE);
+		}
+
+		f->close();
+		memdelete(f);
+	}
+
+	OS::get_singleton()->print("Scan and hot set trace: %d accesses over %d pages, %d frames of %d bytes.\n", trace.size(), num_pages, (int)CS_NUM_FRAMES, (int)CS_PAGE_SIZE);
+
+	// Read-ahead would hide the scans from the replacement policies, so it is disabled while replaying.
+	uint32_t read_ahead_max_pages = fcm->get_read_ahead_max_pages();
+	fcm->set_read_ahead_max_pages(0);
+
+	for (uint32_t i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i) {
+		float hit_rate = replay_trace(path, policies[i].policy, trace);
+		OS::get_singleton()->print("%s hit rate: %.2f%%\n", policies[i].name, hit_rate * 100.0f);
+	}
+
+	fcm->set_read_ahead_max_pages(read_ahead_max_pages);
+
+	Dictionary stats = fcm->get_stats();
+	OS::get_singleton()->print("Cache stats: %s\n", String(Variant(stats)).utf8().get_data());
+
+	OS::get_singleton()->print("Pinning: %s\n", test_pinning(path, num_pages) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Memory mapped reads: %s\n", test_mmap(path, num_pages) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Concurrent reads: %s\n", test_concurrent_reads(path, num_pages) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Warm-start manifest: %s\n", test_manifest(path, num_pages) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Compressed tier: %s\n", test_compressed_tier() ? "passed" : "FAILED");
+	OS::get_singleton()->print("Load cancellation: %s\n", test_cancellation(path, num_pages) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Shared opens: %s\n", test_shared_open(path, num_pages) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Async reads: %s\n", test_async_reads(path, num_pages) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Background flush: %s\n", test_background_flush(OS::get_singleton()->get_user_data_dir().plus_file("test_cacheserv_dirty.bin")) ? "passed" : "FAILED");
+	OS::get_singleton()->print("Direct IO reads (%s frames): %s\n", String(fcm->get_stats()["arena"]).utf8().get_data(), test_direct_io(path, num_pages) ? "passed" : "FAILED");
+
+	DirAccess *da = DirAccess::create(DirAccess::ACCESS_FILESYSTEM);
+	da->remove(path);
+	memdelete(da);
+
+	return nullptr;
+}
+} // namespace TestCacheserv
+
+#else
+
+namespace TestCacheserv {
+
+MainLoop *test() {
+
+	ERR_PRINT("The cacheserv module is disabled.");
+	return nullptr;
+}
+} // namespace TestCacheserv
+
+#endif
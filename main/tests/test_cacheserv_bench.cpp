@@ -0,0 +1,393 @@
+/*************************************************************************/
+/*  test_cacheserv_bench.cpp                                             */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "test_cacheserv_bench.h"
+
+#include "core/math/random_number_generator.h"
+#include "core/os/dir_access.h"
+#include "core/os/file_access.h"
+#include "core/os/os.h"
+#include "core/os/thread.h"
+#include "core/sort_array.h"
+
+#include "modules/modules_enabled.gen.h"
+
+#ifdef MODULE_CACHESERV_ENABLED
+
+#include "modules/cacheserv/file_cache_manager.h"
+
+#if defined(UNIX_ENABLED)
+#include "modules/cacheserv/file_access_unbuffered_unix.h"
+#endif
+
+namespace TestCacheservBench {
+
+// Replays synthetic access traces against each cache policy, and reports throughput, latency percentiles and hit rates.
+// Each access reads or writes one whole page, and every replay starts with none of the file cached.
+// The page size and cache size are the ones the cache manager was initialized with; run again with other values of
+// cacheserv/page_size and cacheserv/cache_size to compare them.
+
+struct PolicyInfo {
+	int policy;
+	const char *name;
+};
+
+// KEEP is left out, as it only holds a few pages of small files.
+static const PolicyInfo policies[] = {
+	{ _FileCacheManager::LRU, "LRU" },
+	{ _FileCacheManager::FIFO, "FIFO" },
+	{ _FileCacheManager::CLOCK, "CLOCK" },
+	{ _FileCacheManager::ARC, "ARC" },
+};
+
+struct Access {
+	uint32_t page;
+	bool write;
+};
+
+struct Trace {
+	const char *name;
+	Vector<Access> accesses;
+	bool has_writes;
+};
+
+// The results of one replay. Latencies are in microseconds, one per access.
+struct Result {
+	Vector<uint64_t> latencies;
+	uint64_t hits;
+	uint64_t usec;
+
+	Result() :
+			hits(0),
+			usec(0) {}
+};
+
+// The file is several times larger than the cache, so that every policy has to evict.
+static uint32_t get_file_pages() {
+	return CS_NUM_FRAMES * 4;
+}
+
+static Trace make_sequential_trace(uint32_t p_num_pages, uint32_t p_length) {
+	Trace trace;
+	trace.name = "sequential";
+	trace.has_writes = false;
+
+	for (uint32_t i = 0; i < p_length; ++i) {
+		Access a = { i % p_num_pages, false };
+		trace.accesses.push_back(a);
+	}
+	return trace;
+}
+
+static Trace make_random_trace(uint32_t p_num_pages, uint32_t p_length) {
+	RandomNumberGenerator rng;
+	rng.set_seed(42);
+
+	Trace trace;
+	trace.name = "random";
+	trace.has_writes = false;
+
+	for (uint32_t i = 0; i < p_length; ++i) {
+		Access a = { rng.randi() % p_num_pages, false };
+		trace.accesses.push_back(a);
+	}
+	return trace;
+}
+
+// Draws pages with a Zipf distribution of exponent p_theta, page 0 being the most popular,
+// and scatters the popular pages over the file. A fraction p_write_ratio of the accesses are writes.
+static Trace make_zipfian_trace(const char *p_name, uint32_t p_num_pages, uint32_t p_length, double p_theta, float p_write_ratio) {
+	RandomNumberGenerator rng;
+	rng.set_seed(7);
+
+	Vector<double> cdf;
+	cdf.resize(p_num_pages);
+	double sum = 0;
+	for (uint32_t i = 0; i < p_num_pages; ++i) {
+		sum += 1.0 / Math::pow((double)(i + 1), p_theta);
+		cdf.write[i] = sum;
+	}
+
+	Vector<uint32_t> scatter;
+	scatter.resize(p_num_pages);
+	for (uint32_t i = 0; i < p_num_pages; ++i) {
+		scatter.write[i] = i;
+	}
+	for (uint32_t i = p_num_pages - 1; i > 0; --i) {
+		SWAP(scatter.write[i], scatter.write[rng.randi() % (i + 1)]);
+	}
+
+	Trace trace;
+	trace.name = p_name;
+	trace.has_writes = p_write_ratio > 0;
+
+	for (uint32_t i = 0; i < p_length; ++i) {
+		double x = rng.randf() * sum;
+		uint32_t low = 0;
+		uint32_t high = p_num_pages - 1;
+		while (low < high) {
+			uint32_t mid = (low + high) / 2;
+			if (cdf[mid] < x) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+
+		Access a = { scatter[low], rng.randf() < p_write_ratio };
+		trace.accesses.push_back(a);
+	}
+	return trace;
+}
+
+// Replays the accesses from p_from to p_to of the trace on an open file.
+static void replay(RID p_rid, const Trace &p_trace, int p_from, int p_to, Result &r_result) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	Vector<uint8_t> page;
+	page.resize(CS_PAGE_SIZE);
+
+	for (int i = p_from; i < p_to; ++i) {
+		const Access &a = p_trace.accesses[i];
+		size_t offset = (size_t)a.page * CS_PAGE_SIZE;
+
+		if (fcm->has_page(p_rid, offset)) {
+			r_result.hits += 1;
+		}
+
+		uint64_t start = OS::get_singleton()->get_ticks_usec();
+		if (a.write) {
+			memset(page.ptrw(), a.page & 0xFF, CS_PAGE_SIZE);
+			fcm->seek(p_rid, offset);
+			fcm->check_cache(p_rid, CS_PAGE_SIZE);
+			fcm->write(p_rid, page.ptr(), CS_PAGE_SIZE);
+		} else {
+			fcm->read_at(p_rid, offset, page.ptrw(), CS_PAGE_SIZE);
+		}
+		r_result.latencies.push_back(OS::get_singleton()->get_ticks_usec() - start);
+	}
+}
+
+static void print_result(const char *p_trace, const char *p_policy, int p_threads, Result &r_result) {
+
+	uint64_t p50 = 0;
+	uint64_t p99 = 0;
+	int count = r_result.latencies.size();
+	if (count) {
+		SortArray<uint64_t> sort;
+		sort.sort(r_result.latencies.ptrw(), count);
+		p50 = r_result.latencies[count / 2];
+		p99 = r_result.latencies[MIN(count - 1, count * 99 / 100)];
+	}
+
+	double seconds = MAX(r_result.usec, (uint64_t)1) / 1000000.0;
+	OS::get_singleton()->print("%-12s %-6s %2d thread(s): %10.0f ops/s %9.1f MiB/s  p50 %6d us  p99 %6d us  hit rate %6.2f%%\n",
+			p_trace, p_policy, p_threads,
+			count / seconds,
+			(double)count * CS_PAGE_SIZE / (1024.0 * 1024.0) / seconds,
+			(int)p50, (int)p99,
+			count ? 100.0 * r_result.hits / count : 0.0);
+}
+
+static Result run_single(const String &p_path, const Trace &p_trace, int p_policy) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	Result result;
+
+	RID rid = fcm->open(p_path, p_trace.has_writes ? FileAccess::READ_WRITE : FileAccess::READ, p_policy);
+	ERR_FAIL_COND_V(!rid.is_valid(), result);
+
+	uint64_t start = OS::get_singleton()->get_ticks_usec();
+	replay(rid, p_trace, 0, p_trace.accesses.size(), result);
+	// Dirty pages count towards the run, so the file is flushed before the clock stops.
+	if (p_trace.has_writes) {
+		fcm->flush(rid);
+	}
+	result.usec = OS::get_singleton()->get_ticks_usec() - start;
+
+	fcm->permanent_close(rid);
+	return result;
+}
+
+struct ThreadReplay {
+	RID rid;
+	const Trace *trace;
+	int from;
+	int to;
+	Result result;
+};
+
+static void thread_replay_func(void *p_udata) {
+	ThreadReplay *tr = (ThreadReplay *)p_udata;
+	replay(tr->rid, *tr->trace, tr->from, tr->to, tr->result);
+}
+
+// Splits a read-only trace between several threads reading the same file.
+static Result run_threaded(const String &p_path, const Trace &p_trace, int p_policy, int p_threads) {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	Result result;
+
+	RID rid = fcm->open(p_path, FileAccess::READ, p_policy);
+	ERR_FAIL_COND_V(!rid.is_valid(), result);
+
+	Vector<ThreadReplay> replays;
+	replays.resize(p_threads);
+	Vector<Thread *> threads;
+	threads.resize(p_threads);
+
+	int per_thread = p_trace.accesses.size() / p_threads;
+	uint64_t start = OS::get_singleton()->get_ticks_usec();
+
+	for (int i = 0; i < p_threads; ++i) {
+		ThreadReplay &tr = replays.write[i];
+		tr.rid = rid;
+		tr.trace = &p_trace;
+		tr.from = i * per_thread;
+		tr.to = (i + 1) * per_thread;
+		threads.write[i] = Thread::create(thread_replay_func, &tr);
+	}
+
+	for (int i = 0; i < p_threads; ++i) {
+		Thread::wait_to_finish(threads[i]);
+		memdelete(threads[i]);
+		result.hits += replays[i].result.hits;
+		result.latencies.append_array(replays[i].result.latencies);
+	}
+
+	result.usec = OS::get_singleton()->get_ticks_usec() - start;
+
+	fcm->permanent_close(rid);
+	return result;
+}
+
+#if defined(UNIX_ENABLED)
+// Replays a read-only trace straight on the file, without the cache, as a baseline.
+static Result run_uncached(const String &p_path, const Trace &p_trace) {
+
+	Result result;
+	FileAccessUnbufferedUnix *f = FileAccessUnbufferedUnix::open_unbuffered(p_path, FileAccess::READ);
+	ERR_FAIL_COND_V(!f, result);
+
+	Vector<uint8_t> page;
+	page.resize(CS_PAGE_SIZE);
+
+	uint64_t start = OS::get_singleton()->get_ticks_usec();
+	for (int i = 0; i < p_trace.accesses.size(); ++i) {
+		uint64_t op_start = OS::get_singleton()->get_ticks_usec();
+		f->seek((size_t)p_trace.accesses[i].page * CS_PAGE_SIZE);
+		f->get_buffer(page.ptrw(), CS_PAGE_SIZE);
+		result.latencies.push_back(OS::get_singleton()->get_ticks_usec() - op_start);
+	}
+	result.usec = OS::get_singleton()->get_ticks_usec() - start;
+
+	f->close();
+	memdelete(f);
+	return result;
+}
+#endif
+
+MainLoop *test() {
+
+	FileCacheManager *fcm = FileCacheManager::get_singleton();
+	ERR_FAIL_COND_V_MSG(!fcm, nullptr, "The file cache manager is not initialized.");
+
+	String path = OS::get_singleton()->get_user_data_dir().plus_file("test_cacheserv_bench.bin");
+	uint32_t num_pages = get_file_pages();
+	uint32_t length = num_pages * 4;
+
+	{
+		FileAccess *f = FileAccess::open(path, FileAccess::WRITE);
+		ERR_FAIL_COND_V_MSG(!f, nullptr, "Could not create " + path + ".");
+
+		Vector<uint8_t> page;
+		page.resize(CS_PAGE_SIZE);
+		for (uint32_t i = 0; i < num_pages; ++i) {
+			memset(page.ptrw(), i & 0xFF, CS_PAGE_SIZE);
+			f->store_buffer(page.ptr(), CS_PAGE_SIZE);
+		}
+
+		f->close();
+		memdelete(f);
+	}
+
+	Vector<Trace> traces;
+	traces.push_back(make_sequential_trace(num_pages, length));
+	traces.push_back(make_random_trace(num_pages, length));
+	traces.push_back(make_zipfian_trace("zipfian", num_pages, length, 0.99, 0));
+	traces.push_back(make_zipfian_trace("mixed", num_pages, length, 0.99, 0.2));
+
+	OS::get_singleton()->print("%d pages of %d bytes, %d frames, %d accesses per trace.\n", num_pages, (int)CS_PAGE_SIZE, (int)CS_NUM_FRAMES, length);
+
+	for (int i = 0; i < traces.size(); ++i) {
+		for (uint32_t j = 0; j < sizeof(policies) / sizeof(policies[0]); ++j) {
+			Result result = run_single(path, traces[i], policies[j].policy);
+			print_result(traces[i].name, policies[j].name, 1, result);
+		}
+
+#if defined(UNIX_ENABLED)
+		if (!traces[i].has_writes) {
+			Result result = run_uncached(path, traces[i]);
+			print_result(traces[i].name, "none", 1, result);
+		}
+#endif
+	}
+
+	// The mixed trace rewrote part of the file with the same bytes, so the threaded runs read the same data.
+	const int thread_counts[] = { 2, 4, 8 };
+	for (uint32_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); ++i) {
+		for (uint32_t j = 0; j < sizeof(policies) / sizeof(policies[0]); ++j) {
+			Result result = run_threaded(path, traces[2], policies[j].policy, thread_counts[i]);
+			print_result(traces[2].name, policies[j].name, thread_counts[i], result);
+		}
+	}
+
+	OS::get_singleton()->print("Cache stats: %s\n", String(Variant(fcm->get_stats())).utf8().get_data());
+
+	DirAccess *da = DirAccess::create(DirAccess::ACCESS_FILESYSTEM);
+	da->remove(path);
+	memdelete(da);
+
+	return nullptr;
+}
+} // namespace TestCacheservBench
+
+#else
+
+namespace TestCacheservBench {
+
+MainLoop *test() {
+
+	ERR_PRINT("The cacheserv module is disabled.");
+	return nullptr;
+}
+} // namespace TestCacheservBench
+
+#endif
@@ -0,0 +1,159 @@
+/*************************************************************************/
+/*  test_command_queue.cpp                                               */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "test_command_queue.h"
+
+#include "core/command_queue_mt.h"
+#include "core/os/os.h"
+#include "core/os/thread.h"
+
+namespace TestCommandQueue {
+
+// Pushes commands from several threads to a reader thread, the way the servers do with a multi-threaded thread model,
+// and checks that the commands of each thread run in the order they were pushed. Run it on older builds to compare the
+// throughput.
+
+struct Receiver {
+	// Only touched by the reader thread.
+	Vector<uint32_t> last_sequence;
+	uint64_t received;
+	bool ordered;
+	bool exit;
+
+	void receive(int p_writer, uint32_t p_sequence) {
+		if (p_sequence != last_sequence[p_writer] + 1) {
+			ordered = false;
+		}
+		last_sequence.write[p_writer] = p_sequence;
+		received++;
+	}
+
+	int add(int p_a, int p_b) {
+		return p_a + p_b;
+	}
+
+	void stop() {
+		exit = true;
+	}
+
+	Receiver() :
+			received(0),
+			ordered(true),
+			exit(false) {}
+};
+
+struct Writer {
+	CommandQueueMT *queue;
+	Receiver *receiver;
+	int index;
+	uint32_t count;
+};
+
+static void reader_func(void *p_udata) {
+
+	Writer *w = (Writer *)p_udata;
+	while (!w->receiver->exit) {
+		w->queue->wait_and_flush_one();
+	}
+	w->queue->flush_all();
+}
+
+static void writer_func(void *p_udata) {
+
+	Writer *w = (Writer *)p_udata;
+	for (uint32_t i = 1; i <= w->count; ++i) {
+		w->queue->push(w->receiver, &Receiver::receive, w->index, i);
+	}
+}
+
+// Returns whether every command arrived in order, and the time taken in r_usec.
+static bool run(int p_writers, uint32_t p_count, uint64_t &r_usec) {
+
+	CommandQueueMT queue(true);
+	Receiver receiver;
+	receiver.last_sequence.resize(p_writers);
+	for (int i = 0; i < p_writers; ++i) {
+		receiver.last_sequence.write[i] = 0;
+	}
+
+	Writer reader = { &queue, &receiver, -1, 0 };
+	Thread *reader_thread = Thread::create(reader_func, &reader);
+
+	Vector<Writer> writers;
+	writers.resize(p_writers);
+	Vector<Thread *> threads;
+	threads.resize(p_writers);
+
+	uint64_t start = OS::get_singleton()->get_ticks_usec();
+
+	for (int i = 0; i < p_writers; ++i) {
+		Writer w = { &queue, &receiver, i, p_count };
+		writers.write[i] = w;
+	}
+	for (int i = 0; i < p_writers; ++i) {
+		threads.write[i] = Thread::create(writer_func, &writers.write[i]);
+	}
+	for (int i = 0; i < p_writers; ++i) {
+		Thread::wait_to_finish(threads[i]);
+		memdelete(threads[i]);
+	}
+
+	// Returns once everything pushed before it has run.
+	int sum = 0;
+	queue.push_and_ret(&receiver, &Receiver::add, 2, 3, &sum);
+
+	r_usec = OS::get_singleton()->get_ticks_usec() - start;
+
+	queue.push(&receiver, &Receiver::stop);
+	Thread::wait_to_finish(reader_thread);
+	memdelete(reader_thread);
+
+	return receiver.ordered && sum == 5 && receiver.received == (uint64_t)p_writers * p_count;
+}
+
+MainLoop *test() {
+
+	const uint32_t count = 200000;
+	const int writer_counts[] = { 1, 2, 4, 8 };
+
+	bool passed = true;
+	for (uint32_t i = 0; i < sizeof(writer_counts) / sizeof(writer_counts[0]); ++i) {
+		uint64_t usec;
+		passed = run(writer_counts[i], count, usec) && passed;
+
+		double seconds = MAX(usec, (uint64_t)1) / 1000000.0;
+		OS::get_singleton()->print("%d writer thread(s): %10.0f commands/s\n", writer_counts[i], writer_counts[i] * count / seconds);
+	}
+
+	OS::get_singleton()->print("Command order: %s\n", passed ? "passed" : "FAILED");
+
+	return nullptr;
+}
+} // namespace TestCommandQueue
@@ -0,0 +1,164 @@
+/*************************************************************************/
+/*  test_frame_allocator.cpp                                             */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "test_frame_allocator.h"
+
+#include "core/frame_allocator.h"
+#include "core/os/os.h"
+
+namespace TestFrameAllocator {
+
+// These rely on nothing else taken from the FrameAllocator of the main thread being in use while they run.
+
+// Memory given back in reverse order is reused right away.
+static bool test_lifo() {
+
+	uint8_t *a = (uint8_t *)FrameAllocator::alloc(100);
+	uint8_t *b = (uint8_t *)FrameAllocator::alloc(100);
+	FrameAllocator::free(b, 100);
+	uint8_t *c = (uint8_t *)FrameAllocator::alloc(50);
+
+	bool passed = c == b && b > a;
+
+	FrameAllocator::free(c, 50);
+	FrameAllocator::free(a, 100);
+	return passed;
+}
+
+// Memory given back out of order is only reused once nothing is in use anymore.
+static bool test_rewind() {
+
+	uint8_t *a = (uint8_t *)FrameAllocator::alloc(100);
+	uint8_t *b = (uint8_t *)FrameAllocator::alloc(100);
+	FrameAllocator::free(a, 100);
+	uint8_t *c = (uint8_t *)FrameAllocator::alloc(100);
+	bool passed = c > b;
+
+	FrameAllocator::free(b, 100);
+	FrameAllocator::free(c, 100);
+	uint8_t *d = (uint8_t *)FrameAllocator::alloc(100);
+	passed = passed && d == a;
+
+	FrameAllocator::free(d, 100);
+	return passed;
+}
+
+// The last allocation grows in place, the others are moved along with their contents.
+static bool test_realloc() {
+
+	uint8_t *a = (uint8_t *)FrameAllocator::alloc(64);
+	memset(a, 1, 64);
+	uint8_t *grown = (uint8_t *)FrameAllocator::realloc(a, 64, 256);
+	bool passed = grown == a;
+
+	uint8_t *b = (uint8_t *)FrameAllocator::alloc(64);
+	uint8_t *moved = (uint8_t *)FrameAllocator::realloc(grown, 256, 512);
+	passed = passed && moved != grown && moved > b;
+	for (int i = 0; i < 64; i++) {
+		passed = passed && moved[i] == 1;
+	}
+
+	// realloc() gave back the memory it moved from.
+	FrameAllocator::free(moved, 512);
+	FrameAllocator::free(b, 64);
+	return passed;
+}
+
+// Blocks chained during a frame are replaced by a single one at the next frame, so the same allocations then
+// come out of one block, one after the other.
+static bool test_compaction() {
+
+	const uint32_t size = 256 * 1024;
+
+	uint8_t *a = (uint8_t *)FrameAllocator::alloc(size);
+	uint8_t *b = (uint8_t *)FrameAllocator::alloc(size);
+	uint8_t *c = (uint8_t *)FrameAllocator::alloc(size);
+	FrameAllocator::free(c, size);
+	FrameAllocator::free(b, size);
+	FrameAllocator::free(a, size);
+
+	FrameAllocator::end_frame();
+
+	a = (uint8_t *)FrameAllocator::alloc(size);
+	b = (uint8_t *)FrameAllocator::alloc(size);
+	c = (uint8_t *)FrameAllocator::alloc(size);
+	bool passed = b == a + size && c == b + size;
+
+	FrameAllocator::free(c, size);
+	FrameAllocator::free(b, size);
+	FrameAllocator::free(a, size);
+	return passed;
+}
+
+// Vectors keep their elements as they grow, whether in place or not.
+static bool test_frame_vector() {
+
+	FrameVector<uint32_t> first;
+	FrameVector<uint32_t> second;
+	for (uint32_t i = 0; i < 1000; i++) {
+		first.push_back(i);
+		if (i == 500) {
+			// From here on, the first vector is not the last allocation anymore, and moves when it grows.
+			second.resize(10);
+			for (uint32_t j = 0; j < 10; j++) {
+				second[j] = j;
+			}
+			first.push_back(second[9]);
+		}
+	}
+
+	bool passed = first.size() == 1001 && first[501] == 9;
+	for (uint32_t i = 0; i < 1000; i++) {
+		passed = passed && first[i < 501 ? i : i + 1] == i;
+	}
+
+	return passed;
+}
+
+MainLoop *test() {
+
+	bool lifo = test_lifo();
+	OS::get_singleton()->print("LIFO reuse: %s\n", lifo ? "passed" : "FAILED");
+
+	bool rewind = test_rewind();
+	OS::get_singleton()->print("Rewind: %s\n", rewind ? "passed" : "FAILED");
+
+	bool realloc = test_realloc();
+	OS::get_singleton()->print("Realloc: %s\n", realloc ? "passed" : "FAILED");
+
+	bool compaction = test_compaction();
+	OS::get_singleton()->print("Compaction: %s\n", compaction ? "passed" : "FAILED");
+
+	bool frame_vector = test_frame_vector();
+	OS::get_singleton()->print("FrameVector: %s\n", frame_vector ? "passed" : "FAILED");
+
+	return nullptr;
+}
+} // namespace TestFrameAllocator
@@ -0,0 +1,197 @@
+/*************************************************************************/
+/*  test_job_graph.cpp                                                   */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "test_job_graph.h"
+
+#include "core/job_graph.h"
+#include "core/os/os.h"
+
+namespace TestJobGraph {
+
+// Records when each job runs, to check that no job runs before the jobs it depends on.
+struct Order {
+	enum {
+		MAX_JOBS = 64
+	};
+
+	volatile uint32_t clock;
+	uint32_t stamps[MAX_JOBS];
+	uint32_t runs[MAX_JOBS];
+
+	void run(int p_job) {
+		stamps[p_job] = atomic_increment(&clock);
+		atomic_increment(&runs[p_job]);
+	}
+
+	bool before(int p_first, int p_then) const {
+		return stamps[p_first] != 0 && stamps[p_first] < stamps[p_then];
+	}
+
+	Order() {
+		clock = 0;
+		for (int i = 0; i < MAX_JOBS; i++) {
+			stamps[i] = 0;
+			runs[i] = 0;
+		}
+	}
+};
+
+// A binary tree of jobs, each job depending on its parent, and a last job depending on all the leaves.
+// The graph is run several times, being reset in between, to check that it can be reused.
+static bool test_dependency_order() {
+
+	const int count = 63;
+	const int rounds = 16;
+
+	Order order;
+	JobGraph graph;
+
+	for (int i = 0; i < count + 1; i++) {
+		graph.add_job([&order, i]() { order.run(i); });
+	}
+	for (int i = 1; i < count; i++) {
+		graph.add_dependency(i, (i - 1) / 2);
+	}
+	for (int i = count / 2; i < count; i++) {
+		graph.add_dependency(count, i);
+	}
+
+	for (int round = 0; round < rounds; round++) {
+		graph.submit();
+		graph.wait(count);
+
+		for (int i = 1; i < count; i++) {
+			if (!order.before((i - 1) / 2, i)) {
+				return false;
+			}
+		}
+		for (int i = count / 2; i < count; i++) {
+			if (!order.before(i, count)) {
+				return false;
+			}
+		}
+
+		graph.reset();
+	}
+
+	for (int i = 0; i < count + 1; i++) {
+		if (order.runs[i] != (uint32_t)rounds) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Continuations added before and after their job was submitted, and after it is done.
+static bool test_continuations() {
+
+	Order order;
+	JobGraph graph;
+
+	JobGraph::JobID first = graph.add_job([&order]() { order.run(0); });
+	JobGraph::JobID second = graph.add_continuation(first, [&order]() { order.run(1); });
+	graph.submit();
+
+	JobGraph::JobID third = graph.add_continuation(second, [&order]() { order.run(2); });
+	graph.submit();
+	graph.wait(third);
+
+	JobGraph::JobID late = graph.add_continuation(first, [&order]() { order.run(3); });
+	graph.submit();
+	graph.wait_all();
+
+	return graph.is_done(late) && order.before(0, 1) && order.before(1, 2) && order.before(0, 3);
+}
+
+// Jobs that depend on each other in a cycle are refused, instead of never finishing.
+static bool test_cycle() {
+
+	Order order;
+	JobGraph graph;
+
+	JobGraph::JobID a = graph.add_job([&order]() { order.run(0); });
+	JobGraph::JobID b = graph.add_continuation(a, [&order]() { order.run(1); });
+	JobGraph::JobID c = graph.add_continuation(b, [&order]() { order.run(2); });
+	graph.add_dependency(a, c);
+
+	OS::get_singleton()->print("Errors about a cycle are expected:\n");
+	graph.submit();
+	graph.wait_all();
+
+	return !graph.is_done(a) && !graph.is_done(b) && !graph.is_done(c) && order.clock == 0;
+}
+
+// Every element of a parallel_for is visited once, including for loops started from the workers.
+static bool test_parallel_for() {
+
+	const uint32_t count = 10000;
+
+	Vector<uint32_t> visits;
+	visits.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		visits.write[i] = 0;
+	}
+	uint32_t *ptr = visits.ptrw();
+
+	ThreadWorkPool *pool = ThreadWorkPool::get_singleton();
+	pool->parallel_for(0, count, [ptr](uint32_t i) { atomic_increment(&ptr[i]); });
+	pool->parallel_for(0, count / 100, [ptr, pool](uint32_t i) {
+		pool->parallel_for(i * 100, (i + 1) * 100, [ptr](uint32_t j) { atomic_increment(&ptr[j]); }, 10);
+	});
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (visits[i] != 2) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+MainLoop *test() {
+
+	OS::get_singleton()->print("Threads: %d\n", ThreadWorkPool::get_singleton()->get_thread_count());
+
+	bool order = test_dependency_order();
+	OS::get_singleton()->print("Dependency order: %s\n", order ? "passed" : "FAILED");
+
+	bool continuations = test_continuations();
+	OS::get_singleton()->print("Continuations: %s\n", continuations ? "passed" : "FAILED");
+
+	bool cycle = test_cycle();
+	OS::get_singleton()->print("Cycle: %s\n", cycle ? "passed" : "FAILED");
+
+	bool parallel_for = test_parallel_for();
+	OS::get_singleton()->print("Parallel for: %s\n", parallel_for ? "passed" : "FAILED");
+
+	return nullptr;
+}
+} // namespace TestJobGraph
@@ -35,9 +35,15 @@
 #ifdef DEBUG_ENABLED
 
 #include "test_astar.h"
+#include "test_cacheserv.h"
+#include "test_cacheserv_bench.h"
+#include "test_command_queue.h"
+#include "test_frame_allocator.h"
 #include "test_gdscript.h"
 #include "test_gui.h"
+#include "test_job_graph.h"
 #include "test_math.h"
+#include "test_message_queue.h"
 #include "test_oa_hash_map.h"
 #include "test_ordered_hash_map.h"
 #include "test_physics_2d.h"
@@ -63,6 +69,12 @@ const char **tests_get_names() {
 		"gd_bytecode",
 		"ordered_hash_map",
 		"astar",
+		"cacheserv",
+		"cacheserv_bench",
+		"command_queue",
+		"message_queue",
+		"job_graph",
+		"frame_allocator",
 		nullptr
 	};
 
@@ -143,6 +155,36 @@ MainLoop *test_main(String p_test, const List<String> &p_args) {
 		return TestAStar::test();
 	}
 
+	if (p_test == "cacheserv") {
+
+		return TestCacheserv::test();
+	}
+
+	if (p_test == "cacheserv_bench") {
+
+		return TestCacheservBench::test();
+	}
+
+	if (p_test == "command_queue") {
+
+		return TestCommandQueue::test();
+	}
+
+	if (p_test == "message_queue") {
+
+		return TestMessageQueue::test();
+	}
+
+	if (p_test == "job_graph") {
+
+		return TestJobGraph::test();
+	}
+
+	if (p_test == "frame_allocator") {
+
+		return TestFrameAllocator::test();
+	}
+
 	print_line("Unknown test: " + p_test);
 	return nullptr;
 }
@@ -0,0 +1,153 @@
+/*************************************************************************/
+/*  test_message_queue.cpp                                               */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2020 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2020 Godot Engine contributors (cf. AUTHORS.md).   */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "test_message_queue.h"
+
+#include "core/message_queue.h"
+#include "core/os/os.h"
+#include "core/os/thread.h"
+
+namespace TestMessageQueue {
+
+// Pushes deferred sets from several threads while the main thread flushes, and checks that the sets of each thread
+// arrive in the order they were pushed. Every thread pushes more than fits in its first chunk, so the buffers grow.
+
+class Receiver : public Object {
+
+	GDCLASS(Receiver, Object);
+
+public:
+	// The property each writer sets, and the last sequence number received from it.
+	Vector<StringName> names;
+	Vector<uint32_t> last_sequence;
+	uint64_t received;
+	bool ordered;
+
+protected:
+	bool _set(const StringName &p_name, const Variant &p_value) {
+		for (int i = 0; i < names.size(); ++i) {
+			if (names[i] == p_name) {
+				uint32_t sequence = p_value;
+				if (sequence != last_sequence[i] + 1) {
+					ordered = false;
+				}
+				last_sequence.write[i] = sequence;
+				received++;
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	Receiver() :
+			received(0),
+			ordered(true) {}
+};
+
+struct Writer {
+	ObjectID receiver;
+	StringName name;
+	uint32_t count;
+	volatile bool *failed;
+};
+
+static void writer_func(void *p_udata) {
+
+	Writer *w = (Writer *)p_udata;
+	for (uint32_t i = 1; i <= w->count; ++i) {
+		if (MessageQueue::get_singleton()->push_set(w->receiver, w->name, i) != OK) {
+			*w->failed = true;
+			return;
+		}
+	}
+}
+
+// Returns whether every set arrived, in order. With p_flush_while_pushing, the main thread flushes while
+// the writers push, otherwise only once they are done.
+static bool run(int p_writers, uint32_t p_count, bool p_flush_while_pushing) {
+
+	Receiver *receiver = memnew(Receiver);
+	receiver->names.resize(p_writers);
+	receiver->last_sequence.resize(p_writers);
+
+	volatile bool failed = false;
+
+	Vector<Writer> writers;
+	writers.resize(p_writers);
+	Vector<Thread *> threads;
+	threads.resize(p_writers);
+
+	for (int i = 0; i < p_writers; ++i) {
+		receiver->names.write[i] = "writer_" + itos(i);
+		receiver->last_sequence.write[i] = 0;
+		Writer w = { receiver->get_instance_id(), receiver->names[i], p_count, &failed };
+		writers.write[i] = w;
+	}
+	for (int i = 0; i < p_writers; ++i) {
+		threads.write[i] = Thread::create(writer_func, &writers.write[i]);
+	}
+
+	if (p_flush_while_pushing) {
+		while (receiver->received < (uint64_t)p_writers * p_count && !failed) {
+			MessageQueue::get_singleton()->flush();
+		}
+	}
+
+	for (int i = 0; i < p_writers; ++i) {
+		Thread::wait_to_finish(threads[i]);
+		memdelete(threads[i]);
+	}
+	MessageQueue::get_singleton()->flush();
+
+	bool passed = !failed && receiver->ordered && receiver->received == (uint64_t)p_writers * p_count;
+	memdelete(receiver);
+	return passed;
+}
+
+MainLoop *test() {
+
+	// A set takes about 50 bytes, so this is a few hundred kilobytes per thread, well past the first chunk
+	// but within the default max_size_kb when nothing is flushed until the writers are done.
+	const uint32_t count = 10000;
+	const int writer_counts[] = { 1, 2, 4, 8 };
+
+	bool passed = true;
+	for (uint32_t i = 0; i < sizeof(writer_counts) / sizeof(writer_counts[0]); ++i) {
+		passed = run(writer_counts[i], count, false) && passed;
+		passed = run(writer_counts[i], count, true) && passed;
+	}
+
+	OS::get_singleton()->print("Message order: %s\n", passed ? "passed" : "FAILED");
+	OS::get_singleton()->print("Max buffer usage: %d bytes\n", MessageQueue::get_singleton()->get_max_buffer_usage());
+
+	return nullptr;
+}
+} // namespace TestMessageQueue
@@ -0,0 +1,302 @@
+/*************************************************************************/
+/*  async_io_unix.cpp                                                    */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PAGEICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "async_io_unix.h"
+
+#if defined(UNIX_ENABLED)
+
+#include "core/error_macros.h"
+#include "core/os/memory.h"
+#include "core/print_string.h"
+#include "core/ustring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define CS_IO_URING_ENABLED
+#endif
+#endif
+#endif
+
+AsyncIOUnix::AsyncIOUnix() :
+		requests(NULL),
+		completions(NULL),
+		capacity(0),
+		queued(0),
+		ring_fd(-1),
+		sq_ring(NULL),
+		cq_ring(NULL),
+		sqes(NULL),
+		sq_ring_size(0),
+		cq_ring_size(0),
+		sqes_size(0),
+		sq_entries(0),
+		sq_head(NULL),
+		sq_tail(NULL),
+		sq_mask(NULL),
+		sq_array(NULL),
+		cq_head(NULL),
+		cq_tail(NULL),
+		cq_mask(NULL),
+		cqes(NULL) {
+}
+
+AsyncIOUnix::~AsyncIOUnix() {
+	teardown_ring();
+
+	if (requests) memdelete_arr(requests);
+	if (completions) memdelete_arr(completions);
+}
+
+void AsyncIOUnix::init(uint32_t p_capacity, bool p_use_ring) {
+	CRASH_COND(requests != NULL || p_capacity == 0);
+
+	capacity = p_capacity;
+	queued = 0;
+	requests = memnew_arr(Request, capacity);
+	completions = memnew_arr(Completion, capacity);
+
+	if (p_use_ring && !setup_ring(capacity)) {
+		// Not an error, the kernel may simply not support io_uring, or a sandbox may forbid it.
+		print_verbose("io_uring is unavailable, the file cache will use preadv/pwritev.");
+	}
+}
+
+bool AsyncIOUnix::setup_ring(uint32_t p_entries) {
+#if defined(CS_IO_URING_ENABLED)
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = syscall(__NR_io_uring_setup, p_entries, &params);
+	if (fd < 0) {
+		return false;
+	}
+
+	ring_fd = fd;
+	sq_entries = params.sq_entries;
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	bool single_mmap = false;
+#if defined(IORING_FEAT_SINGLE_MMAP)
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		// Both rings live in one mapping, which has to be large enough for either of them.
+		single_mmap = true;
+		sq_ring_size = MAX(sq_ring_size, cq_ring_size);
+		cq_ring_size = sq_ring_size;
+	}
+#endif
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		sq_ring = NULL;
+		teardown_ring();
+		return false;
+	}
+
+	if (single_mmap) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			cq_ring = NULL;
+			teardown_ring();
+			return false;
+		}
+	}
+
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		sqes = NULL;
+		teardown_ring();
+		return false;
+	}
+
+	uint8_t *sq = (uint8_t *)sq_ring;
+	sq_head = (uint32_t *)(sq + params.sq_off.head);
+	sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+	sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+	sq_array = (uint32_t *)(sq + params.sq_off.array);
+
+	uint8_t *cq = (uint8_t *)cq_ring;
+	cq_head = (uint32_t *)(cq + params.cq_off.head);
+	cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+	cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+	cqes = cq + params.cq_off.cqes;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void AsyncIOUnix::teardown_ring() {
+#if defined(CS_IO_URING_ENABLED)
+	if (sqes) munmap(sqes, sqes_size);
+	if (cq_ring && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+	if (sq_ring) munmap(sq_ring, sq_ring_size);
+	if (ring_fd >= 0) ::close(ring_fd);
+#endif
+
+	sqes = NULL;
+	cq_ring = NULL;
+	sq_ring = NULL;
+	ring_fd = -1;
+}
+
+void AsyncIOUnix::queue(int p_fd, uint64_t p_offset, const struct iovec *p_iov, uint32_t p_iov_count, uint64_t p_user_data, bool p_write) {
+	CRASH_COND_MSG(queued >= capacity, "Too many queued IO operations.");
+
+	Request &r = requests[queued++];
+	r.fd = p_fd;
+	r.offset = p_offset;
+	r.iov = p_iov;
+	r.iov_count = p_iov_count;
+	r.user_data = p_user_data;
+	r.write = p_write;
+}
+
+static int64_t run_request(int p_fd, uint64_t p_offset, const struct iovec *p_iov, uint32_t p_iov_count, bool p_write) {
+	ssize_t ret;
+
+	do {
+		ret = p_write ? ::pwritev(p_fd, p_iov, p_iov_count, p_offset) : ::preadv(p_fd, p_iov, p_iov_count, p_offset);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -(int64_t)errno : (int64_t)ret;
+}
+
+void AsyncIOUnix::run_fallback() {
+	for (uint32_t i = 0; i < queued; ++i) {
+		const Request &r = requests[i];
+		completions[i].user_data = r.user_data;
+		completions[i].result = run_request(r.fd, r.offset, r.iov, r.iov_count, r.write);
+	}
+}
+
+bool AsyncIOUnix::run_ring() {
+#if defined(CS_IO_URING_ENABLED)
+	struct io_uring_sqe *sqe_array = (struct io_uring_sqe *)sqes;
+	struct io_uring_cqe *cqe_array = (struct io_uring_cqe *)cqes;
+
+	// Requests are consumed by the kernel in order, so the first `submitted` requests are in flight or done.
+	uint32_t filled = 0;
+	uint32_t submitted = 0;
+	uint32_t reaped = 0;
+
+	while (reaped < queued) {
+		// Fill the submission ring with as many requests as it can hold.
+		uint32_t tail = *sq_tail;
+		uint32_t head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+		while (filled < queued && tail - head < sq_entries) {
+			const Request &r = requests[filled];
+			uint32_t idx = tail & *sq_mask;
+			struct io_uring_sqe *sqe = &sqe_array[idx];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = r.write ? IORING_OP_WRITEV : IORING_OP_READV;
+			sqe->fd = r.fd;
+			sqe->off = r.offset;
+			sqe->addr = (uint64_t)(uintptr_t)r.iov;
+			sqe->len = r.iov_count;
+			sqe->user_data = filled;
+			sq_array[idx] = idx;
+
+			++tail;
+			++filled;
+		}
+
+		__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+		uint32_t to_submit = filled - submitted;
+		uint32_t to_wait = filled - reaped;
+		int ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, to_wait, IORING_ENTER_GETEVENTS, NULL, 0);
+
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+				// Nothing was lost. Reap what is there and try again.
+			} else if (submitted == 0 && reaped == 0) {
+				// The ring is unusable. Take back the entries and let the caller use the fallback.
+				__atomic_store_n(sq_tail, __atomic_load_n(sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+				ERR_PRINT("io_uring_enter failed with errno " + itos(errno) + ", falling back to preadv/pwritev.");
+				teardown_ring();
+				return false;
+			} else {
+				CRASH_NOW_MSG("io_uring_enter failed with errno " + itos(errno) + " while operations were in flight.");
+			}
+		} else {
+			submitted += ret;
+		}
+
+		// Collect the completions.
+		uint32_t cq_h = *cq_head;
+		uint32_t cq_t = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+		while (cq_h != cq_t) {
+			const struct io_uring_cqe *cqe = &cqe_array[cq_h & *cq_mask];
+			completions[reaped].user_data = requests[cqe->user_data].user_data;
+			completions[reaped].result = cqe->res;
+			++reaped;
+			++cq_h;
+		}
+
+		__atomic_store_n(cq_head, cq_h, __ATOMIC_RELEASE);
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint32_t AsyncIOUnix::submit_and_wait() {
+	if (queued == 0) {
+		return 0;
+	}
+
+	if (ring_fd < 0 || !run_ring()) {
+		run_fallback();
+	}
+
+	uint32_t count = queued;
+	queued = 0;
+	return count;
+}
+
+#endif // if defined(UNIX_ENABLED)
@@ -0,0 +1,130 @@
+/*************************************************************************/
+/*  async_io_unix.h                                                      */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PAGEICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#ifndef ASYNC_IO_UNIX_H
+#define ASYNC_IO_UNIX_H
+
+#include "core/typedefs.h"
+
+#if defined(UNIX_ENABLED)
+
+#include <sys/uio.h>
+
+// Batched positional IO on file descriptors.
+//
+// Operations are queued with queue_read() and queue_write(), and submit_and_wait() hands
+// them to the kernel together and blocks until all of them have completed.
+// On Linux the batch goes through io_uring, so a whole batch costs a single system call.
+// When io_uring is unavailable (old kernels, seccomp filters, other unices), or disabled,
+// the queued operations are performed one by one with preadv() and pwritev() instead.
+// Callers see the same completions either way.
+//
+// An instance is not thread safe. Each IO worker owns one.
+class AsyncIOUnix {
+
+public:
+	struct Completion {
+		uint64_t user_data;
+		// The number of bytes transferred, or a negative errno value.
+		int64_t result;
+	};
+
+private:
+	struct Request {
+		const struct iovec *iov;
+		uint64_t offset;
+		uint64_t user_data;
+		int fd;
+		uint32_t iov_count;
+		bool write;
+	};
+
+	Request *requests;
+	Completion *completions;
+	uint32_t capacity;
+	uint32_t queued;
+
+	// io_uring state. ring_fd is -1 when the fallback is in use.
+	int ring_fd;
+	void *sq_ring;
+	void *cq_ring;
+	void *sqes;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	uint32_t sq_entries;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	void *cqes;
+
+	bool setup_ring(uint32_t p_entries);
+	void teardown_ring();
+
+	// Runs the queued requests with the ring. Returns false if the ring failed and nothing was submitted.
+	bool run_ring();
+	void run_fallback();
+	void queue(int p_fd, uint64_t p_offset, const struct iovec *p_iov, uint32_t p_iov_count, uint64_t p_user_data, bool p_write);
+
+public:
+	// Allocates room for p_capacity queued operations.
+	// If p_use_ring is false, or the ring can't be created, the preadv()/pwritev() fallback is used.
+	void init(uint32_t p_capacity, bool p_use_ring);
+
+	_FORCE_INLINE_ bool is_ring_enabled() const { return ring_fd >= 0; }
+	_FORCE_INLINE_ uint32_t get_capacity() const { return capacity; }
+	_FORCE_INLINE_ uint32_t get_queued() const { return queued; }
+
+	// Queue a read into, or a write from, the given buffers, starting at p_offset in the file.
+	// The buffers and the iovec array must stay valid until submit_and_wait() returns.
+	void queue_read(int p_fd, uint64_t p_offset, const struct iovec *p_iov, uint32_t p_iov_count, uint64_t p_user_data) {
+		queue(p_fd, p_offset, p_iov, p_iov_count, p_user_data, false);
+	}
+	void queue_write(int p_fd, uint64_t p_offset, const struct iovec *p_iov, uint32_t p_iov_count, uint64_t p_user_data) {
+		queue(p_fd, p_offset, p_iov, p_iov_count, p_user_data, true);
+	}
+
+	// Submits every queued operation and waits for all of them.
+	// Returns the number of completions, which can be read with get_completion() until the next submission.
+	// Completions are not necessarily in the order the operations were queued.
+	uint32_t submit_and_wait();
+	_FORCE_INLINE_ const Completion &get_completion(uint32_t p_idx) const { return completions[p_idx]; }
+
+	AsyncIOUnix();
+	~AsyncIOUnix();
+};
+
+#endif // if defined(UNIX_ENABLED)
+
+#endif // ASYNC_IO_UNIX_H
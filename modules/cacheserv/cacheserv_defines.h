@@ -31,31 +31,100 @@
 #ifndef CACHESERV_DEFINES_H
 #define CACHESERV_DEFINES_H
 
-#define CS_PAGE_SIZE 0x1000
-#define CS_CACHE_SIZE (CS_PAGE_SIZE * 64)
+#include "core/typedefs.h"
+
+#define CS_PAGE_SIZE_DEFAULT 0x1000
+#define CS_CACHE_SIZE_DEFAULT (CS_PAGE_SIZE_DEFAULT * 64)
+// Also the alignment direct IO needs on common file systems.
+#define CS_PAGE_SIZE_MIN 0x1000
+#define CS_PAGE_SIZE_MAX 0x1000000
+#define CS_NUM_FRAMES_MIN 32
+// The size of explicit huge pages, which the frame arena is rounded up to when it uses them.
+// 2 MiB is the default on x86-64 and arm64.
+#define CS_HUGE_PAGE_SIZE 0x200000
+
+// The page size and the cache size are chosen once, when FileCacheManager::init() runs,
+// either from the project settings or from the arguments passed to init().
+// They must not change while any file is tracked by the cache.
+// The page size is always a power of 2, and the cache size is always a multiple of the page size.
+extern size_t cs_page_size;
+extern size_t cs_cache_size;
+
+#define CS_PAGE_SIZE (cs_page_size)
+#define CS_CACHE_SIZE (cs_cache_size)
 #define CS_MEM_VAL_BAD ~0
 #define CS_NUM_FRAMES ((CS_CACHE_SIZE) / (CS_PAGE_SIZE))
 #define CS_FIFO_THRESH_DEFAULT 8
 #define CS_LRU_THRESH_DEFAULT 8
 #define CS_KEEP_THRESH_DEFAULT 8
+#define CS_CLOCK_THRESH_DEFAULT 8
+#define CS_ARC_THRESH_DEFAULT 8
 #define CS_LEN_UNSPECIFIED 0xFADEFADEFADEFADE
 
+#define CS_IO_THREADS_DEFAULT 2
+// Capacity of each operation ring. Must be a power of 2.
+#define CS_CTRL_QUEUE_SIZE 4096
+// The most load and store ops an IO worker submits to the kernel at once.
+#define CS_IO_BATCH_MAX 32
+
+// How long ops of each priority class may wait in the operation queue before they are served ahead of
+// higher classes. Interactive ops are always served first and have no deadline.
+// A reader that catches up with the read-ahead waits for prefetch loads, so their deadline is kept short.
+#define CS_DEADLINE_STREAMING_USEC 10000
+#define CS_DEADLINE_PREFETCH_USEC 50000
+#define CS_DEADLINE_WRITE_BACK_USEC 500000
+
+// The background flusher starts writing back dirty frames once more than the high watermark of the frames
+// are dirty, and stops once no more than the low watermark are. Both are fractions of the frame count.
+#define CS_DIRTY_HIGH_WATERMARK_DEFAULT 0.25
+#define CS_DIRTY_LOW_WATERMARK_DEFAULT 0.1
+// How often the background flusher checks the dirty frames.
+#define CS_FLUSHER_INTERVAL_USEC 50000
+// How many frames from the old end of a policy list eviction looks at for a clean victim before
+// it settles for the oldest frame and waits for its write-back.
+#define CS_EVICT_SCAN_MAX 8
+
+// The warm start only queues more loads while the operation queue holds fewer ops than this,
+// so that it never delays the loads of files that are actually being read.
+#define CS_WARM_START_QUEUE_DEPTH 8
+// Identifies warm-start manifest files, and the version of their format.
+#define CS_MANIFEST_MAGIC 0x4D575343 // "CSWM"
+#define CS_MANIFEST_VERSION 1
+
+// Pages evicted into the compressed tier are only kept if they compress to at most this fraction of their size.
+#define CS_COMPRESSED_TIER_MAX_RATIO 0.875
+
+// The number of cache policies in _FileCacheManager::CachePolicy.
+#define CS_CACHE_POLICY_COUNT 5
+// The number of power of 2 buckets in the IO latency histograms. The last one covers about 16 seconds and up.
+#define CS_LATENCY_BUCKETS 25
+
+// Read-ahead starts after this many consecutive sequential reads.
+#define CS_READ_AHEAD_SEQ_THRESH 2
+// Initial size of the read-ahead window, in pages. The window doubles each time the reader catches up with it.
+#define CS_READ_AHEAD_MIN_PAGES 4
+#define CS_READ_AHEAD_MAX_PAGES_DEFAULT 32
+
 #define STRINGIFY2(X) #X
 #define STRINGIFY(X) STRINGIFY2(X)
 
 // The number of bytes after the previous page offset for the offset a.
-#define CS_PARTIAL_SIZE(a) ((a) % CS_PAGE_SIZE)
+// CS_PAGE_SIZE is a power of 2, so we can mask instead of dividing.
+#define CS_PARTIAL_SIZE(a) ((a) & (CS_PAGE_SIZE - 1))
 
 // Extract offset from GUID by masking the range.
+// Page offsets are always multiples of CS_PAGE_SIZE, so the 40 bit offset field works for any page size.
 #define CS_GET_FILE_OFFSET_FROM_GUID(guid) ((guid)&0x000000FFFFFFFFFF)
 #define CS_GET_GUID_FROM_FILE_OFFSET(offset, guid_prefix) ((guid_prefix) | offset)
 
 // Round off to the previous page offset.
 #define CS_GET_PAGE(a) ((a)-CS_PARTIAL_SIZE(a))
+// The index of the page containing offset a in its file.
+#define CS_GET_PAGE_INDEX(a) ((a) / CS_PAGE_SIZE)
 
 #define CS_GET_CACHE_POLICY_FN(fns, policy) (this->*(fns[policy]))
 
-#define CS_GET_LENGTH_IN_PAGES(length) (((length) / CS_PAGE_SIZE) + CS_PARTIAL_SIZE(length))
+#define CS_GET_LENGTH_IN_PAGES(length) (((length) + CS_PAGE_SIZE - 1) / CS_PAGE_SIZE)
 
 #define ERR_COND_MSG_ACTION(m_cond, m_message, m_action)                                                                                                     \
 	{                                                                                                                                                        \
@@ -73,6 +142,10 @@
 		}                                                                                                  \
 	}
 
+#ifndef ERR_PRINTS
+#define ERR_PRINTS(m_string) ERR_PRINT(m_string)
+#endif
+
 #ifndef ERR_FAIL_COND_MSG
 #define ERR_FAIL_COND_MSG(m_cond, m_msg)                                                                   \
 	{                                                                                                      \
@@ -0,0 +1,158 @@
+/*************************************************************************/
+/*  compressed_tier.cpp                                                  */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PAGEICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "compressed_tier.h"
+
+#include "core/error_macros.h"
+#include "core/os/memory.h"
+
+CompressedTier::CompressedTier() :
+		arena(NULL),
+		capacity(0),
+		tail(0),
+		mode(Compression::MODE_ZSTD),
+		compressed_bytes(0),
+		raw_bytes(0),
+		dropped(0) {}
+
+CompressedTier::~CompressedTier() {
+	if (arena) {
+		memdelete_arr(arena);
+	}
+}
+
+Error CompressedTier::init(size_t p_capacity, Compression::Mode p_mode) {
+	ERR_FAIL_COND_V(arena != NULL, ERR_ALREADY_IN_USE);
+
+	if (p_capacity == 0) {
+		return OK;
+	}
+
+	// Every page must fit in the arena on its own.
+	ERR_FAIL_COND_V_MSG(p_capacity < CS_PAGE_SIZE, ERR_INVALID_PARAMETER, "The compressed tier must be able to hold at least one page.");
+
+	arena = memnew_arr(uint8_t, p_capacity);
+	ERR_FAIL_COND_V(!arena, ERR_OUT_OF_MEMORY);
+
+	capacity = p_capacity;
+	tail = 0;
+	mode = p_mode;
+	scratch.resize(Compression::get_max_compressed_buffer_size(CS_PAGE_SIZE, mode));
+
+	return OK;
+}
+
+void CompressedTier::drop(List<Entry>::Element *p_entry) {
+	compressed_bytes -= p_entry->get().size;
+	raw_bytes -= p_entry->get().used_size;
+	index.remove(p_entry->get().page);
+	entries.erase(p_entry);
+}
+
+bool CompressedTier::store(page_id p_page, const uint8_t *p_data, uint32_t p_used_size) {
+	CRASH_COND(!arena);
+	CRASH_COND(p_used_size > CS_PAGE_SIZE);
+
+	if (p_used_size == 0) {
+		return false;
+	}
+
+	int size = Compression::compress(scratch.ptrw(), p_data, p_used_size, mode);
+
+	if (size <= 0 || size > p_used_size * CS_COMPRESSED_TIER_MAX_RATIO) {
+		return false;
+	}
+
+	// A page whose copy is still held can't have been brought back, but make sure there's only ever one copy.
+	List<Entry>::Element **old = index.lookup_ptr(p_page);
+	if (old) {
+		drop(*old);
+	}
+
+	// Pages are never split around the end of the arena. The rest of it is skipped instead,
+	// along with the pages still there, which are the oldest ones.
+	if (tail + size > capacity) {
+		while (entries.front() && entries.front()->get().offset >= tail) {
+			drop(entries.front());
+			dropped += 1;
+		}
+		tail = 0;
+	}
+
+	// Drop the oldest pages until the new one doesn't overlap any of them.
+	while (entries.front() && entries.front()->get().offset >= tail && entries.front()->get().offset < tail + size) {
+		drop(entries.front());
+		dropped += 1;
+	}
+
+	memcpy(arena + tail, scratch.ptr(), size);
+
+	Entry entry;
+	entry.page = p_page;
+	entry.offset = tail;
+	entry.size = size;
+	entry.used_size = p_used_size;
+
+	index.insert(p_page, entries.push_back(entry));
+
+	tail += size;
+	compressed_bytes += size;
+	raw_bytes += p_used_size;
+
+	return true;
+}
+
+int CompressedTier::take(page_id p_page, uint8_t *p_dst) {
+	List<Entry>::Element **elem = index.lookup_ptr(p_page);
+	if (!elem) {
+		return -1;
+	}
+
+	List<Entry>::Element *e = *elem;
+	int size = Compression::decompress(p_dst, CS_PAGE_SIZE, arena + e->get().offset, e->get().size, mode);
+	int used_size = e->get().used_size;
+
+	drop(e);
+
+	ERR_FAIL_COND_V_MSG(size != used_size, -1, "Could not decompress a page from the compressed tier.");
+
+	return size;
+}
+
+void CompressedTier::remove_file(page_id p_guid_prefix) {
+	List<Entry>::Element *e = entries.front();
+	while (e) {
+		List<Entry>::Element *next = e->next();
+		if ((e->get().page & ~(page_id)0x000000FFFFFFFFFF) == p_guid_prefix) {
+			drop(e);
+		}
+		e = next;
+	}
+}
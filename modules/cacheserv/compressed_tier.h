@@ -0,0 +1,105 @@
+/*************************************************************************/
+/*  compressed_tier.h                                                    */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PAGEICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#ifndef COMPRESSED_TIER_H
+#define COMPRESSED_TIER_H
+
+#include "core/io/compression.h"
+#include "core/list.h"
+#include "core/oa_hash_map.h"
+#include "core/vector.h"
+
+#include "data_helpers.h"
+
+// A second cache tier that keeps compressed copies of pages evicted from the frames.
+//
+// When a page is evicted, its data is compressed into a ring shaped arena. A later miss on that page
+// decompresses it back into a frame instead of loading it from its file. Pages are written to the arena
+// one after the other, and when there is no room left the oldest ones are dropped, so the tier behaves
+// like a FIFO victim cache. A page leaves the tier as soon as it is brought back, so a page is never
+// both in a frame and in the tier, and writes to a page never leave a stale copy behind.
+//
+// Pages that don't compress to less than CS_COMPRESSED_TIER_MAX_RATIO of their size are not kept.
+//
+// Not thread safe. The cache manager only uses it while holding its lock.
+class CompressedTier {
+
+	struct Entry {
+		page_id page;
+		size_t offset;
+		uint32_t size;
+		uint32_t used_size;
+	};
+
+	uint8_t *arena;
+	size_t capacity;
+	// Where the next page is written.
+	size_t tail;
+	// Oldest first, which is also the order they are laid out in the arena from tail onwards.
+	List<Entry> entries;
+	OAHashMap<page_id, List<Entry>::Element *> index;
+	Vector<uint8_t> scratch;
+	Compression::Mode mode;
+
+	// The total compressed and uncompressed sizes of the pages held.
+	size_t compressed_bytes;
+	size_t raw_bytes;
+	uint64_t dropped;
+
+	void drop(List<Entry>::Element *p_entry);
+
+public:
+	// Allocates an arena of p_capacity bytes. A capacity of 0 leaves the tier disabled.
+	Error init(size_t p_capacity, Compression::Mode p_mode);
+	_FORCE_INLINE_ bool is_enabled() const { return arena != NULL; }
+
+	// Compresses the first p_used_size bytes of p_data and keeps them for p_page, dropping the oldest
+	// pages if the arena is full. Returns false if the page doesn't compress well enough to be kept.
+	bool store(page_id p_page, const uint8_t *p_data, uint32_t p_used_size);
+
+	// If the tier holds p_page, decompresses it to p_dst, which must hold a whole page, and removes it from the tier.
+	// Returns the number of bytes decompressed, or -1 if the page is not held.
+	int take(page_id p_page, uint8_t *p_dst);
+
+	// Removes every page of the file with the given GUID prefix.
+	void remove_file(page_id p_guid_prefix);
+
+	_FORCE_INLINE_ uint32_t get_page_count() const { return index.get_num_elements(); }
+	_FORCE_INLINE_ size_t get_capacity() const { return capacity; }
+	_FORCE_INLINE_ size_t get_compressed_bytes() const { return compressed_bytes; }
+	_FORCE_INLINE_ size_t get_raw_bytes() const { return raw_bytes; }
+	// The number of pages dropped to make room for newer ones.
+	_FORCE_INLINE_ uint64_t get_dropped() const { return dropped; }
+
+	CompressedTier();
+	~CompressedTier();
+};
+
+#endif // COMPRESSED_TIER_H
@@ -31,14 +31,17 @@
 #ifndef CTRL_QUEUE_H
 #define CTRL_QUEUE_H
 
-#include "core/list.h"
-#include "core/os/mutex.h"
+#include "core/os/os.h"
 #include "core/os/semaphore.h"
 #include "core/rid.h"
+#include "core/safe_refcount.h"
 
 #include "data_helpers.h"
 
-class CachedResourceHandle : public RID_Data {};
+#include <atomic>
+
+// What the RIDs of the files tracked by the cache manager point to. The files are looked up by the index of their RID.
+struct CachedResourceHandle {};
 
 struct CtrlOp {
 	enum Op {
@@ -49,22 +52,46 @@ struct CtrlOp {
 		FLUSH_CLOSE,
 	};
 
+	// Each IO worker serves the classes in this order, except for ops that waited past their deadline.
+	enum Priority {
+		// Pages a thread is waiting for, write-backs that free a frame for one, and flushes.
+		PRIORITY_INTERACTIVE,
+		// Files that are read continuously and must not fall behind, like audio and video streams.
+		PRIORITY_STREAMING,
+		// Read-ahead and warm-start loads, which nobody is waiting for yet.
+		PRIORITY_PREFETCH,
+		// Write-backs of dirty pages that are not being evicted.
+		PRIORITY_WRITE_BACK,
+		PRIORITY_MAX
+	};
+
 	DescriptorInfo *di;
 	frame_id frame;
 	size_t offset;
 	uint8_t type;
+	uint8_t priority;
+	// For loads, the file's load generation when the op was pushed. See FileCacheManager::cancel_loads().
+	uint32_t generation;
+	// When the op should be served at the latest, in OS ticks. Set by CtrlQueue::push().
+	uint64_t deadline;
 
 	CtrlOp() :
 			di(NULL),
 			frame(CS_MEM_VAL_BAD),
 			offset(CS_MEM_VAL_BAD),
-			type(QUIT) {}
+			type(QUIT),
+			priority(PRIORITY_INTERACTIVE),
+			generation(0),
+			deadline(0) {}
 
-	CtrlOp(DescriptorInfo *i_di, frame_id frame, size_t i_offset, uint8_t i_type) :
+	CtrlOp(DescriptorInfo *i_di, frame_id frame, size_t i_offset, uint8_t i_type, uint8_t i_priority = PRIORITY_INTERACTIVE) :
 			di(i_di),
 			frame(frame),
 			offset(i_offset),
-			type(i_type) {}
+			type(i_type),
+			priority(i_priority),
+			generation(0),
+			deadline(0) {}
 
 	String as_string() const {
 		return String("type: ") + (type == LOAD ? "LOAD" : type == STORE ? "STORE" : type == QUIT ? "QUIT" : type == FLUSH ? "FLUSH" : "FLUSH_CLOSE") +
@@ -74,69 +101,291 @@ struct CtrlOp {
 	}
 };
 
+// A bounded lock-free multi-producer multi-consumer ring buffer.
+//
+// Every cell carries a sequence number. A producer may fill a cell when its sequence equals
+// the producer's position, and a consumer may empty it when the sequence is one past the
+// consumer's position. Positions are claimed with a compare and swap, so neither side ever
+// takes a lock, and a full or empty ring is reported instead of blocking.
+//
+// The capacity must be a power of 2.
+template <class T>
+class CtrlRing {
+
+	struct Cell {
+		std::atomic<uint64_t> sequence;
+		T data;
+	};
+
+	Cell *cells;
+	uint64_t mask;
+
+	// Producers and consumers update different positions, so they are kept on different cache lines.
+	uint8_t pad0[64];
+	std::atomic<uint64_t> enqueue_pos;
+	uint8_t pad1[64];
+	std::atomic<uint64_t> dequeue_pos;
+	uint8_t pad2[64];
+
+public:
+	void init(uint32_t p_capacity) {
+		CRASH_COND(p_capacity < 2 || (p_capacity & (p_capacity - 1)) != 0);
+
+		cells = memnew_arr(Cell, p_capacity);
+		mask = p_capacity - 1;
+
+		for (uint32_t i = 0; i < p_capacity; ++i) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		enqueue_pos.store(0, std::memory_order_relaxed);
+		dequeue_pos.store(0, std::memory_order_relaxed);
+	}
+
+	// Returns false if the ring is full.
+	bool try_push(const T &p_data) {
+		Cell *cell;
+		uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+		while (true) {
+			cell = &cells[pos & mask];
+			uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)seq - (int64_t)pos;
+
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->data = p_data;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false if the ring is empty.
+	bool try_pop(T &r_data) {
+		Cell *cell;
+		uint64_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+		while (true) {
+			cell = &cells[pos & mask];
+			uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+
+			if (diff == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		r_data = cell->data;
+		cell->sequence.store(pos + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Copies the oldest element without removing it. Returns false if the ring is empty.
+	// Only valid when there is a single consumer, as nothing stops another one from taking the element.
+	bool try_peek(T &r_data) const {
+		uint64_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		const Cell *cell = &cells[pos & mask];
+
+		if (cell->sequence.load(std::memory_order_acquire) != pos + 1) {
+			return false;
+		}
+
+		r_data = cell->data;
+		return true;
+	}
+
+	// Approximate number of queued elements. Only meant for statistics.
+	uint32_t size() const {
+		uint64_t e = enqueue_pos.load(std::memory_order_relaxed);
+		uint64_t d = dequeue_pos.load(std::memory_order_relaxed);
+		return e > d ? (uint32_t)(e - d) : 0;
+	}
+
+	CtrlRing() :
+			cells(NULL),
+			mask(0) {}
+
+	~CtrlRing() {
+		if (cells) {
+			memdelete_arr(cells);
+		}
+	}
+};
+
+// The operation queue is split into one shard per IO worker, and each shard into one ring per priority class.
+// All operations on a file go to the same shard, so operations of the same class on a file are processed
+// in the order they were pushed, while operations on different files are spread over the workers and run in parallel.
+//
+// A worker takes operations from the highest class that has any, so a burst of read-ahead can't delay a page that
+// is needed right away. Every operation gets a deadline from its class when it is pushed though, and an operation
+// that is past it is taken before those of higher classes, so that lower classes can't starve.
 class CtrlQueue {
 
 	friend class FileCacheManager;
 
 private:
-	List<CtrlOp> queue;
-	Mutex *mut;
-	Semaphore *sem;
+	struct Shard {
+		CtrlRing<CtrlOp> rings[CtrlOp::PRIORITY_MAX];
+		// Posted once per pushed operation, so a worker only sleeps when its shard is empty.
+		Semaphore sem;
+	};
 
-	CtrlOp pop() {
-		// We keep this loop to catch the case where the semaphore is triggered even when the queue is empty.
-		while (true) {
+	Shard *shards;
+	uint32_t shard_count;
 
-			while (queue.empty()) {
-				sem->wait();
-			}
+	// The number of operations taken ahead of higher classes because they were past their deadline.
+	volatile uint64_t deadline_promotions;
 
-			if (sig_quit) return CtrlOp();
+	// How long operations of each class may wait before they are served ahead of higher classes.
+	static uint64_t get_deadline_budget(uint8_t p_priority) {
+		static const uint64_t budgets[CtrlOp::PRIORITY_MAX] = {
+			0,
+			CS_DEADLINE_STREAMING_USEC,
+			CS_DEADLINE_PREFETCH_USEC,
+			CS_DEADLINE_WRITE_BACK_USEC,
+		};
+		return budgets[p_priority];
+	}
+
+	_FORCE_INLINE_ Shard &get_shard(const DescriptorInfo *di) {
+		return shards[(di->guid_prefix >> 40) % shard_count];
+	}
 
-			{ // We only need to lock when accessing the queue.
-				MutexLock ml(mut);
-				// If the queue isn't empty, we can pop. otherwise, loop back around and wait for the queue to be filled.
-				if (!queue.empty()) {
-					CtrlOp op = queue.front()->get();
-					queue.pop_front();
-					return op;
+	static void push_to(CtrlRing<CtrlOp> &ring, Semaphore &sem, const CtrlOp &op) {
+		// The rings are bounded. When one is full the producer waits for the worker to catch up.
+		while (!ring.try_push(op)) {
+			OS::get_singleton()->delay_usec(1);
+		}
+		sem.post();
+	}
+
+	// Takes the next operation from a shard that is known to hold one.
+	// Each shard has a single consumer, its worker, so peeking at the front of a ring is safe.
+	void take(Shard &shard, CtrlOp &r_op) {
+		uint64_t now = OS::get_singleton()->get_ticks_usec();
+
+		for (int i = CtrlOp::PRIORITY_INTERACTIVE + 1; i < CtrlOp::PRIORITY_MAX; ++i) {
+			if (shard.rings[i].try_peek(r_op) && r_op.deadline <= now && shard.rings[i].try_pop(r_op)) {
+				if (shard.rings[CtrlOp::PRIORITY_INTERACTIVE].size()) {
+					atomic_increment(&deadline_promotions);
 				}
+				return;
+			}
+		}
+
+		for (int i = CtrlOp::PRIORITY_INTERACTIVE; i < CtrlOp::PRIORITY_MAX; ++i) {
+			if (shard.rings[i].try_pop(r_op)) {
+				return;
 			}
 		}
+
+		// Each wait on the semaphore matches exactly one push, so one of the rings must hold an operation.
+		CRASH_NOW();
 	}
 
-public:
-	bool sig_quit;
+	// Blocks until an operation is available in the given shard.
+	CtrlOp pop(uint32_t shard_idx) {
+		Shard &shard = shards[shard_idx];
+		CtrlOp op;
+
+		shard.sem.wait();
+		take(shard, op);
+
+		return op;
+	}
 
-	CtrlQueue() {
-		mut = Mutex::create();
-		sem = Semaphore::create();
-		sig_quit = false;
+	// Like pop, but returns false instead of blocking when the shard is empty.
+	bool try_pop(uint32_t shard_idx, CtrlOp &r_op) {
+		Shard &shard = shards[shard_idx];
+
+		if (!shard.sem.try_wait()) {
+			return false;
+		}
+
+		take(shard, r_op);
+		return true;
 	}
 
+public:
+	volatile bool sig_quit;
+
+	CtrlQueue() :
+			shards(NULL),
+			shard_count(0),
+			deadline_promotions(0),
+			sig_quit(false) {}
+
 	~CtrlQueue() {
-		memdelete(mut);
-		memdelete(sem);
+		if (shards) {
+			memdelete_arr(shards);
+		}
 	}
 
-	// Pushes to the back ofthe queue.
+	void init(uint32_t p_shard_count, uint32_t p_capacity) {
+		CRASH_COND(shards != NULL || p_shard_count == 0);
+
+		shard_count = p_shard_count;
+		shards = memnew_arr(Shard, shard_count);
+
+		for (uint32_t i = 0; i < shard_count; ++i) {
+			for (int j = 0; j < CtrlOp::PRIORITY_MAX; ++j) {
+				shards[i].rings[j].init(p_capacity);
+			}
+		}
+	}
+
+	// Pushes to the back of the ring of the operation's class, in the file's shard.
+	// The file's pending operation count is released by the worker once the operation is done.
 	void push(CtrlOp op) {
-		MutexLock ml = MutexLock(mut);
-		queue.push_back(op);
-		// for (List<CtrlOp>::Element *i = queue.front(); i; i = i->next())
-		// 	WARN_PRINTS("Curr op: " + String(i->get().type == CtrlOp::LOAD ? "load" : "other") + " op with page: " + itoh(i->get().offset) + " and frame: " + itoh(i->get().frame))
-		sem->post();
+		CRASH_COND(op.priority >= CtrlOp::PRIORITY_MAX);
+
+		Shard &shard = get_shard(op.di);
+		op.deadline = OS::get_singleton()->get_ticks_usec() + get_deadline_budget(op.priority);
+		atomic_increment(&op.di->pending_ops);
+		push_to(shard.rings[op.priority], shard.sem, op);
+	}
+
+	// Wakes up every worker with a QUIT operation.
+	void push_quit() {
+		sig_quit = true;
+		for (uint32_t i = 0; i < shard_count; ++i) {
+			push_to(shards[i].rings[CtrlOp::PRIORITY_INTERACTIVE], shards[i].sem, CtrlOp());
+		}
+	}
 
-		// WARN_PRINTS("Pushed " + String(op.type == CtrlOp::LOAD ? "load" : "other") + " op with page: " + itoh(op.offset) + " and frame: " + itoh(op.frame))
+	// Approximate number of operations waiting in all shards.
+	uint32_t size() const {
+		uint32_t total = 0;
+		for (int i = 0; i < CtrlOp::PRIORITY_MAX; ++i) {
+			total += size(i);
+		}
+		return total;
 	}
 
-	// Pushes to the queue's front, so the pushed operation is processed ASAP.
-	void priority_push(CtrlOp op) {
-		MutexLock ml = MutexLock(mut);
-		queue.push_front(op);
-		sem->post();
-		// WARN_PRINTS("Priority pushed op.")
+	// Approximate number of operations of one class waiting in all shards.
+	uint32_t size(int p_priority) const {
+		uint32_t total = 0;
+		for (uint32_t i = 0; i < shard_count; ++i) {
+			total += shards[i].rings[p_priority].size();
+		}
+		return total;
 	}
+
+	uint64_t get_deadline_promotions() const { return deadline_promotions; }
 };
 
 #endif //CTRL_QUEUE_H
@@ -33,7 +33,7 @@
 #include "file_cache_manager.h"
 
 DescriptorInfo::DescriptorInfo(FileAccess *fa, page_id new_range, int cache_policy) :
-		offset(0), guid_prefix(new_range), cache_policy(cache_policy), valid(true) {
+		offset(0), guid_prefix(new_range), cache_policy(cache_policy), async_fd(-1), pinned_pages(0), warm_start(false), open_mode(FileAccess::READ), open_count(1), io_priority(CtrlOp::PRIORITY_INTERACTIVE), load_generation(0), store_error(OK), pending_ops(1), async_reads(0), mapped_region(NULL), mapped_size(0), valid(true), dirty(false), last_read_end(0), read_ahead_end(0), seq_reads(0), read_ahead_window(0) {
 	ERR_FAIL_COND(!fa);
 	internal_data_source = fa;
 	switch (cache_policy) {
@@ -46,11 +46,16 @@ DescriptorInfo::DescriptorInfo(FileAccess *fa, page_id new_range, int cache_poli
 		case _FileCacheManager::FIFO:
 			max_pages = CS_FIFO_THRESH_DEFAULT;
 			break;
+		case _FileCacheManager::CLOCK:
+			max_pages = CS_CLOCK_THRESH_DEFAULT;
+			break;
+		case _FileCacheManager::ARC:
+			max_pages = CS_ARC_THRESH_DEFAULT;
+			break;
 	}
 	total_size = internal_data_source->get_len();
 	path = internal_data_source->get_path();
-	ready_sem = Semaphore::create();
-	dirty_sem = Semaphore::create();
+	modified_time = FileAccess::get_modified_time(path);
 	lock = RWLock::create();
 }
 
@@ -68,6 +73,8 @@ Variant DescriptorInfo::to_variant(const FileCacheManager &p) {
 	out["guid_prefix"] = Variant(itoh(guid_prefix));
 	out["pages"] = Variant(d);
 	out["cache_policy"] = Variant(cache_policy);
+	out["mmap"] = Variant(mapped_region != NULL);
+	out["warm_start"] = Variant(warm_start);
 
 
 	return Variant(out);
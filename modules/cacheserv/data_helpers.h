@@ -32,6 +32,7 @@
 #define CACHE_INFO_TABLE_H
 
 #include "core/map.h"
+#include "core/oa_hash_map.h"
 #include "core/object.h"
 #include "core/os/file_access.h"
 #include "core/os/rw_lock.h"
@@ -39,12 +40,17 @@
 #include "core/os/thread.h"
 #include "core/reference.h"
 #include "core/rid.h"
+#include "core/safe_refcount.h"
 #include "core/set.h"
 #include "core/variant.h"
 #include "core/vector.h"
 
 #include "cacheserv_defines.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
 // Int to hex string.
 _FORCE_INLINE_ String itoh(size_t num) {
 	char x[100];
@@ -58,69 +64,250 @@ typedef uint64_t page_id;
 
 struct CacheInfoTable;
 struct Frame;
+struct FrameList;
 struct DescriptorInfo;
 
 class FileCacheManager;
 
+// Maps the GUIDs of tracked pages to the frames that hold them.
+// Every cache access goes through this table, so it is an open addressing hash table rather than a tree.
+struct PageTable {
+private:
+	OAHashMap<page_id, frame_id> map;
+
+public:
+	// Returns the frame holding the page, or CS_MEM_VAL_BAD if the page is not tracked.
+	_FORCE_INLINE_ frame_id operator[](page_id p_page) const {
+		const frame_id *f = map.lookup_ptr(p_page);
+		return f ? *f : (frame_id)CS_MEM_VAL_BAD;
+	}
+
+	_FORCE_INLINE_ bool has(page_id p_page) const { return map.has(p_page); }
+
+	// Returns false if the page was already tracked, in which case its frame is left unchanged.
+	_FORCE_INLINE_ bool insert(page_id p_page, frame_id p_frame) {
+		if (map.has(p_page)) {
+			return false;
+		}
+		map.insert(p_page, p_frame);
+		return true;
+	}
+
+	_FORCE_INLINE_ void erase(page_id p_page) { map.remove(p_page); }
+	_FORCE_INLINE_ uint32_t size() const { return map.get_num_elements(); }
+	void clear() { map.clear(); }
+
+	// Makes room for p_pages pages, so that the table never has to grow while the cache is in use.
+	void reserve(uint32_t p_pages) {
+		// OAHashMap grows once it is 90% full.
+		uint32_t capacity = p_pages + p_pages / 8 + 1;
+		if (capacity > map.get_capacity()) {
+			map.reserve(capacity);
+		}
+	}
+};
+
+// Lets threads wait for the frames of a file to change state, and for the file to be closed.
+// Unlike a counting semaphore, every change wakes all the waiters and each one checks the state it waits for,
+// so a waiter can't take a wake-up meant for another page, and no waiter can miss one.
+class StateSignal {
+	mutable std::mutex mutex_;
+	mutable std::condition_variable condition_;
+
+public:
+	// Must be called after the state has changed. The waiters check the state while holding the mutex,
+	// so one that saw the old state is already waiting by the time this can lock it.
+	_FORCE_INLINE_ void broadcast() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		condition_.notify_all();
+	}
+
+	// Blocks until p_done returns true.
+	template <class C>
+	_FORCE_INLINE_ void wait_until(C p_done) const {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!p_done()) {
+			condition_.wait(lock);
+		}
+	}
+};
+
 struct DescriptorInfo {
 	String path;
+	// The tracked pages of the file, in no particular order. Each frame knows where its page is, see Frame::get_page_index().
 	Vector<page_id> pages;
+	// One bit per page of the file, set while the page is tracked, so that checking for a page doesn't search pages.
+	// Grows as pages further into the file get tracked.
+	Vector<uint64_t> page_bitmap;
 	FileAccess *internal_data_source;
-	Semaphore *ready_sem;
-	Semaphore *dirty_sem;
+	// Broadcast when a frame of the file becomes ready, and when the file is closed.
+	StateSignal ready_signal;
+	// Broadcast when a frame of the file becomes clean.
+	StateSignal dirty_signal;
 	RWLock *lock;
 	size_t offset;
 	size_t total_size;
+	// The modification time of the file when it was last closed, to tell whether its pages are still current when it is reopened.
+	uint64_t modified_time;
 	page_id guid_prefix;
 	int cache_policy;
 	int max_pages;
+	// The descriptor of the data source if it is a file that supports batched positional IO, -1 otherwise.
+	int async_fd;
+	// The number of page pins currently held on this file.
+	uint32_t pinned_pages;
+	// True if the file was opened by the warm start and nobody has opened it since.
+	bool warm_start;
+	// The FileAccess::ModeFlags the file is open with.
+	int open_mode;
+	// The number of opens the file has not been closed for yet. Only files opened for reading can be opened more than once.
+	uint32_t open_count;
+	// The CtrlOp::Priority class that loads of this file are queued with, unless they are read-ahead.
+	uint8_t io_priority;
+	// Bumped to cancel the loads already queued for this file. Loads pushed with an older generation are skipped.
+	volatile uint32_t load_generation;
+	// ERR_FILE_CANT_WRITE once a write-back of one of the file's pages failed, OK until then.
+	Error store_error;
+	// The number of ops for this file that are queued or being processed, plus one held by the cache until
+	// FileCacheManager::remove_data_source(). Whoever drops it to 0 frees the descriptor.
+	volatile uint32_t pending_ops;
+	// The number of reads of this file made with FileCacheManager::read_async() that are not done yet.
+	volatile uint32_t async_reads;
+	// When the file is served through mmap, its mapping. NULL for files whose pages go through the frames.
+	const uint8_t *mapped_region;
+	size_t mapped_size;
 	bool valid;
 	bool dirty;
 
+	// Sequential access detection and read-ahead state.
+	// The offset right after the end of the previous read.
+	size_t last_read_end;
+	// The offset of the first page that has not been read ahead yet.
+	size_t read_ahead_end;
+	// The number of consecutive reads that started where the previous one ended.
+	uint32_t seq_reads;
+	// The current read-ahead window, in pages. 0 when the file is not being read sequentially.
+	uint32_t read_ahead_window;
+
 	// Create a new DescriptorInfo with a new random namespace defined by 24 most significant bits.
 	DescriptorInfo(FileAccess *fa, page_id new_guid_prefix, int cache_policy);
 	~DescriptorInfo() {
-		while (dirty) dirty_sem->wait();
-		memdelete(ready_sem);
-		memdelete(dirty_sem);
+		dirty_signal.wait_until([this]() { return !dirty; });
 		memdelete(lock);
 	}
 
+	_FORCE_INLINE_ bool has_page(size_t p_offset) const {
+		size_t index = CS_GET_PAGE_INDEX(p_offset);
+		return (index >> 6) < (size_t)page_bitmap.size() && (page_bitmap[index >> 6] & ((uint64_t)1 << (index & 63)));
+	}
+
+	void set_page_tracked(size_t p_offset, bool p_tracked) {
+		size_t index = CS_GET_PAGE_INDEX(p_offset);
+		if ((index >> 6) >= (size_t)page_bitmap.size()) {
+			if (!p_tracked) {
+				return;
+			}
+			size_t old_size = page_bitmap.size();
+			page_bitmap.resize((index >> 6) + 1);
+			memset(page_bitmap.ptrw() + old_size, 0, (page_bitmap.size() - old_size) * sizeof(uint64_t));
+		}
+		if (p_tracked) {
+			page_bitmap.write[index >> 6] |= (uint64_t)1 << (index & 63);
+		} else {
+			page_bitmap.write[index >> 6] &= ~((uint64_t)1 << (index & 63));
+		}
+	}
+
 	Variant to_variant(const FileCacheManager &p);
 };
 
 struct Frame {
 	friend class FileCacheManager;
+	friend struct FrameList;
 
 private:
 	uint8_t *const memory_region;
+	// The replacement policy list this frame belongs to, and its neighbours in that list.
+	FrameList *list;
+	frame_id list_prev;
+	frame_id list_next;
 	page_id owning_page;
 	uint32_t ts_last_use;
-	uint16_t used_size;
-	volatile bool dirty;
-	volatile bool ready;
-	volatile bool used;
+	// The number of times the current page was found in the cache. Saved in the warm-start manifest.
+	uint32_t access_count;
+	// Where the current page is in the DescriptorInfo::pages of its file.
+	uint32_t page_index;
+	uint32_t used_size;
+	// The number of pins held on this frame. A pinned frame is not in any policy list and is never evicted.
+	uint32_t pin_count;
+	// The number of threads copying data out of this frame without holding the cache manager's lock.
+	// A frame is only evicted once it has no readers left.
+	std::atomic<uint32_t> readers;
+	// The state flags are read without any lock by readers and IO workers, and the transitions are
+	// made by whichever thread owns the frame at the time, so they are atomic.
+	std::atomic<bool> dirty;
+	std::atomic<bool> ready;
+	std::atomic<bool> used;
+	// Set while an IO worker reads the frame's page into it. See FileCacheManager::claim_load_frame().
+	std::atomic<bool> loading;
+	// Set when the last write-back of the frame failed, or only wrote part of it. The frame stays dirty.
+	std::atomic<bool> store_failed;
+	// Set by the background flusher when it queues a write-back of this frame, and cleared by the IO worker
+	// once it is done with it, so that the frame isn't queued again in the meantime.
+	std::atomic<bool> write_back_queued;
+	// True if this frame was filled by read-ahead and has not been accessed yet.
+	bool read_ahead;
+	// True if this frame was loaded by check_cache() and the read it was loaded for has not happened yet.
+	bool prefetched;
+	// Reference bit for the CLOCK replacement policy.
+	bool referenced;
 
 public:
 	Frame() :
 			memory_region(NULL),
+			list(NULL),
+			list_prev(CS_MEM_VAL_BAD),
+			list_next(CS_MEM_VAL_BAD),
 			owning_page(0),
 			ts_last_use(0),
+			access_count(0),
+			page_index(0),
 			used_size(0),
+			pin_count(0),
+			readers(0),
 			dirty(false),
 			ready(false),
-			used(false) {}
+			used(false),
+			loading(false),
+			store_failed(false),
+			write_back_queued(false),
+			read_ahead(false),
+			prefetched(false),
+			referenced(false) {}
 
 	explicit Frame(
 			uint8_t *i_memory_region) :
 
 			memory_region(i_memory_region),
+			list(NULL),
+			list_prev(CS_MEM_VAL_BAD),
+			list_next(CS_MEM_VAL_BAD),
 			owning_page(0),
 			ts_last_use(0),
+			access_count(0),
+			page_index(0),
 			used_size(0),
+			pin_count(0),
+			readers(0),
 			dirty(false),
 			ready(false),
-			used(false) {}
+			used(false),
+			loading(false),
+			store_failed(false),
+			write_back_queued(false),
+			read_ahead(false),
+			prefetched(false),
+			referenced(false) {}
 
 	~Frame() {
 	}
@@ -131,62 +318,107 @@ public:
 
 	_FORCE_INLINE_ Frame &set_owning_page(page_id page) {
 		// A frame whose owning page is changing should not be dirty and should be in a non-ready state.
-		CRASH_COND(dirty || ready)
+		CRASH_COND(dirty || ready);
 		owning_page = page;
+		access_count = 0;
 		return *this;
 	}
 
 	_FORCE_INLINE_ bool get_dirty() {
-		return dirty;
+		return dirty.load(std::memory_order_acquire);
 	}
 
-	_FORCE_INLINE_ Frame &set_dirty_true() {
+	// dirty_count is only touched on an actual clean -> dirty transition,
+	// so it always matches the number of dirty frames.
+	_FORCE_INLINE_ Frame &set_dirty_true(volatile uint32_t *dirty_count) {
 		// A page that isn't ready can't become dirty.
-		CRASH_COND(!ready)
-		dirty = true;
-		String a;
-		a.parse_utf8((const char *)(this->memory_region), 4095);
-		// WARN_PRINTS("Dirty page.\n\n" + a + "\n\n");
+		CRASH_COND(!ready);
+		if (!dirty.exchange(true, std::memory_order_acq_rel)) {
+			atomic_increment(dirty_count);
+		}
 		return *this;
 	}
 
-	_FORCE_INLINE_ Frame &set_dirty_false(Semaphore *dirty_sem, frame_id frame) {
+	_FORCE_INLINE_ Frame &set_dirty_false(const StateSignal *dirty_signal, volatile uint32_t *dirty_count) {
 		// A page which is dirty as well as not ready is in an invalid state.
-		CRASH_COND(!ready)
-		dirty = false;
-		// WARN_PRINTS("Dirty page " + itoh(frame) + " is clean.");
-		dirty_sem->post();
+		CRASH_COND(!ready);
+		if (dirty.exchange(false, std::memory_order_acq_rel)) {
+			atomic_decrement(dirty_count);
+		}
+		store_failed.store(false, std::memory_order_release);
+		dirty_signal->broadcast();
+		return *this;
+	}
+
+	_FORCE_INLINE_ bool get_store_failed() {
+		return store_failed.load(std::memory_order_acquire);
+	}
+
+	// Wakes the threads waiting for the frame to become clean, which it won't until it is stored again.
+	_FORCE_INLINE_ Frame &set_store_failed(bool in, const StateSignal *dirty_signal) {
+		store_failed.store(in, std::memory_order_release);
+		if (in) {
+			dirty_signal->broadcast();
+		}
 		return *this;
 	}
 
 	_FORCE_INLINE_ bool get_used() {
-		return used;
+		return used.load(std::memory_order_acquire);
 	}
 
 	_FORCE_INLINE_ Frame &set_used(bool in) {
 		// All io ops must be completed (page must not be dirty) for this transition to be valid.
-		CRASH_COND(dirty)
-		used = in;
+		CRASH_COND(dirty);
+		used.store(in, std::memory_order_release);
 		return *this;
 	}
 
 	_FORCE_INLINE_ bool get_ready() {
-		return ready;
+		return ready.load(std::memory_order_acquire);
 	}
 
-	_FORCE_INLINE_ Frame &set_ready_true(Semaphore *ready_sem) {
+	_FORCE_INLINE_ Frame &set_ready_true(const StateSignal *ready_signal) {
 		// A page cannot be dirty before it is ready.
-		CRASH_COND(!ready && dirty)
-		ready = true;
-		ready_sem->post();
+		CRASH_COND(!ready && dirty);
+		// Publishes the data loaded into the frame to the threads that see it ready.
+		ready.store(true, std::memory_order_release);
+		ready_signal->broadcast();
 		// WARN_PRINTS("Part ready for page " + itoh(page) + " and frame " + itoh(frame) + " .");
 		return *this;
 	}
 
+	_FORCE_INLINE_ bool get_loading() {
+		return loading.load(std::memory_order_acquire);
+	}
+
+	_FORCE_INLINE_ Frame &set_loading_true() {
+		// Only a frame that isn't ready is loaded, and only once at a time.
+		CRASH_COND(ready || loading);
+		loading.store(true, std::memory_order_release);
+		return *this;
+	}
+
+	// Publishes the data loaded into the frame. The frame is ready before it stops loading,
+	// so a thread that waited for the load to finish finds the frame ready.
+	_FORCE_INLINE_ Frame &finish_load(uint32_t p_used_size, const StateSignal *ready_signal) {
+		CRASH_COND(!loading);
+		used_size = p_used_size;
+		ready.store(true, std::memory_order_release);
+		loading.store(false, std::memory_order_release);
+		ready_signal->broadcast();
+		return *this;
+	}
+
+	_FORCE_INLINE_ Frame &wait_not_loading(const StateSignal *ready_signal) {
+		ready_signal->wait_until([this]() { return !loading.load(std::memory_order_acquire); });
+		return *this;
+	}
+
 	_FORCE_INLINE_ Frame &set_ready_false() {
 		// A page that is dirty must always be ready.
-		CRASH_COND(dirty)
-		ready = false;
+		CRASH_COND(dirty);
+		ready.store(false, std::memory_order_release);
 		return *this;
 	}
 
@@ -194,6 +426,26 @@ public:
 		return ts_last_use;
 	}
 
+	_FORCE_INLINE_ uint32_t get_access_count() {
+		return access_count;
+	}
+
+	_FORCE_INLINE_ uint32_t get_page_index() {
+		return page_index;
+	}
+
+	_FORCE_INLINE_ Frame &set_page_index(uint32_t index) {
+		page_index = index;
+		return *this;
+	}
+
+	_FORCE_INLINE_ Frame &add_access() {
+		if (access_count < UINT32_MAX) {
+			access_count += 1;
+		}
+		return *this;
+	}
+
 	_FORCE_INLINE_ Frame &set_last_use(uint32_t in) {
 		// maybe unnecessary.
 		// CRASH_COND(dirty)
@@ -201,25 +453,90 @@ public:
 		return *this;
 	}
 
-	_FORCE_INLINE_ Frame &wait_clean(Semaphore *sem) {
-		while (dirty != false)
-			sem->wait();
+	_FORCE_INLINE_ Frame &wait_clean(const StateSignal *dirty_signal) {
+		dirty_signal->wait_until([this]() { return !dirty.load(std::memory_order_acquire); });
 		// ERR_PRINTS("Page is clean.")
 		return *this;
 	}
 
-	_FORCE_INLINE_ Frame &wait_ready(Semaphore *sem) {
-		while (ready != true)
-			sem->wait();
+	_FORCE_INLINE_ Frame &wait_ready(const StateSignal *ready_signal) {
+		ready_signal->wait_until([this]() { return ready.load(std::memory_order_acquire); });
 		// ERR_PRINTS("Page is clean.")
 		return *this;
 	}
 
-	_FORCE_INLINE_ uint16_t get_used_size() {
+	_FORCE_INLINE_ bool get_write_back_queued() {
+		return write_back_queued.load(std::memory_order_acquire);
+	}
+
+	_FORCE_INLINE_ Frame &set_write_back_queued(bool in) {
+		write_back_queued.store(in, std::memory_order_release);
+		return *this;
+	}
+
+	_FORCE_INLINE_ bool get_read_ahead() {
+		return read_ahead;
+	}
+
+	_FORCE_INLINE_ Frame &set_read_ahead(bool in) {
+		read_ahead = in;
+		return *this;
+	}
+
+	_FORCE_INLINE_ bool get_prefetched() {
+		return prefetched;
+	}
+
+	_FORCE_INLINE_ Frame &set_prefetched(bool in) {
+		prefetched = in;
+		return *this;
+	}
+
+	_FORCE_INLINE_ bool get_referenced() {
+		return referenced;
+	}
+
+	_FORCE_INLINE_ Frame &set_referenced(bool in) {
+		referenced = in;
+		return *this;
+	}
+
+	_FORCE_INLINE_ bool get_pinned() {
+		return pin_count > 0;
+	}
+
+	// Returns the number of pins held after this one was added.
+	_FORCE_INLINE_ uint32_t pin() {
+		return ++pin_count;
+	}
+
+	// Returns the number of pins still held.
+	_FORCE_INLINE_ uint32_t unpin() {
+		CRASH_COND(pin_count == 0);
+		return --pin_count;
+	}
+
+	_FORCE_INLINE_ void acquire_reader() {
+		readers.fetch_add(1, std::memory_order_acquire);
+	}
+
+	// The last reader to leave broadcasts signal, for anyone waiting to reuse the frame.
+	_FORCE_INLINE_ void release_reader(const StateSignal *signal) {
+		CRASH_COND(readers.load(std::memory_order_relaxed) == 0);
+		if (readers.fetch_sub(1, std::memory_order_release) == 1) {
+			signal->broadcast();
+		}
+	}
+
+	_FORCE_INLINE_ bool has_readers() {
+		return readers.load(std::memory_order_acquire) != 0;
+	}
+
+	_FORCE_INLINE_ uint32_t get_used_size() {
 		return used_size;
 	}
 
-	_FORCE_INLINE_ Frame &set_used_size(uint16_t in) {
+	_FORCE_INLINE_ Frame &set_used_size(uint32_t in) {
 		used_size = in;
 		return *this;
 	}
@@ -232,9 +549,16 @@ public:
 		a["memory_region"] = Variant(itoh(reinterpret_cast<size_t>(memory_region)) +  " # " + s + " ... ");
 		a["used_size"] = Variant(itoh(used_size));
 		a["time_since_last_use"] = Variant(itoh(ts_last_use));
-		a["used"] = Variant(used);
-		a["dirty"] = Variant(dirty);
-		a["ready"] = Variant(ready);
+		a["access_count"] = Variant(access_count);
+		a["used"] = Variant(used.load());
+		a["dirty"] = Variant(dirty.load());
+		a["ready"] = Variant(ready.load());
+		a["readers"] = Variant(readers.load());
+		a["loading"] = Variant(loading.load());
+		a["store_failed"] = Variant(store_failed.load());
+		a["read_ahead"] = Variant(read_ahead);
+		a["prefetched"] = Variant(prefetched);
+		a["pin_count"] = Variant(pin_count);
 
 		return Variant(a);
 	}
@@ -259,8 +583,7 @@ public:
 		DataRead(const Frame *alloc, DescriptorInfo *desc_info) :
 				rwl(desc_info->lock),
 				mem(alloc->memory_region) {
-			while (!(alloc->ready))
-				desc_info->ready_sem->wait();
+			desc_info->ready_signal.wait_until([alloc]() { return alloc->ready.load(std::memory_order_acquire); });
 			// WARN_PRINT(("Acquiring data READ lock in thread ID "  + itoh(Thread::get_caller_id()) ).utf8().get_data());
 			acquire();
 		}
@@ -296,8 +619,7 @@ public:
 				rwl(desc_info->lock),
 				mem(p_alloc->memory_region) {
 			if (is_io_op)
-				while (p_alloc->dirty)
-					desc_info->dirty_sem->wait();
+				desc_info->dirty_signal.wait_until([p_alloc]() { return !p_alloc->dirty.load(std::memory_order_acquire); });
 			acquire();
 		}
 
@@ -310,4 +632,97 @@ public:
 	};
 };
 
+// An intrusive doubly linked list of frames, used by the replacement policies.
+// The links live in the frames themselves, so inserting, removing and moving a frame
+// are all O(1) and never allocate. Each frame belongs to at most one list at a time.
+//
+// The head holds the most recently inserted (or moved) frame, the tail the oldest one.
+struct FrameList {
+	frame_id head;
+	frame_id tail;
+	uint32_t count;
+
+	FrameList() :
+			head(CS_MEM_VAL_BAD),
+			tail(CS_MEM_VAL_BAD),
+			count(0) {}
+
+	_FORCE_INLINE_ bool empty() const {
+		return count == 0;
+	}
+
+	_FORCE_INLINE_ uint32_t size() const {
+		return count;
+	}
+
+	_FORCE_INLINE_ bool has(const Vector<Frame *> &frames, frame_id frame) const {
+		return frames[frame]->list == this;
+	}
+
+	_FORCE_INLINE_ void push_front(const Vector<Frame *> &frames, frame_id frame) {
+		Frame *f = frames[frame];
+		CRASH_COND(f->list != NULL);
+
+		f->list = this;
+		f->list_prev = CS_MEM_VAL_BAD;
+		f->list_next = head;
+
+		if (head != (frame_id)CS_MEM_VAL_BAD) {
+			frames[head]->list_prev = frame;
+		} else {
+			tail = frame;
+		}
+
+		head = frame;
+		count += 1;
+	}
+
+	// Does nothing if the frame is not in this list.
+	_FORCE_INLINE_ void remove(const Vector<Frame *> &frames, frame_id frame) {
+		Frame *f = frames[frame];
+		if (f->list != this) {
+			return;
+		}
+
+		if (f->list_prev != (frame_id)CS_MEM_VAL_BAD) {
+			frames[f->list_prev]->list_next = f->list_next;
+		} else {
+			head = f->list_next;
+		}
+
+		if (f->list_next != (frame_id)CS_MEM_VAL_BAD) {
+			frames[f->list_next]->list_prev = f->list_prev;
+		} else {
+			tail = f->list_prev;
+		}
+
+		f->list = NULL;
+		f->list_prev = CS_MEM_VAL_BAD;
+		f->list_next = CS_MEM_VAL_BAD;
+		count -= 1;
+	}
+
+	_FORCE_INLINE_ void move_to_front(const Vector<Frame *> &frames, frame_id frame) {
+		if (head == frame) {
+			return;
+		}
+		remove(frames, frame);
+		push_front(frames, frame);
+	}
+
+	// The frame inserted right after this one, or CS_MEM_VAL_BAD if it is the head.
+	_FORCE_INLINE_ frame_id newer(const Vector<Frame *> &frames, frame_id frame) const {
+		return frames[frame]->list_prev;
+	}
+
+	// Removes the oldest frame from the list and returns it, or CS_MEM_VAL_BAD if the list is empty.
+	_FORCE_INLINE_ frame_id pop_back(const Vector<Frame *> &frames) {
+		frame_id frame = tail;
+		if (frame != (frame_id)CS_MEM_VAL_BAD) {
+			remove(frames, frame);
+		}
+		return frame;
+	}
+};
+
 #endif // !CACHE_INFO_TABLE_H
@@ -2,6 +2,88 @@
 
 #include "core/error_macros.h"
 #include "core/engine.h"
+#include "core/message_queue.h"
 
 #include "file_access_cached.h"
 
+
+HashMap<String, int> FileAccessCached::resource_policies;
+int FileAccessCached::default_resource_policy = _FileCacheManager::LRU;
+
+// Set while a resource is opened through the cache, so that the cache manager opening the
+// file itself with FileAccess::open() gets a regular file instead of coming back here.
+static thread_local bool opening_resource = false;
+
+FileAccess *FileAccessCached::open_resource(const String &p_path, bool p_is_pack) {
+	if (opening_resource) {
+		return NULL;
+	}
+
+	// FileAccess::exists() opens the file to check for it, so a missing file is not an error here.
+	FileAccess *check = FileAccess::create_for_path(p_path);
+	bool exists = check->file_exists(p_path);
+	memdelete(check);
+	if (!exists) {
+		return NULL;
+	}
+
+	int cache_policy = default_resource_policy;
+	if (!p_is_pack) {
+		const int *policy = resource_policies.getptr(p_path.get_extension().to_lower());
+		if (policy) {
+			cache_policy = *policy;
+		}
+	}
+
+	FileAccessCached *fac = memnew(FileAccessCached);
+
+	// Nothing is cached until the file is read, as many opens only check that the file exists, or read its header.
+	opening_resource = true;
+	Error err = fac->cached_open(p_path, FileAccess::READ, cache_policy, false, false);
+	opening_resource = false;
+
+	if (err != OK) {
+		memdelete(fac);
+		return NULL;
+	}
+
+	return fac;
+}
+
+void FileAccessCached::async_read_done(void *p_udata, Error p_error, size_t p_length) {
+	CachedReadRequest *request = static_cast<CachedReadRequest *>(p_udata);
+
+	// Nobody else has seen the data yet, so it can be resized in place.
+	if (p_error == OK) {
+		request->data.resize(p_length);
+	}
+	request->status.store(p_error == OK ? CachedReadRequest::STATUS_DONE : CachedReadRequest::STATUS_FAILED, std::memory_order_release);
+
+	// The queued call holds its own reference to the request.
+	if (!request->callback.is_null() && MessageQueue::get_singleton()) {
+		Variant arg = Ref<CachedReadRequest>(request);
+		const Variant *args[1] = { &arg };
+		MessageQueue::get_singleton()->push_callable(request->callback, args, 1);
+	}
+
+	if (request->unreference()) {
+		memdelete(request);
+	}
+}
+
+void FileAccessCached::set_resource_caching(bool p_enable, const Dictionary &p_policies, int p_default_policy) {
+	ERR_FAIL_INDEX(p_default_policy, CS_CACHE_POLICY_COUNT);
+
+	resource_policies.clear();
+	default_resource_policy = p_default_policy;
+
+	List<Variant> extensions;
+	p_policies.get_key_list(&extensions);
+	for (List<Variant>::Element *E = extensions.front(); E; E = E->next()) {
+		int cache_policy = p_policies[E->get()];
+		ERR_CONTINUE_MSG(cache_policy < 0 || cache_policy >= CS_CACHE_POLICY_COUNT, "Invalid cache policy for resource extension " + String(E->get()) + ".");
+		resource_policies[String(E->get()).to_lower()] = cache_policy;
+	}
+
+	FileAccess::set_cached_open_func(p_enable ? open_resource : NULL);
+}
@@ -36,11 +36,63 @@
 #include "core/object.h"
 #include "core/os/file_access.h"
 #include "core/os/semaphore.h"
+#include "core/project_settings.h"
+#include "core/reference.h"
 
 #include "file_cache_manager.h"
 
+#include <atomic>
+
 class _FileAccessCached;
 
+// A read made with FileAccessCached::read_async(). It can be polled until it is done,
+// and is also passed to the callback of the read, if it has one.
+class CachedReadRequest : public Reference {
+	GDCLASS(CachedReadRequest, Reference);
+
+	friend class FileAccessCached;
+
+public:
+	enum Status {
+		STATUS_PENDING,
+		STATUS_DONE,
+		STATUS_FAILED,
+	};
+
+private:
+	uint64_t offset;
+	PackedByteArray data;
+	Callable callback;
+	// Set by the cache manager's async reader thread once data holds what was read.
+	std::atomic<int> status;
+
+protected:
+	static void _bind_methods() {
+		ClassDB::bind_method(D_METHOD("get_status"), &CachedReadRequest::get_status);
+		ClassDB::bind_method(D_METHOD("is_done"), &CachedReadRequest::is_done);
+		ClassDB::bind_method(D_METHOD("get_offset"), &CachedReadRequest::get_offset);
+		ClassDB::bind_method(D_METHOD("get_data"), &CachedReadRequest::get_data);
+
+		BIND_ENUM_CONSTANT(STATUS_PENDING);
+		BIND_ENUM_CONSTANT(STATUS_DONE);
+		BIND_ENUM_CONSTANT(STATUS_FAILED);
+	}
+
+public:
+	Status get_status() const { return (Status)status.load(std::memory_order_acquire); }
+	bool is_done() const { return get_status() != STATUS_PENDING; }
+	uint64_t get_offset() const { return offset; }
+
+	// Empty until the read is done. Shorter than the length asked for if the read went past the end of the file.
+	PackedByteArray get_data() const { return get_status() == STATUS_DONE ? data : PackedByteArray(); }
+
+	CachedReadRequest() :
+			offset(0),
+			status(STATUS_PENDING) {}
+};
+
+VARIANT_ENUM_CAST(CachedReadRequest::Status);
+
 class FileAccessCached : public FileAccess, public Object {
 	GDCLASS(FileAccessCached, Object);
 
@@ -57,12 +109,33 @@ private:
 
 	FileCacheManager *cache_mgr;
 	RID cached_file;
-	Semaphore *sem;
+	Semaphore sem;
+
+	// Every FileAccessCached opened on a path shares the file's descriptor in the cache manager,
+	// so each one keeps its own position and reads and writes with read_at() and write_at(). That way
+	// threads using the same file through different FileAccessCached objects don't move each other's position.
+	mutable size_t position;
+	mutable bool eof;
+
+	// The cache policy of resource files by extension, and of the other resources and packs.
+	// Set from the project settings by set_resource_caching().
+	static HashMap<String, int> resource_policies;
+	static int default_resource_policy;
+
+	// FileAccess::CachedOpenFunc that serves resources and packs from the cache.
+	static FileAccess *open_resource(const String &p_path, bool p_is_pack);
+
+	// FileCacheManager::AsyncReadCallback of read_async(). Completes the CachedReadRequest passed as p_udata.
+	static void async_read_done(void *p_udata, Error p_error, size_t p_length);
 
 protected:
-	Error cached_open(const String &p_path, int p_mode_flags, int cache_policy) {
-		cached_file = cache_mgr->open(p_path, p_mode_flags, cache_policy);
+	Error cached_open(const String &p_path, int p_mode_flags, int cache_policy, bool use_mmap = false, bool p_prefill = true) {
+		cached_file = cache_mgr->open(p_path, p_mode_flags, cache_policy, use_mmap, p_prefill);
 		ERR_FAIL_COND_V(cached_file.is_valid() == false, ERR_CANT_OPEN);
+		rel_path = p_path;
+		abs_path = ProjectSettings::get_singleton()->globalize_path(p_path);
+		position = 0;
+		eof = false;
 		return OK;
 	}
 
@@ -74,11 +147,15 @@ protected:
 	template <typename T>
 	_FORCE_INLINE_ T get_t() const {
 
-		T buf = CS_MEM_VAL_BAD;
-		cache_mgr->check_cache(cached_file, sizeof(T));
-		size_t o_length = cache_mgr->read(cached_file, &buf, sizeof(T));
+		T buf = 0;
+		size_t o_length = cache_mgr->read_at(cached_file, position, &buf, sizeof(T));
+		ERR_FAIL_COND_V(o_length == (size_t)CS_MEM_VAL_BAD, 0);
+
+		position += o_length;
 		if (o_length < sizeof(T)) {
-			ERR_PRINTS("Read less than " + itos(sizeof(T)) + " byte(s).");
+			// Reading past the end of the file is not an error, like with FileAccessUnix.
+			eof = true;
+			return 0;
 		}
 		return buf;
 	}
@@ -86,10 +163,11 @@ protected:
 	template <typename T>
 	void store_t(T buf) {
 
-		cache_mgr->check_cache(cached_file, sizeof(T));
-		size_t o_length = cache_mgr->write(cached_file, &buf, sizeof(T));
+		cache_mgr->check_cache_at(cached_file, position, sizeof(T));
+		size_t o_length = cache_mgr->write_at(cached_file, position, &buf, sizeof(T));
+		position += o_length;
 		if (o_length < sizeof(T)) {
-			ERR_PRINTS("Read less than " + itos(sizeof(T)) + " byte(s).");
+			ERR_PRINTS("Wrote less than " + itos(sizeof(T)) + " byte(s).");
 		}
 	}
 
@@ -108,67 +186,103 @@ public:
 	void close() {
 		if (cached_file.is_valid()) {
 			cache_mgr->close(cached_file);
+			cached_file = RID();
 		}
 	} ///< close a file
 
 	// Completely removes the file from the cache, including cached pages.
 	void permanent_close() {
 		if (cached_file.is_valid()) {
-			cache_mgr->close(cached_file);
-			cache_mgr->permanent_close(cached_file);
-			cached_file = RID();
+			RID rid = cached_file;
+			close();
+			cache_mgr->permanent_close(rid);
 		}
 	}
 
+	// Makes FileAccess::open() read resources, and the files inside packs, through the cache when p_enable is true.
+	// Resources use the cache policy of their extension in p_policies, or p_default_policy. Packs always use p_default_policy.
+	static void set_resource_caching(bool p_enable, const Dictionary &p_policies = Dictionary(), int p_default_policy = _FileCacheManager::LRU);
+
 	virtual bool is_open() const { return this->cached_file.is_valid(); } ///< true when file is open
 
 	virtual String get_path() const { return rel_path; } /// returns the path for the current open file
 	virtual String get_path_absolute() const { return abs_path; } /// returns the absolute path for the current open file
 
 	virtual void seek(size_t p_position) {
-		cache_mgr->seek(cached_file, p_position);
+		position = p_position;
+		eof = false;
 		// After we seek, we check that the data there exists in the cache.
-		cache_mgr->check_cache(cached_file, CS_LEN_UNSPECIFIED);
+		cache_mgr->check_cache_at(cached_file, position, CS_LEN_UNSPECIFIED);
 	} ///< seek to a given position
 
-	virtual void seek_end(int64_t p_position) { cache_mgr->seek_end(cached_file, p_position); } ///< seek from the end of file
+	virtual void seek_end(int64_t p_position) { seek(get_len() + p_position); } ///< seek from the end of file
 
-	virtual size_t get_position() const { return cache_mgr->get_len(cached_file); } ///< get position in the file
+	virtual size_t get_position() const { return position; } ///< get position in the file
 
 	virtual size_t get_len() const { return cache_mgr->get_len(cached_file); } ///< get size of the file
 
-	virtual bool eof_reached() const { return cache_mgr->eof_reached(cached_file); } ///< reading passed EOF
+	virtual bool eof_reached() const { return eof; } ///< reading passed EOF
 
 	virtual uint8_t get_8() const { return get_t<uint8_t>(); } ///< get a byte
 
 	virtual int get_buffer(uint8_t *p_dst, int p_length) const {
-		int o_length = 0;
-		//ERR_PRINTS("Initial offset: " + itoh(cache_mgr->get_position(cached_file)));
-
-		// Read 4 pages of data at a time. This is so that it will always be
-		// possible to have pages of a file present in the cache without worrying
-		// about not being able to add new pages to the cache or reading from invalid pages.
+		ERR_FAIL_COND_V(p_length < 0, -1);
 
-		// This reads blocks of bytes at a time rather than calling get_8 a bunch of times.
+		// read_at() loads the pages it needs one at a time, so reads of any length fit in the cache.
+		size_t o_length = cache_mgr->read_at(cached_file, position, p_dst, p_length);
+		ERR_FAIL_COND_V(o_length == (size_t)CS_MEM_VAL_BAD, -1);
 
-		for (int i = 0; i < p_length - (p_length % (CS_PAGE_SIZE * 4)); i += CS_PAGE_SIZE * 2) {
-			//ERR_PRINTS("Current offset: " + itoh(cache_mgr->get_position(cached_file) + i));
-			cache_mgr->check_cache(cached_file, CS_PAGE_SIZE * 4);
-			o_length += cache_mgr->read(cached_file, p_dst + i, CS_PAGE_SIZE * 2);
+		position += o_length;
+		if ((size_t)p_length > o_length) {
+			eof = true;
 		}
+		return o_length;
+	} ///< get an array of bytes
 
-		if ((p_length % (CS_PAGE_SIZE * 4)) > 0) {
-			//ERR_PRINTS("Current offset: " + itoh(cache_mgr->get_position(cached_file)));
-			cache_mgr->check_cache(cached_file, CS_PAGE_SIZE * 4);
-			o_length += cache_mgr->read(cached_file, p_dst + (p_length - (p_length % (CS_PAGE_SIZE * 4))), (p_length % (4 * CS_PAGE_SIZE)));
+	// Pins the next p_length bytes of the file in the cache, without copying them, and moves the position past them.
+	// The range must be released with unpin_buffer(). See FileCacheManager::pin().
+	Error pin_buffer(int p_length, FileCacheManager::PinnedRange &r_range) {
+		Error err = cache_mgr->pin(cached_file, position, p_length, r_range);
+		if (err == OK) {
+			position += r_range.length;
 		}
-		if (p_length > o_length) {
-			ERR_PRINTS("Read less than " + itos(p_length) + " bytes.\n");
+		return err;
+	}
+
+	void unpin_buffer(FileCacheManager::PinnedRange &r_range) { cache_mgr->unpin(r_range); }
+
+	// Reads p_length bytes from p_offset without waiting for them, and without using or changing the position.
+	// If p_callback is valid, it is called on the main thread with the request once the read is done.
+	// Returns a null reference if the read can't be made. See FileCacheManager::read_async().
+	Ref<CachedReadRequest> read_async(uint64_t p_offset, int p_length, const Callable &p_callback = Callable()) {
+		ERR_FAIL_COND_V(p_length < 0, Ref<CachedReadRequest>());
+
+		Ref<CachedReadRequest> request;
+		request.instance();
+		request->offset = p_offset;
+		request->callback = p_callback;
+		request->data.resize(p_length);
+
+		// The cache manager holds a reference to the request until the read is done.
+		request->reference();
+		Error err = cache_mgr->read_async(cached_file, p_offset, request->data.ptrw(), p_length, async_read_done, request.ptr());
+		if (err != OK) {
+			request->unreference();
+			return Ref<CachedReadRequest>();
 		}
-		return o_length;
-	} ///< get an array of bytes
 
-	virtual Error get_error() const { return last_error; } ///< get last error
+		return request;
+	}
+
+	// See FileCacheManager::set_io_priority().
+	void set_io_priority(int p_priority) { cache_mgr->set_io_priority(cached_file, p_priority); }
+	int get_io_priority() const { return cache_mgr->get_io_priority(cached_file); }
+
+	// Drops the loads still queued for the file, for example after seeking away from where it was being read.
+	void cancel_loads() { cache_mgr->cancel_loads(cached_file); }
+
+	// Write-backs happen after store_buffer() has returned, so their failures are reported by the cache manager.
+	virtual Error get_error() const { return last_error != OK ? last_error : cache_mgr->get_error(cached_file); } ///< get last error
 
 	virtual void flush() { cache_mgr->flush(cached_file); }
 
@@ -178,18 +292,22 @@ public:
 
 		int o_length = 0;
 
-		for (int i = 0; i < p_length - (p_length % (CS_PAGE_SIZE * 4)); i += CS_PAGE_SIZE * 2) {
-			//ERR_PRINTS("Current offset: " + itoh(cache_mgr->get_position(cached_file) + i));
-			cache_mgr->check_cache(cached_file, CS_PAGE_SIZE * 4);
-			o_length += cache_mgr->write(cached_file, p_src + i, CS_PAGE_SIZE * 2);
+		// Written two pages at a time, with the two pages after them queued for loading too.
+		const int chunk = (int)(CS_PAGE_SIZE * 2);
+		const int tail = p_length - (p_length % (chunk * 2));
+
+		for (int i = 0; i < tail; i += chunk) {
+			cache_mgr->check_cache_at(cached_file, position + i, chunk * 2);
+			o_length += cache_mgr->write_at(cached_file, position + i, p_src + i, chunk);
 		}
 
-		if ((p_length % (CS_PAGE_SIZE * 4)) > 0) {
-			//ERR_PRINTS("Current offset: " + itoh(cache_mgr->get_position(cached_file)));
-			cache_mgr->check_cache(cached_file, CS_PAGE_SIZE * 4);
-			o_length += cache_mgr->write(cached_file, p_src + (p_length - (p_length % (CS_PAGE_SIZE * 4))), (p_length % (4 * CS_PAGE_SIZE)));
+		if (tail < p_length) {
+			cache_mgr->check_cache_at(cached_file, position + tail, chunk * 2);
+			o_length += cache_mgr->write_at(cached_file, position + tail, p_src + tail, p_length - tail);
 		}
 
+		position += o_length;
+
 		if (p_length > o_length) {
 			ERR_PRINTS("Wrote less than " + itos(p_length) + " bytes.\n");
 		}
@@ -207,14 +325,14 @@ public:
 
 		cache_mgr = FileCacheManager::get_singleton();
 		CRASH_COND(!cache_mgr);
-		sem = Semaphore::create();
-		CRASH_COND(!sem);
+		position = 0;
+		eof = false;
+		last_error = OK;
 	}
 
 	virtual ~FileAccessCached() {
 		//WARN_PRINT("FileAccesCached destructor");
 		close();
-		memdelete(sem);
 	}
 };
 
@@ -229,6 +347,7 @@ protected:
 
 	static void _bind_methods() {
 		ClassDB::bind_method(D_METHOD("open", "path", "mode", "cache_policy"), &_FileAccessCached::open);
+		ClassDB::bind_method(D_METHOD("open_mapped", "path", "cache_policy"), &_FileAccessCached::open_mapped);
 		ClassDB::bind_method(D_METHOD("close"), &_FileAccessCached::close);
 
 		ClassDB::bind_method(D_METHOD("get_8"), &_FileAccessCached::get_8);
@@ -241,6 +360,7 @@ protected:
 		ClassDB::bind_method(D_METHOD("get_real"), &_FileAccessCached::get_real);
 
 		ClassDB::bind_method(D_METHOD("get_buffer", "len"), &_FileAccessCached::get_buffer);
+		ClassDB::bind_method(D_METHOD("read_async", "offset", "length", "callback"), &_FileAccessCached::read_async, DEFVAL(Callable()));
 		ClassDB::bind_method(D_METHOD("get_line"), &_FileAccessCached::get_line);
 		ClassDB::bind_method(D_METHOD("get_csv_line"), &_FileAccessCached::get_csv_line);
 
@@ -262,6 +382,10 @@ protected:
 
 		ClassDB::bind_method(D_METHOD("eof_reached"), &_FileAccessCached::eof_reached);
 		ClassDB::bind_method(D_METHOD("flush"), &_FileAccessCached::flush);
+
+		ClassDB::bind_method(D_METHOD("set_io_priority", "priority"), &_FileAccessCached::set_io_priority);
+		ClassDB::bind_method(D_METHOD("get_io_priority"), &_FileAccessCached::get_io_priority);
+		ClassDB::bind_method(D_METHOD("cancel_loads"), &_FileAccessCached::cancel_loads);
 	}
 
 public:
@@ -278,6 +402,14 @@ public:
 			return Variant();
 	}
 
+	Variant open_mapped(String path, int cache_policy) {
+
+		if (fac.cached_open(path, FileAccess::READ, cache_policy, true) == OK) {
+			return this;
+		} else
+			return Variant();
+	}
+
 	uint8_t get_8() { return fac.get_8(); }
 
 	uint16_t get_16() { return fac.get_16(); }
@@ -294,15 +426,21 @@ public:
 
 	Vector<String> get_csv_line() { return fac.get_csv_line(); }
 
-	PoolByteArray get_buffer(int len) {
-		PoolByteArray pba;
+	PackedByteArray get_buffer(int len) {
+		PackedByteArray pba;
 		pba.resize(len);
-		fac.get_buffer(pba.write().ptr(), len);
+		fac.get_buffer(pba.ptrw(), len);
 		return pba;
 	}
 
+	Ref<CachedReadRequest> read_async(int64_t offset, int length, const Callable &callback) { return fac.read_async(offset, length, callback); }
+
 	void flush() { fac.flush(); }
 
+	void set_io_priority(int priority) { fac.set_io_priority(priority); }
+	int get_io_priority() const { return fac.get_io_priority(); }
+	void cancel_loads() { fac.cancel_loads(); }
+
 	String get_line() { return fac.get_line(); }
 
 	void seek(int64_t position) { fac.seek(position); }
@@ -320,17 +458,10 @@ public:
 	void store_double(double value) { fac.store_double(value); }
 	void store_real(float value) { fac.store_real(value); }
 
-	void store_buffer(PoolByteArray buffer) { fac.store_buffer(buffer.read().ptr(), buffer.size()); }
+	void store_buffer(PackedByteArray buffer) { fac.store_buffer(buffer.ptr(), buffer.size()); }
 	void store_line(String line) { fac.store_line(line); }
 
-	void store_csv_line(PoolStringArray values, String delim = ",") {
-		Vector<String> v;
-		v.resize(values.size());
-		for (int i = 0; i < values.size(); i++) {
-			v.push_back(values[i]);
-		}
-		fac.store_csv_line(v, delim);
-	}
+	void store_csv_line(PackedStringArray values, String delim = ",") { fac.store_csv_line(values, delim); }
 
 	void store_pascal_string(String string) { fac.store_pascal_string(string); }
 	void store_string(String string) { fac.store_string(string); }
@@ -340,13 +471,11 @@ public:
 		Error err = encode_variant(p_var, NULL, len, p_full_objects);
 		ERR_FAIL_COND(err != OK);
 
-		PoolVector<uint8_t> buff;
+		PackedByteArray buff;
 		buff.resize(len);
-		PoolVector<uint8_t>::Write w = buff.write();
 
-		err = encode_variant(p_var, &w[0], len, p_full_objects);
+		err = encode_variant(p_var, buff.ptrw(), len, p_full_objects);
 		ERR_FAIL_COND(err != OK);
-		w = PoolVector<uint8_t>::Write();
 
 		store_32(len);
 		store_buffer(buff);
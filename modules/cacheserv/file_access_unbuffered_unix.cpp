@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -30,6 +31,7 @@ void FileAccessUnbufferedUnix::check_errors(int val, int expected, int mode) {
 				ERR_PRINTS("Seeked to " + itoh(val) + " instead of " + itoh(expected));
 				// CRASH_COND();
 			}
+			break;
 		case CHK_MODE_WRITE:
 			if (val == -1) {
 				ERR_PRINTS("Write error with file " + this->path);
@@ -38,6 +40,7 @@ void FileAccessUnbufferedUnix::check_errors(int val, int expected, int mode) {
 				ERR_PRINTS("Wrote " + itoh(val) + " instead of " + itoh(expected) + " bytes from " + this->path);
 				last_error = ERR_FILE_EOF;
 			}
+			break;
 		case CHK_MODE_READ:
 			if (val == -1) {
 				ERR_PRINTS("Read error with file " + this->path);
@@ -89,22 +92,71 @@ Error FileAccessUnbufferedUnix::_open(const String &p_path, int p_mode_flags) {
 		path = path + ".tmp";
 	}
 
-	fd = ::open(path.utf8().get_data(), mode);
+	if (direct && p_mode_flags == READ) {
+#if defined(O_DIRECT)
+		fd = ::open(path.utf8().get_data(), mode | O_DIRECT);
+		// Some file systems, like tmpfs, refuse O_DIRECT.
+		if (fd < 0 && errno == EINVAL) {
+			direct = false;
+			fd = ::open(path.utf8().get_data(), mode);
+		}
+#else
+		fd = ::open(path.utf8().get_data(), mode);
+#if defined(F_NOCACHE)
+		if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) != 0) {
+			direct = false;
+		}
+#else
+		direct = false;
+#endif
+#endif
+	} else {
+		direct = false;
+		fd = ::open(path.utf8().get_data(), mode);
+	}
 
 	if (fd < 0) {
 		last_error = ERR_FILE_CANT_OPEN;
 		return last_error;
 	} else {
+		// The file may have just been created, or truncated.
+		fstat(fd, &st);
 		last_error = OK;
 		flags = p_mode_flags;
 		return last_error;
 	}
 }
 
-Error FileAccessUnbufferedUnix::unbuffered_open(const String &p_path, int p_mode_flags) {
+Error FileAccessUnbufferedUnix::unbuffered_open(const String &p_path, int p_mode_flags, bool p_direct) {
+	direct = p_direct;
 	return this->_open(p_path, p_mode_flags);
 }
 
+FileAccessUnbufferedUnix *FileAccessUnbufferedUnix::open_unbuffered(const String &p_path, int p_mode_flags, Error *r_error, bool p_direct) {
+
+	FileAccessUnbufferedUnix *fa = memnew(FileAccessUnbufferedUnix);
+
+	if (p_path.begins_with("res://")) {
+		fa->_set_access_type(ACCESS_RESOURCES);
+	} else if (p_path.begins_with("user://")) {
+		fa->_set_access_type(ACCESS_USERDATA);
+	} else {
+		fa->_set_access_type(ACCESS_FILESYSTEM);
+	}
+
+	Error err = fa->unbuffered_open(p_path, p_mode_flags, p_direct);
+	if (r_error) {
+		*r_error = err;
+	}
+
+	if (err != OK) {
+		memdelete(fa);
+		return NULL;
+	}
+
+	return fa;
+}
+
 void FileAccessUnbufferedUnix::close() {
 
 	if (fd < 0)
@@ -152,13 +204,8 @@ void FileAccessUnbufferedUnix::seek(size_t p_position) {
 
 	int old_pos = pos;
 
-	if (p_position >= st.st_size) {
-
-		pos = ::lseek(fd, 0, SEEK_END);
-	} else {
-
-		pos = ::lseek(fd, p_position, SEEK_SET);
-	}
+	// Seeking past the end is allowed, the next write extends the file.
+	pos = ::lseek(fd, p_position, SEEK_SET);
 
 	ERR_COND_ACTION(pos < 0,);
 	if (pos == -1) {
@@ -289,6 +336,30 @@ Error FileAccessUnbufferedUnix::_chmod(const String &p_path, int p_mod) {
 	return FAILED;
 }
 
+uint32_t FileAccessUnbufferedUnix::_get_unix_permissions(const String &p_file) {
+
+	String file = fix_path(p_file);
+	int err = stat(file.utf8().get_data(), &st);
+
+	if (!err) {
+		return st.st_mode & 0x7FF;
+	} else {
+		ERR_FAIL_V_MSG(0, "Failed to get unix permissions for: " + p_file);
+	};
+}
+
+Error FileAccessUnbufferedUnix::_set_unix_permissions(const String &p_file, uint32_t p_permissions) {
+
+	String file = fix_path(p_file);
+	int err = chmod(file.utf8().get_data(), p_permissions);
+
+	if (!err) {
+		return OK;
+	}
+
+	return FAILED;
+}
+
 // Flush does not make sense for unbuffered IO so it has only checks and does not actually do anything.
 void FileAccessUnbufferedUnix::flush() {
 
@@ -304,8 +375,9 @@ CloseNotificationFunc FileAccessUnbufferedUnix::close_notification_func = NULL;
 
 FileAccessUnbufferedUnix::FileAccessUnbufferedUnix() :
 		fd(-1),
-		flags(0),
 		pos(0),
+		flags(0),
+		direct(false),
 		last_error(OK) {
 }
 
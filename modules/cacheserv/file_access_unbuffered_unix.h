@@ -38,6 +38,8 @@
 
 #if defined(UNIX_ENABLED)
 
+#include "drivers/unix/file_access_unix.h"
+
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -52,6 +54,8 @@ class FileAccessUnbufferedUnix : public FileAccess {
 	int fd;
 	int pos;
 	int flags;
+	// True if reads bypass the kernel page cache. See open_unbuffered().
+	bool direct;
 	struct stat st;
 	void check_errors() const;
 	void check_errors(int val, int expected, int mode);
@@ -63,8 +67,22 @@ class FileAccessUnbufferedUnix : public FileAccess {
 	static FileAccess *create_unbuf_unix();
 
 public:
-
-	Error unbuffered_open(const String &p_path, int p_mode_flags);
+	static CloseNotificationFunc close_notification_func;
+
+	// Opens a file for unbuffered access. Like FileAccess::open, res:// and user:// paths are resolved.
+	// Returns NULL if the file can't be opened.
+	//
+	// If p_direct is true and the file is opened for reading, reads bypass the kernel page cache (O_DIRECT),
+	// so that data cached by the caller isn't cached a second time by the kernel. Direct reads must start at
+	// offsets and use buffers and lengths aligned to the block size of the file system, which CS_PAGE_SIZE_MIN
+	// covers. Where the file system doesn't support it, the file is opened normally; see is_direct().
+	static FileAccessUnbufferedUnix *open_unbuffered(const String &p_path, int p_mode_flags, Error *r_error = NULL, bool p_direct = false);
+
+	// The descriptor of the open file, for positional and asynchronous IO that bypasses the file offset.
+	_FORCE_INLINE_ int get_fd() const { return fd; }
+	_FORCE_INLINE_ bool is_direct() const { return direct; }
+
+	Error unbuffered_open(const String &p_path, int p_mode_flags, bool p_direct = false);
 	Error _open(const String &p_path, int p_mode_flags); ///< open a file
 	// Error open();
 	void close(); ///< close a file
@@ -96,6 +114,8 @@ public:
 	uint64_t _get_modified_time(const String &p_file);
 
 	Error _chmod(const String &p_path, int p_mod);
+	uint32_t _get_unix_permissions(const String &p_file);
+	Error _set_unix_permissions(const String &p_file, uint32_t p_permissions);
 
 	FileAccessUnbufferedUnix();
 	virtual ~FileAccessUnbufferedUnix();
@@ -33,41 +33,89 @@
 
 #include "core/os/os.h"
 
+#if defined(UNIX_ENABLED)
+#include "file_access_unbuffered_unix.h"
+
+#include <sys/mman.h>
+#endif
+
+#include <errno.h>
 #include <time.h>
 
-#define RID_TO_DD(op) (uint64_t) rid op get_id() & 0x0000000000FFFFFF
+// The data descriptor of a file is the index of its RID, plus one so that no file gets the GUID prefix 0 of unused frames.
+#define RID_TO_DD(op) (((uint64_t)rid op get_id() & 0x0000000000FFFFFF) + 1)
 #define RID_PTR_TO_DD RID_TO_DD(->)
 #define RID_REF_TO_DD RID_TO_DD(.)
 
+size_t cs_page_size = CS_PAGE_SIZE_DEFAULT;
+size_t cs_cache_size = CS_CACHE_SIZE_DEFAULT;
+
+// Opens a file as a data source. On unix, files are opened unbuffered, so that the IO workers
+// can batch their loads and stores on the descriptor. Anything else, like files inside a pack,
+// goes through the normal FileAccess API and r_async_fd is set to -1.
+// If p_direct is true, files opened for reading bypass the kernel page cache where the file system allows it.
+static FileAccess *open_data_source(const String &p_path, int p_mode, int *r_async_fd, bool p_direct) {
+#if defined(UNIX_ENABLED)
+	FileAccessUnbufferedUnix *ufa = FileAccessUnbufferedUnix::open_unbuffered(p_path, p_mode, NULL, p_direct);
+	if (ufa) {
+		*r_async_fd = ufa->get_fd();
+		return ufa;
+	}
+#endif
+
+	*r_async_fd = -1;
+	return FileAccess::open(p_path, p_mode);
+}
+
 FileCacheManager::FileCacheManager() {
-	mutex = Mutex::create();
 	rng.set_seed(OS::get_singleton()->get_ticks_usec());
 
-	memory_region = memnew_arr(uint8_t, CS_CACHE_SIZE);
+	// The memory region and the frames are set up in init(), once the page and cache sizes are known.
+	memory_region = NULL;
 	page_frame_map.clear();
-	// pages.clear();
 	frames.clear();
 
-	available_space = CS_CACHE_SIZE;
+	memory_region_size = 0;
+	arena_type = ARENA_HEAP;
+	available_space = 0;
 	used_space = 0;
-	total_space = CS_CACHE_SIZE;
-
-	for (int i = 0; i < CS_NUM_FRAMES; ++i) {
-		frames.push_back(
-				memnew(Frame(memory_region + i * CS_PAGE_SIZE)));
-	}
+	total_space = 0;
+	read_ahead_max_pages = CS_READ_AHEAD_MAX_PAGES_DEFAULT;
+	use_io_uring = true;
+	use_direct_io = false;
+	use_huge_pages = true;
+	warm_start_thread = NULL;
+	warm_start_stop = false;
+	flusher_thread = NULL;
+	flusher_stop = false;
+	dirty_high_watermark = CS_DIRTY_HIGH_WATERMARK_DEFAULT;
+	dirty_low_watermark = CS_DIRTY_LOW_WATERMARK_DEFAULT;
+	dirty_frames = 0;
+	async_read_thread = NULL;
+	compressed_tier_size = 0;
+	compressed_tier_mode = Compression::MODE_ZSTD;
+	arc_target = 0;
+	pinned_frames = 0;
 
 	singleton = this;
 }
 
 FileCacheManager::~FileCacheManager() {
 	//// WARN_PRINT("Destructor running.");
-	if (memory_region) memdelete(memory_region);
 
-	if (rids.size()) {
-		for (const String *key = rids.next(NULL); key; key = rids.next(key)) {
-			permanent_close(rids[*key]);
-		}
+	stop_warm_start();
+	stop_flusher();
+	stop_async_reads();
+
+	if (!warm_start_manifest.empty() && memory_region) {
+		save_manifest(warm_start_manifest);
+	}
+
+	// Closing a file goes through the IO workers, so every file is closed before they are stopped.
+	List<String> paths;
+	rids.get_key_list(&paths);
+	for (List<String>::Element *E = paths.front(); E; E = E->next()) {
+		permanent_close(rids[E->get()]);
 	}
 
 	if (files.size()) {
@@ -77,27 +125,34 @@ FileCacheManager::~FileCacheManager() {
 		}
 	}
 
+	exit_thread = true;
+	op_queue.push_quit();
+
+	for (int i = 0; i < io_workers.size(); ++i) {
+		Thread::wait_to_finish(io_workers[i]->thread);
+		memdelete(io_workers[i]->thread);
+		memdelete(io_workers[i]);
+	}
+
 	for (int i = 0; i < frames.size(); ++i) {
 		memdelete(frames[i]);
 	}
 
-	op_queue.sig_quit = true;
-	op_queue.push(CtrlOp());
-	exit_thread = true;
-
-	Thread::wait_to_finish(this->thread);
+	free_arena();
+}
 
-	memdelete(thread);
-	memdelete(mutex);
+RID FileCacheManager::open(const String &path, int p_mode, int cache_policy, bool use_mmap, bool p_prefill) {
+	return open_file(path, p_mode, cache_policy, use_mmap, p_prefill);
 }
 
-RID FileCacheManager::open(const String &path, int p_mode, int cache_policy) {
+RID FileCacheManager::open_file(const String &path, int p_mode, int cache_policy, bool use_mmap, bool p_prefill) {
 
 	//  WARN_PRINTS(path + " " + itoh(p_mode) + " " + itoh(cache_policy));
 
 	ERR_FAIL_COND_V(path.empty(), RID());
+	ERR_FAIL_COND_V_MSG(use_mmap && p_mode != FileAccess::READ, RID(), "Only files opened for reading can be memory mapped.");
 
-	MutexLock ml = MutexLock(mutex);
+	MutexLock ml(mutex);
 
 	RID rid;
 
@@ -107,6 +162,28 @@ RID FileCacheManager::open(const String &path, int p_mode, int cache_policy) {
 		rid = rids[path];
 		DescriptorInfo *desc_info = files[RID_REF_TO_DD];
 
+		// A file the warm start opened for reading is handed over as it is.
+		// For any other mode it is closed first, and reopened below.
+		if (desc_info->warm_start) {
+			desc_info->warm_start = false;
+			if (p_mode == FileAccess::READ && !use_mmap) {
+				if (desc_info->cache_policy != cache_policy) {
+					set_cache_policy(desc_info, cache_policy);
+				}
+				return rid;
+			}
+			close(rid);
+		}
+
+		// Files open for reading are shared by everyone who reads them, like the files inside a pack all reading the pack.
+		if (desc_info->valid && p_mode == FileAccess::READ && desc_info->open_mode == FileAccess::READ && !use_mmap && !desc_info->mapped_region) {
+			desc_info->open_count += 1;
+			if (desc_info->cache_policy != cache_policy) {
+				set_cache_policy(desc_info, cache_policy);
+			}
+			return rid;
+		}
+
 		ERR_FAIL_COND_V_MSG(
 				desc_info->valid,
 				RID(),
@@ -114,21 +191,40 @@ RID FileCacheManager::open(const String &path, int p_mode, int cache_policy) {
 
 		CRASH_COND_MSG(desc_info->internal_data_source != NULL, "Descriptor in invalid state, internal data source is apparently valid!");
 
-		desc_info->internal_data_source = FileAccess::open(desc_info->path, p_mode);
+		desc_info->internal_data_source = open_data_source(desc_info->path, p_mode, &desc_info->async_fd, use_direct_io_for(p_mode, use_mmap));
+		ERR_FAIL_COND_V_MSG(!desc_info->internal_data_source, RID(), "Could not open file.");
+
+		// The file may have been changed without going through the cache while it was closed,
+		// for example by the editor saving a resource. Its cached pages are stale then.
+		size_t total_size = desc_info->internal_data_source->get_len();
+		uint64_t modified_time = FileAccess::get_modified_time(desc_info->path);
+		if (total_size != desc_info->total_size || modified_time != desc_info->modified_time) {
+			for (int i = desc_info->pages.size() - 1; i >= 0; --i) {
+				untrack_page(desc_info, desc_info->pages[i]);
+			}
+			if (compressed_tier.is_enabled()) {
+				compressed_tier.remove_file(desc_info->guid_prefix);
+			}
+			desc_info->total_size = total_size;
+			desc_info->modified_time = modified_time;
+		}
+
+		if (use_mmap) {
+			map_data_source(desc_info);
+		}
 
 		// Seek to the previous offset.
 		seek(rid, files[RID_REF_TO_DD]->offset);
-		check_cache(rid, 8 * CS_PAGE_SIZE);
+		if (p_prefill) {
+			check_cache(rid, 8 * CS_PAGE_SIZE);
+		}
+		desc_info->open_mode = p_mode;
+		desc_info->open_count = 1;
+		desc_info->store_error = OK;
 		desc_info->valid = true;
 
 		if (desc_info->cache_policy != cache_policy) {
-			for (int i = 0; i < desc_info->pages.size(); ++i) {
-				CS_GET_CACHE_POLICY_FN(cache_removal_policies, desc_info->cache_policy)
-				(desc_info->pages[i]);
-				CS_GET_CACHE_POLICY_FN(cache_insertion_policies, cache_policy)
-				(desc_info->pages[i]);
-			}
-			desc_info->cache_policy = cache_policy;
+			set_cache_policy(desc_info, cache_policy);
 		}
 
 	} else {
@@ -138,45 +234,88 @@ RID FileCacheManager::open(const String &path, int p_mode, int cache_policy) {
 
 		ERR_COND_MSG_ACTION(!rid.is_valid(), "Failed to create RID.", { memdelete(hdl); return RID(); });
 
-		// PreferredFileAccessType *fa = memnew(FileAccessUnbufferedUnix);
-
 		//Fail with a bad RID if we can't open the file.
 		FileAccess *fa = NULL;
-		ERR_COND_MSG_ACTION((fa = FileAccess::open(path, p_mode)) == NULL, "Could not open file.", { handle_owner.free(rid); memdelete(hdl); return RID(); });
+		int async_fd = -1;
+		ERR_COND_MSG_ACTION((fa = open_data_source(path, p_mode, &async_fd, use_direct_io_for(p_mode, use_mmap))) == NULL, "Could not open file.", { handle_owner.free(rid); memdelete(hdl); return RID(); });
 
-		rids[path] = (add_data_source(rid, fa, cache_policy));
+		rids[path] = (add_data_source(rid, fa, cache_policy, async_fd, use_mmap, p_prefill));
+		files[RID_REF_TO_DD]->open_mode = p_mode;
 		//  WARN_PRINTS("open file " + path + " with mode " + itoh(p_mode) + "\nGot RID " + itoh(RID_REF_TO_DD) + "\n");
 	}
 
 	return rid;
 }
 
+void FileCacheManager::set_cache_policy(DescriptorInfo *desc_info, int cache_policy) {
+
+	for (int i = 0; i < desc_info->pages.size(); ++i) {
+		// Pinned pages join the new policy's list when they are unpinned.
+		if (frames[page_frame_map[desc_info->pages[i]]]->get_pinned()) {
+			continue;
+		}
+		CS_GET_CACHE_POLICY_FN(cache_removal_policies, desc_info->cache_policy)
+		(desc_info->pages[i]);
+		CS_GET_CACHE_POLICY_FN(cache_insertion_policies, cache_policy)
+		(desc_info->pages[i]);
+	}
+	desc_info->cache_policy = cache_policy;
+}
+
 void FileCacheManager::close(const RID rid) {
 
-	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
-	ERR_FAIL_COND_MSG(!elem, String("No such file"))
+	DescriptorInfo *desc_info = get_descriptor(rid);
+	ERR_FAIL_COND_MSG(!desc_info, String("No such file"));
 
-	DescriptorInfo *desc_info = *elem;
+	wait_async_reads(desc_info);
+
+	if (desc_info->internal_data_source) {
+		{
+			MutexLock ml(mutex);
 
-	if (desc_info->internal_data_source)
-		enqueue_flush_close(desc_info);
-	else
+			// Someone else still reads the file.
+			if (desc_info->open_count > 1) {
+				desc_info->open_count -= 1;
+				return;
+			}
+
+			// Nobody is going to read the pages that are still queued for loading.
+			cancel_loads(desc_info);
+
+			enqueue_dirty_stores(desc_info);
+			enqueue_flush_close(desc_info);
+		}
+	} else
 		ERR_PRINTS("File already closed.");
 
-	// This semaphore is triggered by do_flush_close_op.
-	while (desc_info->valid == true)
-		desc_info->ready_sem->wait();
+	// do_flush_close_op broadcasts once it has closed the file.
+	desc_info->ready_signal.wait_until([desc_info]() { return !desc_info->valid; });
 
 	//  WARN_PRINTS("Closed file " + desc_info->path);
 }
 
 void FileCacheManager::permanent_close(const RID rid) {
 	//  WARN_PRINTS("permanently closed file with RID " + itoh(RID_REF_TO_DD));
-	MutexLock ml = MutexLock(mutex);
-	close(rid);
+
+	// The async reads need the lock to finish, so they are waited for before taking it.
+	DescriptorInfo *desc_info = get_descriptor(rid);
+	if (desc_info) {
+		wait_async_reads(desc_info);
+	}
+
+	MutexLock ml(mutex);
+
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	ERR_FAIL_COND_MSG(elem && (*elem)->pinned_pages > 0, "Can't remove a file from the cache while some of its pages are pinned.");
+	ERR_FAIL_COND_MSG(elem && (*elem)->valid && (*elem)->open_count > 1, "Can't remove a file from the cache while it is open more than once.");
+
+	if (elem && (*elem)->valid) {
+		close(rid);
+	}
 	remove_data_source(rid);
+	CachedResourceHandle *hdl = handle_owner.getornull(rid);
 	handle_owner.free(rid);
-	memdelete(static_cast<CachedResourceHandle *>(rid.get_data()));
+	memdelete(hdl);
 }
 
 // Error FileCacheManager::reopen(const RID rid, int mode) {
@@ -195,28 +334,87 @@ void FileCacheManager::permanent_close(const RID rid) {
 // This function takes a pointer to a FileAccess object,
 // so anything that implements the FileAccess API (from the file system, or from the network)
 // can act as a data source.
-RID FileCacheManager::add_data_source(RID rid, FileAccess *data_source, int cache_policy) {
+RID FileCacheManager::add_data_source(RID rid, FileAccess *data_source, int cache_policy, int async_fd, bool use_mmap, bool p_prefill) {
 
 	CRASH_COND(rid.is_valid() == false);
 	data_descriptor dd = RID_REF_TO_DD;
 
 	files[dd] = memnew(DescriptorInfo(data_source, (page_id)dd << 40, cache_policy));
+	files[dd]->async_fd = async_fd;
 	files[dd]->valid = true;
 
+	if (use_mmap) {
+		map_data_source(files[dd]);
+	}
+
 	CRASH_COND(files[dd] == NULL);
 
 	seek(rid, 0, SEEK_SET);
-	check_cache(rid, (cache_policy == _FileCacheManager::KEEP ? CS_KEEP_THRESH_DEFAULT : cache_policy == _FileCacheManager::LRU ? CS_LRU_THRESH_DEFAULT : CS_FIFO_THRESH_DEFAULT) * CS_PAGE_SIZE);
+	if (p_prefill) {
+		check_cache(rid, files[dd]->max_pages * CS_PAGE_SIZE);
+	}
 
 	return rid;
 }
 
+bool FileCacheManager::map_data_source(DescriptorInfo *desc_info) {
+#if defined(UNIX_ENABLED)
+	CRASH_COND(desc_info->mapped_region != NULL);
+
+	if (desc_info->async_fd < 0 || desc_info->total_size == 0) {
+		ERR_PRINTS("Can't memory map " + desc_info->path + ", it will be cached normally.");
+		return false;
+	}
+
+	void *region = mmap(NULL, desc_info->total_size, PROT_READ, MAP_SHARED, desc_info->async_fd, 0);
+	if (region == MAP_FAILED) {
+		ERR_PRINTS("Memory mapping " + desc_info->path + " failed with errno " + itos(errno) + ", it will be cached normally.");
+		return false;
+	}
+
+	switch (desc_info->cache_policy) {
+		case _FileCacheManager::FIFO:
+			madvise(region, desc_info->total_size, MADV_SEQUENTIAL);
+			break;
+		case _FileCacheManager::KEEP:
+			madvise(region, desc_info->total_size, MADV_WILLNEED);
+			break;
+		default:
+			break;
+	}
+
+	desc_info->mapped_region = (const uint8_t *)region;
+	desc_info->mapped_size = desc_info->total_size;
+	return true;
+#else
+	ERR_PRINTS("Memory mapped files are not supported on this platform, " + desc_info->path + " will be cached normally.");
+	return false;
+#endif
+}
+
+void FileCacheManager::unmap_data_source(DescriptorInfo *desc_info) {
+#if defined(UNIX_ENABLED)
+	if (desc_info->mapped_region) {
+		munmap((void *)desc_info->mapped_region, desc_info->mapped_size);
+	}
+#endif
+
+	desc_info->mapped_region = NULL;
+	desc_info->mapped_size = 0;
+}
+
 void FileCacheManager::remove_data_source(RID rid) {
 	DescriptorInfo *di = files[RID_REF_TO_DD];
 
 	for (int i = 0; i < di->pages.size(); i++) {
 
-		frames[page_frame_map[di->pages[i]]]->wait_clean(di->dirty_sem).set_ready_false().set_used(false).set_owning_page(0);
+		CS_GET_CACHE_POLICY_FN(cache_removal_policies, di->cache_policy)
+		(di->pages[i]);
+
+		wait_no_readers(page_frame_map[di->pages[i]]);
+
+		frames[page_frame_map[di->pages[i]]]->wait_clean(&di->dirty_signal).set_ready_false().set_used(false).set_owning_page(0);
+		free_frames.push_front(frames, page_frame_map[di->pages[i]]);
 
 		memset(
 				Frame::DataWrite(
@@ -225,15 +423,83 @@ void FileCacheManager::remove_data_source(RID rid) {
 						true)
 						.ptr(),
 				0,
-				4096);
+				CS_PAGE_SIZE);
+
+		page_frame_map.erase(di->pages[i]);
+	}
+
+	// The GUID prefix of the file can be given to another file later.
+	if (compressed_tier.is_enabled()) {
+		compressed_tier.remove_file(di->guid_prefix);
 	}
 
 	rids.erase(di->path);
 	files.erase(di->guid_prefix >> 40);
-	memdelete(di);
+
+	// The IO workers may still have to skip cancelled ops of the file, and they need the descriptor for that.
+	// Drops the cache's own count, so the descriptor is freed here only if no op is left, and otherwise
+	// by the worker that finishes the last one. di must not be touched after this.
+	if (atomic_decrement(&di->pending_ops) == 0) {
+		memdelete(di);
+	}
+}
+
+void FileCacheManager::cancel_loads(const RID rid) {
+	MutexLock ml(mutex);
+
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	ERR_FAIL_COND_MSG(!elem, "No such file");
+
+	cancel_loads(*elem);
+}
+
+void FileCacheManager::cancel_loads(DescriptorInfo *desc_info) {
+	atomic_increment(&desc_info->load_generation);
+
+	// The IO workers check the generation of a load when they claim its frame, which they do while holding
+	// the file's write lock, so once the lock has been acquired here, no queued load will run anymore.
+	// The loads that claimed their frame before still run, and leave their page ready.
+	desc_info->lock->write_lock();
+	desc_info->lock->write_unlock();
+
+	// Backwards, as untracking a page removes it from the list.
+	for (int i = desc_info->pages.size() - 1; i >= 0; --i) {
+		page_id curr_page = desc_info->pages[i];
+		frame_id curr_frame = page_frame_map[curr_page];
+
+		if (frames[curr_frame]->get_ready()) {
+			continue;
+		}
+
+		// A reader or a pin is waiting for the page. The lock is held, so nobody can start waiting after this check.
+		if (frames[curr_frame]->pin_count || frames[curr_frame]->has_readers()) {
+			enqueue_load(desc_info, curr_frame, CS_GET_FILE_OFFSET_FROM_GUID(curr_page), CtrlOp::PRIORITY_INTERACTIVE);
+		} else {
+			untrack_page(desc_info, curr_page);
+		}
+	}
+}
+
+void FileCacheManager::set_io_priority(const RID rid, int priority) {
+	ERR_FAIL_INDEX(priority, CtrlOp::PRIORITY_MAX);
+	MutexLock ml(mutex);
+
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	ERR_FAIL_COND_MSG(!elem, "No such file");
+
+	(*elem)->io_priority = priority;
+}
+
+int FileCacheManager::get_io_priority(const RID rid) const {
+	MutexLock ml(mutex);
+
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	ERR_FAIL_COND_V_MSG(!elem, CtrlOp::PRIORITY_INTERACTIVE, "No such file");
+
+	return (*elem)->io_priority;
 }
 
-void FileCacheManager::enqueue_load(DescriptorInfo *desc_info, frame_id curr_frame, size_t offset) {
+void FileCacheManager::enqueue_load(DescriptorInfo *desc_info, frame_id curr_frame, size_t offset, uint8_t priority) {
 	//WARN_PRINTS("Enqueueing load for file " + desc_info->path + " at frame " + itoh(curr_frame) + " at offset " + itoh(offset))
 
 	if (offset > desc_info->total_size) {
@@ -244,87 +510,84 @@ void FileCacheManager::enqueue_load(DescriptorInfo *desc_info, frame_id curr_fra
 
 		//  WARN_PRINTS("Accessed out of bounds, reading zeroes.");
 		memset(Frame::DataWrite(frames[curr_frame], desc_info, true).ptr(), 0, CS_PAGE_SIZE);
-		frames[curr_frame]->set_ready_true(desc_info->ready_sem);
+		frames[curr_frame]->set_ready_true(&desc_info->ready_signal);
 		//  WARN_PRINTS("Finished OOB access.");
 	} else {
-		op_queue.push(CtrlOp(desc_info, curr_frame, offset, CtrlOp::LOAD));
+		CtrlOp op(desc_info, curr_frame, offset, CtrlOp::LOAD, priority);
+		op.generation = desc_info->load_generation;
+		op_queue.push(op);
 		// WARN_PRINTS("file " + desc_info->path + " at offset " + itoh(offset) + " with frame " + itoh(curr_frame));
 	}
 }
 
 void FileCacheManager::enqueue_store(DescriptorInfo *desc_info, frame_id curr_frame, size_t offset) {
+	// Stores are only enqueued to free a frame for a page that is needed, or to flush the file, so they are interactive.
+	// An earlier failure doesn't count anymore, the frame gets another chance to be stored.
+	frames[curr_frame]->set_store_failed(false, &desc_info->dirty_signal);
 	op_queue.push(CtrlOp(desc_info, curr_frame, offset, CtrlOp::STORE));
 	//  WARN_PRINTS("Enqueue store op for file " + desc_info->path + " at offset " + itoh(offset) + " with frame " + itoh(curr_frame));
 }
 
-void FileCacheManager::enqueue_flush(DescriptorInfo *desc_info) {
+void FileCacheManager::enqueue_dirty_stores(DescriptorInfo *desc_info) {
 
-	{
-		MutexLock ml(op_queue.mut);
-		for (List<CtrlOp>::Element *e = op_queue.queue.front(); e;) {
-			List<CtrlOp>::Element *next = e->next();
-			if (e->get().di == desc_info && e->get().type == CtrlOp::STORE) {
-				//  WARN_PRINTS("Deleting store op with offset: " + itoh(e->get().offset) + " frame: " + itoh(e->get().frame) + " file:  " + e->get().di->path)
+	for (int i = 0; i < desc_info->pages.size(); ++i) {
+		frame_id curr_frame = page_frame_map[desc_info->pages[i]];
 
-				e->erase();
-			}
-			e = next;
+		// Pages with a background write-back queued are stored again, as the write-back may run after the flush.
+		// Whichever store runs second finds the frame clean and skips it.
+		if (frames[curr_frame]->get_dirty()) {
+			enqueue_store(desc_info, curr_frame, CS_GET_FILE_OFFSET_FROM_GUID(desc_info->pages[i]));
 		}
 	}
+}
+
+void FileCacheManager::enqueue_flush(DescriptorInfo *desc_info) {
 
-	op_queue.priority_push(CtrlOp(desc_info, CS_MEM_VAL_BAD, CS_MEM_VAL_BAD, CtrlOp::FLUSH));
+	// Interactive ops on a file are processed in order, so the stores queued for the file's dirty pages
+	// are done before the flush.
+	op_queue.push(CtrlOp(desc_info, CS_MEM_VAL_BAD, CS_MEM_VAL_BAD, CtrlOp::FLUSH));
 	//  WARN_PRINTS("Enqueue flush op")
 }
 
 void FileCacheManager::enqueue_flush_close(DescriptorInfo *desc_info) {
 
 	// WARN_PRINTS("Enqueue flush & close op")
-	{
-		MutexLock ml(op_queue.mut);
-		for (List<CtrlOp>::Element *e = op_queue.queue.front(); e;) {
-			List<CtrlOp>::Element *next = e->next();
-			if (e->get().di == desc_info) {
-
-				// Make it so the page frame mapping is removed as well.
+	// Interactive ops on a file are processed in order, so pushing this to the back of the file's interactive ring
+	// guarantees that no store for the file is left in the queue once the file is closed.
+	// The loads of other classes were cancelled by close(), and are skipped.
+	op_queue.push(CtrlOp(desc_info, CS_MEM_VAL_BAD, CS_MEM_VAL_BAD, CtrlOp::FLUSH_CLOSE));
+}
 
-				if (e->get().type == CtrlOp::LOAD) {
-					DescriptorInfo *desc_info = e->get().di;
-					untrack_page(desc_info, frames[e->get().frame]->owning_page);
-				}
+void FileCacheManager::do_load_op(const CtrlOp &op) {
+	// ERR_PRINTS("Start load op with file: " + op.di->path + " offset: " + itoh(op.offset) + " frame: " + itoh(op.frame))
 
-				e->erase();
-			}
-			e = next;
-		}
+	DescriptorInfo *desc_info = op.di;
+	Frame *f = frames[op.frame];
+	bool claimed;
+	{
+		RWLockWrite w(desc_info->lock);
+		claimed = claim_load_frame(op);
 	}
-	op_queue.priority_push(CtrlOp(desc_info, CS_MEM_VAL_BAD, CS_MEM_VAL_BAD, CtrlOp::FLUSH_CLOSE));
-}
 
-void FileCacheManager::do_load_op(DescriptorInfo *desc_info, page_id curr_page, frame_id curr_frame, size_t offset) {
-	// ERR_PRINTS("Start load op with file: " + desc_info->path + " page: " + itoh(curr_page) + " frame: " + itoh(curr_frame))
+	// The load was cancelled, or its page was evicted or loaded, before this worker got to it.
+	if (!claimed) {
+		atomic_increment(&stats.cancelled_loads);
+		return;
+	}
 
-	CRASH_COND_MSG(desc_info->valid != true, "File not open!")
+	CRASH_COND_MSG(desc_info->valid != true, "File not open!");
 
-	desc_info->internal_data_source->seek(CS_GET_FILE_OFFSET_FROM_GUID(curr_page));
-	int64_t used_size;
-	{
-		Frame::DataWrite w(
-				frames[curr_frame],
-				desc_info,
-				true);
+	desc_info->internal_data_source->seek(CS_GET_PAGE(op.offset));
 
-		used_size = desc_info->internal_data_source->get_buffer(
-				w.ptr(),
-				CS_PAGE_SIZE);
-		//ERR_PRINTS("File read returned " + itoh(used_size));
+	int64_t used_size = desc_info->internal_data_source->get_buffer(
+			f->memory_region,
+			CS_PAGE_SIZE);
+	//ERR_PRINTS("File read returned " + itoh(used_size));
 
-		// Error has occurred.
-		CRASH_COND(used_size < 0);
-		(frames[curr_frame])
-				->set_used_size(used_size)
-				.set_ready_true(desc_info->ready_sem);
-	}
-	// ERR_PRINTS(itoh(used_size) + " from offset " + itoh(offset) + " with page " + itoh(curr_page) + " mapped to frame " + itoh(curr_frame))
+	// Error has occurred.
+	CRASH_COND(used_size < 0);
+	f->finish_load(used_size, &desc_info->ready_signal);
+	// ERR_PRINTS(itoh(used_size) + " from offset " + itoh(op.offset) + " mapped to frame " + itoh(op.frame))
 }
 
 void FileCacheManager::do_store_op(DescriptorInfo *desc_info, page_id curr_page, frame_id curr_frame, size_t offset) {
@@ -332,14 +595,14 @@ void FileCacheManager::do_store_op(DescriptorInfo *desc_info, page_id curr_page,
 
 	// ERR_PRINTS("Start store op with file: " + desc_info->path + " page: " + itoh(curr_page) + " frame: " + itoh(curr_frame))
 
-	// Wait until the file is open.
-	if (!desc_info->valid) {
-		CRASH_NOW_MSG("File not open!") //(!desc_info->valid)
+	// The page was already written back by a flush.
+	if (!frames[curr_frame]->get_dirty()) {
+		return;
 	}
 
 	if (!desc_info->valid) {
-		ERR_PRINTS("File not open!")
-		CRASH_NOW() //(!desc_info->valid)
+		ERR_PRINTS("File not open!");
+		CRASH_NOW(); //(!desc_info->valid)
 	}
 
 	desc_info->internal_data_source->seek(CS_GET_PAGE(offset));
@@ -347,47 +610,196 @@ void FileCacheManager::do_store_op(DescriptorInfo *desc_info, page_id curr_page,
 		Frame::DataRead r(frames[curr_frame], desc_info);
 
 		desc_info->internal_data_source->store_buffer(r.ptr(), frames[curr_frame]->get_used_size());
-		frames[curr_frame]->set_dirty_false(desc_info->dirty_sem, curr_frame);
+		frames[curr_frame]->set_dirty_false(&desc_info->dirty_signal, &dirty_frames);
 	}
 
+	atomic_increment(&stats.write_backs);
+
 	// ERR_PRINTS("End store op with file: " + desc_info->path + " page: " + itoh(curr_page) + " frame: " + itoh(curr_frame))
 }
 
 void FileCacheManager::flush(RID rid) {
-	enqueue_flush(files[RID_REF_TO_DD]);
+	MutexLock ml(mutex);
+
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	ERR_FAIL_COND_MSG(!elem || !(*elem)->valid, "No such file");
+
+	enqueue_dirty_stores(*elem);
+	enqueue_flush(*elem);
 }
 
-void FileCacheManager::do_flush_op(DescriptorInfo *desc_info) {
-	CRASH_COND(!(desc_info->internal_data_source));
+// Orders batched ops by type, then by offset, so that ops on adjacent pages end up next to each other.
+static _FORCE_INLINE_ bool io_op_before(const CtrlOp &a, const CtrlOp &b) {
+	return a.type < b.type || (a.type == b.type && CS_GET_PAGE(a.offset) < CS_GET_PAGE(b.offset));
+}
+
+void FileCacheManager::do_io_batch(IOWorker &worker, const CtrlOp *ops, int count) {
+#if defined(UNIX_ENABLED)
+	DescriptorInfo *desc_info = ops[0].di;
+	// The ops that need IO, sorted. iov[i] is the buffer of ops[order[i]].
+	int order[CS_IO_BATCH_MAX];
+	struct iovec iov[CS_IO_BATCH_MAX];
+	// For the first op of each merged run, the number of ops in the run.
+	int run_length[CS_IO_BATCH_MAX];
+	// For loads, whether the op claimed its frame.
+	bool claimed[CS_IO_BATCH_MAX];
+	int used = 0;
+	bool has_load = false;
+	bool has_store = false;
+
+	CRASH_COND(count > CS_IO_BATCH_MAX);
+	CRASH_COND_MSG(desc_info->async_fd < 0, "File has no descriptor for batched IO.");
+
+	for (int i = 0; i < count; ++i) {
+		CRASH_COND(ops[i].di != desc_info);
+		has_load = has_load || ops[i].type == CtrlOp::LOAD;
+		has_store = has_store || ops[i].type == CtrlOp::STORE;
+	}
+
+	// The frames of the loads are claimed under the file's write lock, and read into without it.
+	if (has_load) {
+		RWLockWrite w(desc_info->lock);
+
+		for (int i = 0; i < count; ++i) {
+			claimed[i] = ops[i].type == CtrlOp::LOAD && claim_load_frame(ops[i]);
+			if (ops[i].type == CtrlOp::LOAD && !claimed[i]) {
+				atomic_increment(&stats.cancelled_loads);
+			}
+		}
+	}
+
+	// Stores only need the data of their frames to stay put until they are written.
+	if (has_store) {
+		desc_info->lock->read_lock();
+	}
+
+	for (int i = 0; i < count; ++i) {
+		// Otherwise the load was skipped, or the page was already written back by a flush, or evicted since the store was queued.
+		if (ops[i].type == CtrlOp::LOAD ? claimed[i] : (frames[ops[i].frame]->get_dirty() && is_frame_current(ops[i]))) {
+			int j = used++;
+			while (j > 0 && io_op_before(ops[i], ops[order[j - 1]])) {
+				order[j] = order[j - 1];
+				--j;
+			}
+			order[j] = i;
+		}
+	}
+
+	// Ops of the same type on adjacent pages are merged into one vectored request.
+	// A store can only be followed by another one in the same request if it writes a whole page.
+	int loads = 0;
+	int stores = 0;
+	int requests = 0;
+	int stored = 0;
+
+	for (int i = 0; i < used;) {
+		const CtrlOp &first = ops[order[i]];
+		int len = 0;
+
+		do {
+			const CtrlOp &op = ops[order[i + len]];
+			Frame *f = frames[op.frame];
+
+			iov[i + len].iov_base = f->memory_region;
+			iov[i + len].iov_len = op.type == CtrlOp::LOAD ? CS_PAGE_SIZE : f->get_used_size();
+			++len;
+		} while (i + len < used &&
+				 ops[order[i + len]].type == first.type &&
+				 CS_GET_PAGE(ops[order[i + len]].offset) == CS_GET_PAGE(first.offset) + len * CS_PAGE_SIZE &&
+				 iov[i + len - 1].iov_len == CS_PAGE_SIZE);
+
+		if (first.type == CtrlOp::LOAD) {
+			worker.aio.queue_read(desc_info->async_fd, CS_GET_PAGE(first.offset), &iov[i], len, i);
+			loads += len;
+		} else {
+			worker.aio.queue_write(desc_info->async_fd, CS_GET_PAGE(first.offset), &iov[i], len, i);
+			stores += len;
+		}
+
+		run_length[i] = len;
+		++requests;
+		i += len;
+	}
+
+	uint32_t completed = worker.aio.submit_and_wait();
 
-	int j = 0;
-	for (int i = 0; i < desc_info->pages.size(); i++) {
-		if (frames[page_frame_map[desc_info->pages[i]]]->get_dirty()) {
-			do_store_op(desc_info, page_frame_map[desc_info->pages[i]], desc_info->pages[i], page_frame_map[desc_info->pages[i]]);
+	for (uint32_t i = 0; i < completed; ++i) {
+		const AsyncIOUnix::Completion &c = worker.aio.get_completion(i);
+		int run = c.user_data;
 
-			j += 1;
+		if (ops[order[run]].type == CtrlOp::LOAD) {
+			// Error has occurred.
+			CRASH_COND_MSG(c.result < 0, "Read error with file " + desc_info->path + ", errno " + itos(-c.result));
+
+			// The bytes read fill the pages of the run in order. Pages past the end of the file get nothing.
+			int64_t remaining = c.result;
+			for (int j = run; j < run + run_length[run]; ++j) {
+				int64_t used_size = CLAMP(remaining, 0, (int64_t)CS_PAGE_SIZE);
+				remaining -= used_size;
+				frames[ops[order[j]].frame]->finish_load(used_size, &desc_info->ready_signal);
+			}
+		} else {
+			// The bytes written cover the pages of the run in order. Only the pages written in full are clean,
+			// the others stay dirty to be stored again.
+			int64_t remaining = c.result;
+			for (int j = run; j < run + run_length[run]; ++j) {
+				frame_id curr_frame = ops[order[j]].frame;
+
+				if (remaining >= (int64_t)iov[j].iov_len) {
+					remaining -= iov[j].iov_len;
+					frames[curr_frame]->set_dirty_false(&desc_info->dirty_signal, &dirty_frames);
+					++stored;
+				} else {
+					remaining = -1;
+					frames[curr_frame]->set_store_failed(true, &desc_info->dirty_signal);
+					atomic_increment(&stats.failed_stores);
+				}
+			}
+
+			if (remaining < 0) {
+				desc_info->store_error = ERR_FILE_CANT_WRITE;
+				ERR_PRINTS("Write error with file " + desc_info->path + (c.result < 0 ? ", errno " + itos(-c.result) : ", wrote only " + itos(c.result) + " bytes") + ".");
+			}
 		}
 	}
+
+	if (has_store) {
+		desc_info->lock->read_unlock();
+	}
+
+	atomic_add(&stats.io_loads, (uint64_t)loads);
+	atomic_add(&stats.io_stores, (uint64_t)stores);
+	atomic_add(&stats.io_requests, (uint64_t)requests);
+	atomic_add(&stats.write_backs, (uint64_t)stored);
+#else
+	CRASH_NOW_MSG("Batched IO is not supported on this platform.");
+#endif
+}
+
+void FileCacheManager::do_flush_op(DescriptorInfo *desc_info) {
+	CRASH_COND(!(desc_info->internal_data_source));
+
+	desc_info->internal_data_source->flush();
 	// ERR_PRINTS("flushed file " + desc_info->path)
 }
 
 void FileCacheManager::do_flush_close_op(DescriptorInfo *desc_info) {
 	CRASH_COND(!(desc_info->internal_data_source));
 
-	for (int i = 0; i < desc_info->pages.size(); i++) {
-		if (frames[page_frame_map[desc_info->pages[i]]]->get_dirty()) {
-			do_store_op(desc_info, desc_info->pages[i], page_frame_map[desc_info->pages[i]], CS_GET_FILE_OFFSET_FROM_GUID(desc_info->pages[i]));
-		}
-	}
+	unmap_data_source(desc_info);
 
 	desc_info->internal_data_source->close();
 	memdelete(desc_info->internal_data_source);
 	desc_info->internal_data_source = NULL;
+	desc_info->async_fd = -1;
+	// Writes through the cache change the modification time too, which must not make open() drop the pages.
+	desc_info->modified_time = FileAccess::get_modified_time(desc_info->path);
 
 	desc_info->dirty = false;
 	desc_info->valid = false;
-	// Posting on this semaphore allows FileCacheManager::close to continue executing.
-	desc_info->ready_sem->post();
+	// Lets FileCacheManager::close return, and the descriptor be deleted.
+	desc_info->ready_signal.broadcast();
+	desc_info->dirty_signal.broadcast();
 
 	// ERR_PRINTS("flushed and closed file " + desc_info->path)
 }
@@ -395,168 +807,467 @@ void FileCacheManager::do_flush_close_op(DescriptorInfo *desc_info) {
 // Perform a read operation.
 size_t FileCacheManager::read(const RID rid, void *const buffer, size_t length) {
 
-	DescriptorInfo **elem = files.getptr(RID_REF_TO_DD);
+	DescriptorInfo *desc_info = get_descriptor(rid);
 
-	ERR_FAIL_COND_V_MSG(!elem, CS_MEM_VAL_BAD, "No such file")
+	ERR_FAIL_COND_V_MSG(!desc_info, CS_MEM_VAL_BAD, "No such file");
 
-	DescriptorInfo *desc_info = *elem;
-	size_t read_length = length;
+	size_t read_length = read_at(rid, desc_info->offset, buffer, length);
+	ERR_FAIL_COND_V(read_length == (size_t)CS_MEM_VAL_BAD, CS_MEM_VAL_BAD);
 
-	// If we try to read a region partially outside the file.
-	{
-		size_t end_offset = desc_info->offset + read_length;
-		if (end_offset > desc_info->total_size) {
-			//// WARN_PRINTS("Reached EOF before reading " + itoh(read_length) + " bytes.");
-			read_length = desc_info->total_size - desc_info->offset;
-		}
+	if (read_length < length) {
+		// Reads that go past EOF zero out the rest of the buffer.
+		memset((uint8_t *)buffer + read_length, '\0', length - read_length);
 	}
 
-	size_t initial_start_offset = desc_info->offset;
-	size_t initial_end_offset = CS_GET_PAGE(initial_start_offset + CS_PAGE_SIZE);
-	page_id curr_page;
-	frame_id curr_frame;
-	size_t buffer_offset = 0;
-
-	// We need to handle the first and last frames differently,
-	// because the data to be copied may not start at a page boundary, and may not end on a page boundary.
-	{
-
-		//  WARN_PRINTS("Getting page for offset " + itoh(desc_info->offset + buffer_offset) + " with start offset " + itoh(desc_info->offset))
-		// Query for the page with the current offset.
-		CRASH_COND((curr_page = get_page_guid(desc_info, desc_info->offset + buffer_offset, true)) == (page_id)CS_MEM_VAL_BAD);
-		// Get frame mapped to page.
-		CRASH_COND((curr_frame = page_frame_map[curr_page]) == (frame_id)CS_MEM_VAL_BAD);
+	// We update the current offset at the end of the operation.
+	desc_info->offset += read_length;
 
-		// The end offset of the first page may not be greater than the start offset of the next page.
-		initial_end_offset = MIN(initial_start_offset + read_length, initial_end_offset);
+	return read_length;
+}
 
-		//  WARN_PRINTS("Reading first page with values:\ninitial_start_offset: " + itoh(initial_start_offset) + "\ninitial_end_offset: " + itoh(initial_end_offset) + "\n read size: " + itoh(initial_end_offset - initial_start_offset));
+size_t FileCacheManager::read_at(const RID rid, size_t offset, void *const buffer, size_t length) {
 
-		{ // Lock the page holder for the operation.
-			//  WARN_PRINTS("Locking frame " + itoh(curr_frame) + " with page " + itoh(curr_page))
+	DescriptorInfo *desc_info = get_descriptor(rid);
 
-			// wait before locking. Not after.
-			frames[curr_frame]->wait_ready(desc_info->ready_sem);
-			Frame::DataRead r(frames[curr_frame], desc_info);
+	ERR_FAIL_COND_V_MSG(!desc_info, CS_MEM_VAL_BAD, "No such file");
 
-			// Here, frames[curr_frame].memory_region + CS_PARTIAL_SIZE(desc_info->offset)
-			//  gives us the address of the first byte to copy which may or may not be on a page boundary.
-			memcpy(
-					(uint8_t *)buffer + buffer_offset,
-					r.ptr() + CS_PARTIAL_SIZE(initial_start_offset),
-					initial_end_offset - initial_start_offset);
-		}
+	// Only the part of the range inside the file can be read.
+	size_t total_size = desc_info->mapped_region ? desc_info->mapped_size : desc_info->total_size;
+	size_t read_length = offset < total_size ? MIN(length, total_size - offset) : 0;
 
-		buffer_offset += (initial_end_offset - initial_start_offset);
-		read_length -= buffer_offset;
+	// Mapped files are read straight from their mapping.
+	if (desc_info->mapped_region) {
+		memcpy(buffer, desc_info->mapped_region + offset, read_length);
+		return read_length;
 	}
 
-	// Pages in the middle must be copied in full.
-	while (buffer_offset < CS_GET_PAGE(length) && read_length > CS_PAGE_SIZE) {
+	size_t buffer_offset = 0;
 
-		// Query for the page with the current offset.
-		CRASH_COND((curr_page = get_page_guid(desc_info, desc_info->offset + buffer_offset, true)) == (page_id)CS_MEM_VAL_BAD);
-		// Get frame mapped to page.
-		CRASH_COND((curr_frame = page_frame_map[curr_page]) == (frame_id)CS_MEM_VAL_BAD);
+	// One page at a time: the page is looked up (and loaded if needed) under the cache manager's lock,
+	// which also registers this thread as a reader of its frame. The data is then copied under the file's
+	// read lock only, so readers of the same file don't wait for each other.
+	while (buffer_offset < read_length) {
 
-		//  WARN_PRINTS("Reading intermediate page.\nbuffer_offset: " + itoh(buffer_offset) + "\nread_length: " + itoh(read_length) + "\ncurrent offset: " + itoh(desc_info->offset));
+		size_t curr_offset = offset + buffer_offset;
+		size_t page_offset = CS_PARTIAL_SIZE(curr_offset);
+		frame_id curr_frame = acquire_frame(desc_info, curr_offset);
+		Frame *f = frames[curr_frame];
+		size_t copy_length;
 
-		// Lock current frame.
 		{
-			//  WARN_PRINTS("Locking frame " + itoh(curr_frame) + " with page " + itoh(curr_page))
+			// wait before locking. Not after.
+			f->wait_ready(&desc_info->ready_signal);
+			Frame::DataRead r(f, desc_info);
 
-			// wait before locking.
-			frames[curr_frame]->wait_ready(desc_info->ready_sem);
-			Frame::DataRead r(frames[curr_frame], desc_info);
+			// The last page of the file may not be full.
+			size_t used_size = f->get_used_size();
+			copy_length = page_offset < used_size ? MIN(read_length - buffer_offset, used_size - page_offset) : 0;
 
-			memcpy(
-					(uint8_t *)buffer + buffer_offset,
-					r.ptr(),
-					CS_PAGE_SIZE);
+			memcpy((uint8_t *)buffer + buffer_offset, r.ptr() + page_offset, copy_length);
+		}
+
+		f->release_reader(&readers_signal);
+
+		if (copy_length == 0) {
+			break;
 		}
 
-		buffer_offset += CS_PAGE_SIZE;
-		read_length -= CS_PAGE_SIZE;
+		buffer_offset += copy_length;
 	}
 
-	// For final potentially partially filled page
-	if (read_length) {
+	if (buffer_offset < read_length) {
+		ERR_PRINTS("Read only " + itos(buffer_offset) + " of " + itos(read_length) + " bytes from " + desc_info->path + ".");
+	}
 
-		// Query for the page with the current offset.
-		CRASH_COND((curr_page = get_page_guid(desc_info, desc_info->offset + buffer_offset, true)) == (page_id)CS_MEM_VAL_BAD);
-		// Get frame mapped to page.
-		CRASH_COND((curr_frame = page_frame_map[curr_page]) == (frame_id)CS_MEM_VAL_BAD);
+	{
+		MutexLock ml(mutex);
+		do_read_ahead(desc_info, offset, offset + buffer_offset);
+	}
 
-		// This is if
-		size_t temp_read_len = MIN(read_length, frames[curr_frame]->get_used_size());
+	return buffer_offset;
+}
 
-		//  WARN_PRINTS("Reading last page.\nread_length: " + itoh(read_length) + "\ntemp_read_len: " + itoh(temp_read_len));
+Error FileCacheManager::read_async(const RID rid, size_t offset, void *const buffer, size_t length, AsyncReadCallback callback, void *udata) {
 
-		{ // Lock last page for reading data.
-			//  WARN_PRINTS("Locking frame " + itoh(curr_frame) + " with page " + itoh(curr_page))
+	ERR_FAIL_COND_V(!callback, ERR_INVALID_PARAMETER);
+	ERR_FAIL_COND_V_MSG(!async_read_thread, ERR_UNCONFIGURED, "The file cache manager is not initialized.");
 
-			// wait before locking.
-			frames[curr_frame]->wait_ready(desc_info->ready_sem);
-			Frame::DataRead r(frames[curr_frame], desc_info);
+	MutexLock ml(mutex);
 
-			memcpy(
-					(uint8_t *)buffer + buffer_offset,
-					r.ptr(),
-					temp_read_len);
-		}
-		buffer_offset += temp_read_len;
-		read_length -= temp_read_len;
-	}
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	ERR_FAIL_COND_V_MSG(!elem || !(*elem)->valid, ERR_FILE_CANT_READ, "No such file");
 
-	if (read_length > 0) // WARN_PRINTS("Unread length: " + itoh(length - read_length) + " bytes.")
+	DescriptorInfo *desc_info = *elem;
 
-		ERR_PRINTS("Read only " + itos(length - read_length) + " of " + itos(length) + "  bytes.\nFinal page: " + itoh(curr_page) + " Final frame: " + itoh(curr_frame));
+	// Mapped files are copied straight from their mapping, there is nothing to load.
+	if (!desc_info->mapped_region) {
+		// Past a quarter of the cache, the first pages could be evicted before they are copied.
+		// The rest of the range is loaded while it is copied, like read_at() does.
+		size_t end_offset = MIN(offset + length, desc_info->total_size);
+		end_offset = MIN(end_offset, CS_GET_PAGE(offset) + (size_t)(CS_NUM_FRAMES / 4) * CS_PAGE_SIZE);
 
-	// TODO: Document this. Reads that exceed EOF will cause the remaining buffer space to be zeroed out.
-	if ((desc_info->offset + length) / desc_info->total_size > 0) {
-		memset((uint8_t *)buffer + (desc_info->total_size - desc_info->offset), '\0', length - read_length);
-	}
+		for (size_t curr_offset = CS_GET_PAGE(offset); curr_offset < end_offset; curr_offset += CS_PAGE_SIZE) {
 
-	// We update the current offset at the end of the operation.
-	desc_info->offset += buffer_offset;
+			// Pages that are already tracked are either cached or being loaded.
+			if (get_page_guid(desc_info, curr_offset, true) != (page_id)CS_MEM_VAL_BAD) {
+				continue;
+			}
 
-	return buffer_offset;
-}
+			// The page may be taken from the compressed tier, then it is ready already.
+			if (!get_page_or_do_paging_op(desc_info, curr_offset)) {
+				enqueue_load(desc_info, page_frame_map[desc_info->guid_prefix | curr_offset], curr_offset);
+			}
+		}
+	}
 
-// Similar to the read operation but opposite data flow.
-size_t FileCacheManager::write(const RID rid, const void *const data, size_t length) {
-	DescriptorInfo **elem = files.getptr(RID_REF_TO_DD);
+	AsyncRead ar;
+	ar.di = desc_info;
+	ar.rid = rid;
+	ar.offset = offset;
+	ar.buffer = buffer;
+	ar.length = length;
+	ar.callback = callback;
+	ar.udata = udata;
 
-	ERR_FAIL_COND_V_MSG(!elem, CS_MEM_VAL_BAD, "No such file")
+	atomic_increment(&desc_info->async_reads);
+	{
+		MutexLock aml(async_read_mutex);
+		async_reads.push_back(ar);
+	}
+	async_read_sem.post();
 
-	DescriptorInfo *desc_info = *elem;
-	size_t write_length = length;
+	return OK;
+}
 
-	size_t initial_start_offset = desc_info->offset;
-	size_t initial_end_offset = CS_GET_PAGE(initial_start_offset + CS_PAGE_SIZE);
-	page_id curr_page;
-	frame_id curr_frame;
-	size_t data_offset = 0;
+void FileCacheManager::async_read_func(void *p_udata) {
+	FileCacheManager &fcm = *static_cast<FileCacheManager *>(p_udata);
 
-	// We need to handle the first and last frames differently,
-	// because the data to be copied may not start at a page boundary, and may not end on a page boundary.
-	{
+	while (true) {
+		fcm.async_read_sem.wait();
 
-		//// WARN_PRINTS("Getting page for offset " + itoh(desc_info->offset + data_offset) + " with start offset " + itoh(desc_info->offset))
-		// Query for the page with the current offset.
-		CRASH_COND((curr_page = get_page_guid(desc_info, desc_info->offset + data_offset, true)) == (page_id)CS_MEM_VAL_BAD);
-		// Get frame mapped to page.
-		CRASH_COND((curr_frame = page_frame_map[curr_page]) == (frame_id)CS_MEM_VAL_BAD);
+		AsyncRead ar;
+		{
+			MutexLock ml(fcm.async_read_mutex);
 
-		// The end offset of the first page may not be greater than the start offset of the next page.
-		initial_end_offset = MIN(initial_start_offset + write_length, initial_end_offset);
-		//  WARN_PRINTS("Reading first page with values:\ninitial_start_offset: " + itoh(initial_start_offset) + "\ninitial_end_offset: " + itoh(initial_end_offset) + "\n read size: " + itoh(initial_end_offset - initial_start_offset));
+			// Each read posts the semaphore once, so an empty queue means stop_async_reads() posted it.
+			if (fcm.async_reads.empty()) {
+				break;
+			}
 
-		{ // Lock the page holder for the operation.
+			ar = fcm.async_reads.front()->get();
+			fcm.async_reads.pop_front();
+		}
 
-			// wait before locking. not after.
-			frames[curr_frame]->wait_ready(desc_info->ready_sem);
-			Frame::DataWrite w(frames[curr_frame], desc_info, false);
+		size_t read_length = fcm.read_at(ar.rid, ar.offset, ar.buffer, ar.length);
+
+		if (read_length == (size_t)CS_MEM_VAL_BAD) {
+			ar.callback(ar.udata, ERR_FILE_CANT_READ, 0);
+		} else {
+			ar.callback(ar.udata, OK, read_length);
+		}
+
+		atomic_increment(&fcm.stats.async_reads);
+		atomic_decrement(&ar.di->async_reads);
+		fcm.async_read_signal.broadcast();
+	}
+}
+
+void FileCacheManager::stop_async_reads() {
+	if (!async_read_thread) {
+		return;
+	}
+
+	async_read_sem.post();
+	Thread::wait_to_finish(async_read_thread);
+	memdelete(async_read_thread);
+	async_read_thread = NULL;
+}
+
+void FileCacheManager::wait_async_reads(DescriptorInfo *desc_info) {
+	async_read_signal.wait_until([desc_info]() { return desc_info->async_reads == 0; });
+}
+
+frame_id FileCacheManager::acquire_frame(DescriptorInfo *desc_info, size_t offset) {
+
+	MutexLock ml(mutex);
+
+	if (!get_page_or_do_paging_op(desc_info, CS_GET_PAGE(offset))) {
+		enqueue_load(desc_info, page_frame_map[get_page_guid(desc_info, offset, false)], CS_GET_PAGE(offset));
+	}
+
+	frame_id curr_frame = page_frame_map[get_page_guid(desc_info, offset, false)];
+	CRASH_COND(curr_frame == (frame_id)CS_MEM_VAL_BAD);
+
+	frames[curr_frame]->acquire_reader();
+	return curr_frame;
+}
+
+void FileCacheManager::wait_no_readers(frame_id curr_frame) {
+	Frame *f = frames[curr_frame];
+	readers_signal.wait_until([f]() { return !f->has_readers(); });
+}
+
+DescriptorInfo *FileCacheManager::get_descriptor(const RID rid) const {
+
+	MutexLock ml(mutex);
+
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	return elem ? *elem : NULL;
+}
+
+Error FileCacheManager::pin(const RID rid, size_t offset, size_t length, PinnedRange &r_range) {
+
+	DescriptorInfo *desc_info = get_descriptor(rid);
+	ERR_FAIL_COND_V_MSG(!desc_info, ERR_INVALID_PARAMETER, "No such file");
+	ERR_FAIL_COND_V_MSG(!r_range.spans.empty() || !r_range.pages.empty(), ERR_ALREADY_IN_USE, "The range is already pinned.");
+
+	// Only the part of the range inside the file can be pinned.
+	length = offset < desc_info->total_size ? MIN(length, desc_info->total_size - offset) : 0;
+	size_t end_offset = offset + length;
+
+	r_range.rid = rid;
+	r_range.length = 0;
+
+	// The mapping of a mapped file already stays put, there is nothing to pin.
+	if (desc_info->mapped_region) {
+		if (length) {
+			PinnedRange::Span span;
+			span.ptr = desc_info->mapped_region + offset;
+			span.size = length;
+			r_range.spans.push_back(span);
+			r_range.length = length;
+		}
+		return OK;
+	}
+
+	size_t page_count = length ? CS_GET_LENGTH_IN_PAGES(end_offset - CS_GET_PAGE(offset)) : 0;
+	Vector<Frame *> pinned;
+
+	{
+		MutexLock ml(mutex);
+
+		ERR_FAIL_COND_V_MSG(pinned_frames + page_count > CS_NUM_FRAMES / 2, ERR_OUT_OF_MEMORY, "Pinning " + itos(page_count) + " more pages would leave too few frames for the rest of the cache.");
+
+		// Each page is pinned as soon as it is mapped, so that mapping the next one can't evict it.
+		for (size_t curr_offset = CS_GET_PAGE(offset); curr_offset < end_offset; curr_offset += CS_PAGE_SIZE) {
+
+			if (!get_page_or_do_paging_op(desc_info, curr_offset)) {
+				enqueue_load(desc_info, page_frame_map[desc_info->guid_prefix | curr_offset], curr_offset);
+			}
+
+			page_id curr_page = get_page_guid(desc_info, curr_offset, false);
+			frame_id curr_frame = page_frame_map[curr_page];
+
+			if (frames[curr_frame]->pin() == 1) {
+				CS_GET_CACHE_POLICY_FN(cache_removal_policies, desc_info->cache_policy)
+				(curr_page);
+				pinned_frames += 1;
+			}
+
+			r_range.pages.push_back(curr_page);
+			pinned.push_back(frames[curr_frame]);
+		}
+
+		desc_info->pinned_pages += r_range.pages.size();
+	}
+
+	// The pinned frames keep their pages, so the loads can be waited for without holding the lock.
+	for (int i = 0; i < r_range.pages.size(); ++i) {
+
+		Frame *f = pinned[i];
+		f->wait_ready(&desc_info->ready_signal);
+
+		size_t page_offset = CS_GET_FILE_OFFSET_FROM_GUID(r_range.pages[i]);
+		size_t span_start = MAX(offset, page_offset);
+		size_t span_end = MIN(end_offset, page_offset + f->get_used_size());
+
+		if (span_end <= span_start) {
+			continue;
+		}
+
+		const uint8_t *ptr = f->memory_region + (span_start - page_offset);
+		size_t size = span_end - span_start;
+		int last = r_range.spans.size() - 1;
+
+		if (last >= 0 && r_range.spans[last].ptr + r_range.spans[last].size == ptr) {
+			r_range.spans.write[last].size += size;
+		} else {
+			PinnedRange::Span span;
+			span.ptr = ptr;
+			span.size = size;
+			r_range.spans.push_back(span);
+		}
+
+		r_range.length += size;
+	}
+
+	return OK;
+}
+
+void FileCacheManager::unpin(PinnedRange &r_range) {
+
+	if (r_range.pages.empty()) {
+		r_range = PinnedRange();
+		return;
+	}
+
+	MutexLock ml(mutex);
+
+	const RID rid = r_range.rid;
+	DescriptorInfo **elem = files.getptr(RID_REF_TO_DD);
+	ERR_FAIL_COND_MSG(!elem, "No such file");
+
+	DescriptorInfo *desc_info = *elem;
+
+	for (int i = 0; i < r_range.pages.size(); ++i) {
+		page_id curr_page = r_range.pages[i];
+
+		if (frames[page_frame_map[curr_page]]->unpin() == 0) {
+			CS_GET_CACHE_POLICY_FN(cache_insertion_policies, desc_info->cache_policy)
+			(curr_page);
+			pinned_frames -= 1;
+		}
+	}
+
+	desc_info->pinned_pages -= r_range.pages.size();
+	r_range = PinnedRange();
+}
+
+void FileCacheManager::do_read_ahead(DescriptorInfo *desc_info, size_t start_offset, size_t end_offset) {
+
+	if (start_offset == desc_info->last_read_end) {
+		desc_info->seq_reads += 1;
+	} else {
+		// The stream was broken by a seek, so we start detecting it again from scratch.
+		desc_info->seq_reads = 0;
+		desc_info->read_ahead_window = 0;
+		desc_info->read_ahead_end = 0;
+	}
+
+	desc_info->last_read_end = end_offset;
+
+	// Never let read-ahead take more than a quarter of the cache, or it would evict the pages it just loaded.
+	uint32_t max_window = MIN(read_ahead_max_pages, (uint32_t)(CS_NUM_FRAMES / 4));
+
+	if (desc_info->seq_reads < CS_READ_AHEAD_SEQ_THRESH || max_window == 0 || !desc_info->valid) {
+		return;
+	}
+
+	size_t window_size;
+
+	if (desc_info->read_ahead_window == 0) {
+		desc_info->read_ahead_window = MIN((uint32_t)CS_READ_AHEAD_MIN_PAGES, max_window);
+	} else {
+		// Only read further ahead once the reader has consumed half of the current window.
+		window_size = desc_info->read_ahead_window * CS_PAGE_SIZE;
+		if (desc_info->read_ahead_end > end_offset + window_size / 2) {
+			return;
+		}
+		desc_info->read_ahead_window = MIN(desc_info->read_ahead_window * 2, max_window);
+	}
+
+	window_size = desc_info->read_ahead_window * CS_PAGE_SIZE;
+
+	size_t from = MAX(CS_GET_PAGE(end_offset), desc_info->read_ahead_end);
+	size_t to = MIN(CS_GET_PAGE(end_offset) + window_size, desc_info->total_size);
+
+	for (size_t curr_offset = from; curr_offset < to; curr_offset += CS_PAGE_SIZE) {
+
+		// Pages that are already tracked are left alone, so that read-ahead does not count as an access.
+		if (get_page_guid(desc_info, curr_offset, true) != (page_id)CS_MEM_VAL_BAD) {
+			continue;
+		}
+
+		get_page_or_do_paging_op(desc_info, curr_offset);
+
+		page_id curr_page = get_page_guid(desc_info, curr_offset, false);
+		frame_id curr_frame = page_frame_map[curr_page];
+
+		frames[curr_frame]->set_read_ahead(true);
+		read_ahead_pages.push_back(curr_page);
+		atomic_increment(&stats.read_ahead_loads);
+
+		enqueue_load(desc_info, curr_frame, curr_offset, CtrlOp::PRIORITY_PREFETCH);
+	}
+
+	// Stale entries are dropped from the front so the list does not outgrow the cache.
+	while (read_ahead_pages.size() > (int)CS_NUM_FRAMES) {
+		read_ahead_pages.pop_front();
+	}
+
+	desc_info->read_ahead_end = MAX(to, desc_info->read_ahead_end);
+}
+
+page_id FileCacheManager::get_unused_read_ahead_page() {
+
+	while (!read_ahead_pages.empty()) {
+
+		page_id curr_page = read_ahead_pages.front()->get();
+		frame_id curr_frame = page_frame_map[curr_page];
+
+		// The page was untracked or accessed since it was read ahead.
+		if (curr_frame == (frame_id)CS_MEM_VAL_BAD || frames[curr_frame]->get_owning_page() != curr_page || !frames[curr_frame]->get_read_ahead()) {
+			read_ahead_pages.pop_front();
+			continue;
+		}
+
+		// Pages that are still being loaded can't be evicted yet, and neither can any page read ahead after them.
+		if (!frames[curr_frame]->get_ready()) {
+			return CS_MEM_VAL_BAD;
+		}
+
+		read_ahead_pages.pop_front();
+		return curr_page;
+	}
+
+	return CS_MEM_VAL_BAD;
+}
+
+// Similar to the read operation but opposite data flow.
+size_t FileCacheManager::write(const RID rid, const void *const data, size_t length) {
+	DescriptorInfo *desc_info = get_descriptor(rid);
+
+	ERR_FAIL_COND_V_MSG(!desc_info, CS_MEM_VAL_BAD, "No such file");
+
+	size_t write_length = write_at(rid, desc_info->offset, data, length);
+	ERR_FAIL_COND_V(write_length == (size_t)CS_MEM_VAL_BAD, CS_MEM_VAL_BAD);
+
+	// We update the current offset at the end of the operation.
+	desc_info->offset += write_length;
+
+	return write_length;
+}
+
+size_t FileCacheManager::write_at(const RID rid, size_t offset, const void *const data, size_t length) {
+	DescriptorInfo *desc_info = get_descriptor(rid);
+
+	ERR_FAIL_COND_V_MSG(!desc_info, CS_MEM_VAL_BAD, "No such file");
+	size_t write_length = length;
+
+	ERR_FAIL_COND_V_MSG(desc_info->mapped_region != NULL, 0, "Memory mapped files are read only.");
+
+	size_t initial_start_offset = offset;
+	size_t initial_end_offset = CS_GET_PAGE(initial_start_offset + CS_PAGE_SIZE);
+	frame_id curr_frame;
+	size_t data_offset = 0;
+
+	// We need to handle the first and last frames differently,
+	// because the data to be copied may not start at a page boundary, and may not end on a page boundary.
+	{
+
+		// The page is looked up under the cache manager's lock, like in read_at(),
+		// and can't be evicted until the frame is released.
+		curr_frame = acquire_frame(desc_info, offset + data_offset);
+
+		// The end offset of the first page may not be greater than the start offset of the next page.
+		initial_end_offset = MIN(initial_start_offset + write_length, initial_end_offset);
+		//  WARN_PRINTS("Reading first page with values:\ninitial_start_offset: " + itoh(initial_start_offset) + "\ninitial_end_offset: " + itoh(initial_end_offset) + "\n read size: " + itoh(initial_end_offset - initial_start_offset));
+
+		{ // Lock the page holder for the operation.
+
+			// wait before locking. not after.
+			frames[curr_frame]->wait_ready(&desc_info->ready_signal);
+			Frame::DataWrite w(frames[curr_frame], desc_info, false);
 
 			// Here, frames[curr_frame].memory_region + PARTIAL_SIZE(desc_info->offset)
 			//  gives us the address of the first byte to copy which may or may not be on a page boundary.
@@ -568,16 +1279,14 @@ size_t FileCacheManager::write(const RID rid, const void *const data, size_t len
 					(uint8_t *)data + data_offset,
 					initial_end_offset - initial_start_offset);
 
-			// If we're using less than a full page, we add our current
-			// size to the used_size value.
-			if (frames[curr_frame]->get_used_size() == CS_PAGE_SIZE) {
-			} else if (
-					CS_PARTIAL_SIZE(initial_end_offset) >
-					frames[curr_frame]->get_used_size()) {
-				frames[curr_frame]->set_used_size(CS_PARTIAL_SIZE(initial_end_offset));
+			// The page is used up to where the write ends, which is its end if the write reaches the next page.
+			size_t end_in_page = initial_end_offset - CS_GET_PAGE(initial_start_offset);
+			if (end_in_page > frames[curr_frame]->get_used_size()) {
+				frames[curr_frame]->set_used_size(end_in_page);
 			}
-			frames[curr_frame]->set_dirty_true();
+			frames[curr_frame]->set_dirty_true(&dirty_frames);
 		}
+		frames[curr_frame]->release_reader(&readers_signal);
 
 		// If we've reached here, it means the cached file is dirty.
 		desc_info->dirty = true;
@@ -586,12 +1295,9 @@ size_t FileCacheManager::write(const RID rid, const void *const data, size_t len
 	}
 
 	// Pages in the middle must be copied in full.
-	while (data_offset < CS_GET_PAGE(write_length) && write_length > CS_PAGE_SIZE) {
+	while (write_length >= CS_PAGE_SIZE) {
 
-		// Query for the page with the current offset.
-		CRASH_COND((curr_page = get_page_guid(desc_info, desc_info->offset + data_offset, true)) == (page_id)CS_MEM_VAL_BAD);
-		// Get frame mapped to page.
-		CRASH_COND((curr_frame = page_frame_map[curr_page]) == (frame_id)CS_MEM_VAL_BAD);
+		curr_frame = acquire_frame(desc_info, offset + data_offset);
 
 		// Here, frames[curr_frame].memory_region + PARTIAL_SIZE(desc_info->offset) gives us the start
 		//  WARN_PRINTS("Writing intermediate page. data_offset: " + itoh(data_offset) + "\nwrite_length: " + itoh(write_length) + "\ncurrent offset: " + itoh(desc_info->offset));
@@ -599,7 +1305,7 @@ size_t FileCacheManager::write(const RID rid, const void *const data, size_t len
 		// Lock current page holder.
 		{
 			// wait before locking.
-			frames[curr_frame]->wait_ready(desc_info->ready_sem);
+			frames[curr_frame]->wait_ready(&desc_info->ready_signal);
 			Frame::DataWrite w(frames[curr_frame], desc_info, false);
 
 			memcpy(
@@ -607,8 +1313,9 @@ size_t FileCacheManager::write(const RID rid, const void *const data, size_t len
 					(uint8_t *)data + data_offset,
 					CS_PAGE_SIZE);
 
-			frames[curr_frame]->set_dirty_true();
+			frames[curr_frame]->set_used_size(CS_PAGE_SIZE).set_dirty_true(&dirty_frames);
 		}
+		frames[curr_frame]->release_reader(&readers_signal);
 
 		data_offset += CS_PAGE_SIZE;
 		write_length -= CS_PAGE_SIZE;
@@ -617,18 +1324,16 @@ size_t FileCacheManager::write(const RID rid, const void *const data, size_t len
 	// For final potentially partially filled page
 	if (write_length) {
 
-		// Query for the page with the current offset.
-		CRASH_COND((curr_page = get_page_guid(desc_info, desc_info->offset + data_offset, true)) == (page_id)CS_MEM_VAL_BAD);
-		// Get frame mapped to page.
-		CRASH_COND((curr_frame = page_frame_map[curr_page]) == (frame_id)CS_MEM_VAL_BAD);
+		curr_frame = acquire_frame(desc_info, offset + data_offset);
 
-		size_t temp_write_len = CLAMP(write_length, 0, frames[curr_frame]->get_used_size());
+		// Less than a page is left, and it starts at the beginning of the page.
+		size_t temp_write_len = write_length;
 		//  WARN_PRINTS("Writing last page.\nwrite_length: " + itoh(write_length) + "\ntemp_write_len: " + itoh(temp_write_len));
 
 		{ // Lock last page for reading data.
 
 			// wait before locking.
-			frames[curr_frame]->wait_ready(desc_info->ready_sem);
+			frames[curr_frame]->wait_ready(&desc_info->ready_signal);
 			Frame::DataWrite w(frames[curr_frame], desc_info, false);
 
 			memcpy(
@@ -636,22 +1341,18 @@ size_t FileCacheManager::write(const RID rid, const void *const data, size_t len
 					(uint8_t *)data + data_offset,
 					temp_write_len);
 
-			// If we're using less than a full page, we add our current
-			// size to the used_size value.
-			if (frames[curr_frame]->get_used_size() == CS_PAGE_SIZE) {
-			} else {
-				if (CS_PARTIAL_SIZE(temp_write_len) > frames[curr_frame]->get_used_size())
-					frames[curr_frame]->set_used_size(temp_write_len);
+			// The used size of the page is only known once it is loaded.
+			if (temp_write_len > frames[curr_frame]->get_used_size()) {
+				frames[curr_frame]->set_used_size(temp_write_len);
 			}
 
-			frames[curr_frame]->set_dirty_true();
+			frames[curr_frame]->set_dirty_true(&dirty_frames);
 		}
+		frames[curr_frame]->release_reader(&readers_signal);
 		data_offset += temp_write_len;
 		write_length -= temp_write_len;
 	}
-	if (write_length > 0) ERR_PRINTS("Wrote only: " + itos(length - write_length) + " bytes.")
-
-	desc_info->offset += data_offset;
+	if (write_length > 0) ERR_PRINTS("Wrote only: " + itos(length - write_length) + " bytes.");
 
 	return data_offset;
 }
@@ -659,11 +1360,9 @@ size_t FileCacheManager::write(const RID rid, const void *const data, size_t len
 // The seek operation just uses the POSIX seek modes.
 size_t FileCacheManager::seek(const RID rid, int64_t new_offset, int mode) {
 
-	DescriptorInfo **elem = files.getptr(RID_REF_TO_DD);
-
-	ERR_FAIL_COND_V_MSG(!elem, CS_MEM_VAL_BAD, "No such file")
+	DescriptorInfo *desc_info = get_descriptor(rid);
 
-	DescriptorInfo *desc_info = *elem;
+	ERR_FAIL_COND_V_MSG(!desc_info, CS_MEM_VAL_BAD, "No such file");
 	size_t curr_offset = desc_info->offset;
 	size_t end_offset = desc_info->total_size;
 	int64_t eff_offset = 0;
@@ -678,79 +1377,209 @@ size_t FileCacheManager::seek(const RID rid, int64_t new_offset, int mode) {
 			eff_offset += end_offset + new_offset;
 			break;
 		default:
-			ERR_PRINT("Invalid mode parameter.")
+			ERR_PRINT("Invalid mode parameter.");
 			return CS_MEM_VAL_BAD;
 	}
 
 	if (eff_offset < 0) {
-		ERR_PRINT("Invalid offset.")
+		ERR_PRINT("Invalid offset.");
 		return CS_MEM_VAL_BAD;
 	}
 
-	/**
-	 * When the user seeks far away from the current offset,
-	 * and if the io queue currently has pending operations,
-	 * we can clear the queue of operations that affect
-	 * our current file (and only those operations).
-	 *
-	 * That way, we can read ahead at the
-	 * new offset without any waits, and we only need to
-	 * do an inexpensive page replacement operation instead
-	 * of waiting for a load to occur.
-	 *
-	 * Maybe this behaviour could be toggled.
-	 */
-	{
-		// Lock to prevent any other threads from changing the queue.
-		MutexLock ml(op_queue.mut);
-		if (!op_queue.queue.empty()) {
-
-			//  WARN_PRINT("Acquired client side queue lock.");
-
-			// Look for load ops with the same file that are farther than a threshold distance away from our effective offset and remove them.
-			for (List<CtrlOp>::Element *i = op_queue.queue.front(); i;) {
-				if (
-						// If the operation is being performed on the same file...
-						i->get().di->guid_prefix == desc_info->guid_prefix &&
-						// And the type of operation is a load...
-						i->get().type == CtrlOp::LOAD &&
-						// And the distance between the pages in the vicinity of the new region and the current offset is large enough...
-						ABSDIFF(
-								eff_offset + (CS_FIFO_THRESH_DEFAULT * CS_PAGE_SIZE / 2),
-								(int64_t)i->get().offset) > CS_FIFO_THRESH_DEFAULT) {
-
-					CtrlOp l = i->get();
-
-					// We can unmap the pages.
-					//  WARN_PRINTS("Unmapping out of range page " + itoh(CS_GET_PAGE(l.offset)) + " and frame " + itoh(l.frame) + " for file with RID " + itoh(rid.get_id()));
-
-					untrack_page(l.di, CS_GET_PAGE(l.offset));
-
-					List<CtrlOp>::Element *next = i->next();
-					// FIXME: Why is this causing an exception on windows?
-					i->erase();
-					i = next;
-
-				} else
-					i = i->next();
+	// Update the offset.
+	desc_info->offset = eff_offset;
+
+	return eff_offset;
+}
+
+// The entries of get_stats() that are single values, in the order they are listed.
+enum CacheStat {
+	STAT_HITS,
+	STAT_MISSES,
+	STAT_HIT_RATE,
+	STAT_TOTAL_EVICTIONS,
+	STAT_READ_AHEAD_LOADS,
+	STAT_READ_AHEAD_HITS,
+	STAT_READ_AHEAD_EVICTIONS,
+	STAT_READ_AHEAD_USEFULNESS,
+	STAT_WRITE_BACKS,
+	STAT_BACKGROUND_WRITE_BACKS,
+	STAT_DIRTY_FRAMES,
+	STAT_COMPRESSED_TIER_SIZE,
+	STAT_COMPRESSED_STORES,
+	STAT_COMPRESSED_HITS,
+	STAT_COMPRESSED_HIT_RATE,
+	STAT_COMPRESSED_PAGES,
+	STAT_COMPRESSED_BYTES,
+	STAT_COMPRESSED_RATIO,
+	STAT_COMPRESSED_DROPPED,
+	STAT_IO_LOADS,
+	STAT_IO_STORES,
+	STAT_IO_REQUESTS,
+	STAT_IO_MERGED,
+	STAT_ARENA,
+	STAT_DIRECT_IO,
+	STAT_QUEUE_DEPTH,
+	STAT_CANCELLED_LOADS,
+	STAT_FAILED_STORES,
+	STAT_ASYNC_READS,
+	STAT_DEADLINE_PROMOTIONS,
+	STAT_PINNED_FRAMES,
+	STAT_MAX
+};
+
+static const char *stat_names[STAT_MAX] = {
+	"hits",
+	"misses",
+	"hit_rate",
+	"total_evictions",
+	"read_ahead_loads",
+	"read_ahead_hits",
+	"read_ahead_evictions",
+	"read_ahead_usefulness",
+	"write_backs",
+	"background_write_backs",
+	"dirty_frames",
+	"compressed_tier_size",
+	"compressed_stores",
+	"compressed_hits",
+	"compressed_hit_rate",
+	"compressed_pages",
+	"compressed_bytes",
+	"compressed_ratio",
+	"compressed_dropped",
+	"io_loads",
+	"io_stores",
+	"io_requests",
+	"io_merged",
+	"arena",
+	"direct_io",
+	"queue_depth",
+	"cancelled_loads",
+	"failed_stores",
+	"async_reads",
+	"deadline_promotions",
+	"pinned_frames",
+};
+
+Variant FileCacheManager::_get_stat(int p_stat) const {
+	static const char *arena_names[] = { "heap", "mapped", "transparent_huge_pages", "huge_pages" };
+
+	switch (p_stat) {
+		case STAT_HITS: return stats.hits;
+		case STAT_MISSES: return stats.misses;
+		case STAT_HIT_RATE: {
+			uint64_t lookups = stats.hits + stats.misses;
+			return lookups ? (double)stats.hits / lookups : 0.0;
+		}
+		case STAT_TOTAL_EVICTIONS: {
+			uint64_t total_evictions = 0;
+			for (int i = 0; i < CS_CACHE_POLICY_COUNT; ++i) {
+				total_evictions += stats.evictions[i];
 			}
+			return total_evictions;
 		}
-		//// WARN_PRINT("Released client side queue lock.");
+		case STAT_READ_AHEAD_LOADS: return stats.read_ahead_loads;
+		case STAT_READ_AHEAD_HITS: return stats.read_ahead_hits;
+		case STAT_READ_AHEAD_EVICTIONS: return stats.read_ahead_evictions;
+		case STAT_READ_AHEAD_USEFULNESS: return stats.read_ahead_loads ? (double)stats.read_ahead_hits / stats.read_ahead_loads : 0.0;
+		case STAT_WRITE_BACKS: return stats.write_backs;
+		case STAT_BACKGROUND_WRITE_BACKS: return stats.background_write_backs;
+		case STAT_DIRTY_FRAMES: return dirty_frames;
+		case STAT_COMPRESSED_TIER_SIZE: return compressed_tier.get_capacity();
+		case STAT_COMPRESSED_STORES: return stats.compressed_stores;
+		case STAT_COMPRESSED_HITS: return stats.compressed_hits;
+		case STAT_COMPRESSED_HIT_RATE: return stats.misses ? (double)stats.compressed_hits / stats.misses : 0.0;
+		case STAT_COMPRESSED_PAGES: return compressed_tier.get_page_count();
+		case STAT_COMPRESSED_BYTES: return compressed_tier.get_compressed_bytes();
+		case STAT_COMPRESSED_RATIO: return compressed_tier.get_compressed_bytes() ? (double)compressed_tier.get_raw_bytes() / compressed_tier.get_compressed_bytes() : 0.0;
+		case STAT_COMPRESSED_DROPPED: return compressed_tier.get_dropped();
+		case STAT_IO_LOADS: return stats.io_loads;
+		case STAT_IO_STORES: return stats.io_stores;
+		case STAT_IO_REQUESTS: return stats.io_requests;
+		case STAT_IO_MERGED: return stats.io_loads + stats.io_stores - stats.io_requests;
+		case STAT_ARENA: return arena_names[arena_type];
+		case STAT_DIRECT_IO: return use_direct_io && arena_type != ARENA_HEAP;
+		case STAT_QUEUE_DEPTH: return op_queue.size();
+		case STAT_CANCELLED_LOADS: return stats.cancelled_loads;
+		case STAT_FAILED_STORES: return stats.failed_stores;
+		case STAT_ASYNC_READS: return stats.async_reads;
+		case STAT_DEADLINE_PROMOTIONS: return op_queue.get_deadline_promotions();
+		case STAT_PINNED_FRAMES: return pinned_frames;
 	}
 
-	// Update the offset.
-	desc_info->offset = eff_offset;
+	return Variant();
+}
 
-	return eff_offset;
+Variant FileCacheManager::get_stat(const String &p_name) const {
+	for (int i = 0; i < STAT_MAX; ++i) {
+		if (p_name == stat_names[i]) {
+			return _get_stat(i);
+		}
+	}
+
+	// The evictions per policy, the latency histograms and the queue depths per priority.
+	return get_stats().get(p_name, Variant());
 }
 
-size_t FileCacheManager::get_len(const RID rid) const {
+Dictionary FileCacheManager::get_stats() const {
+	static const char *policy_names[CS_CACHE_POLICY_COUNT] = { "KEEP", "LRU", "FIFO", "CLOCK", "ARC" };
+	static const char *latency_names[CacheStats::LATENCY_MAX] = { "load_latency", "store_latency", "flush_latency" };
+	static const char *priority_names[CtrlOp::PRIORITY_MAX] = { "INTERACTIVE", "STREAMING", "PREFETCH", "WRITE_BACK" };
+
+	Dictionary d;
+	for (int i = 0; i < STAT_MAX; ++i) {
+		d[stat_names[i]] = _get_stat(i);
+	}
+
+	Dictionary evictions;
+	for (int i = 0; i < CS_CACHE_POLICY_COUNT; ++i) {
+		evictions[policy_names[i]] = stats.evictions[i];
+	}
+	d["evictions"] = evictions;
+
+	for (int i = 0; i < CacheStats::LATENCY_MAX; ++i) {
+		Array histogram;
+		for (int j = 0; j < CS_LATENCY_BUCKETS; ++j) {
+			histogram.push_back(stats.latency[i][j]);
+		}
+		d[latency_names[i]] = histogram;
+	}
+
+	Dictionary queue_depths;
+	for (int i = 0; i < CtrlOp::PRIORITY_MAX; ++i) {
+		queue_depths[priority_names[i]] = op_queue.size(i);
+	}
+	d["queue_depth_by_priority"] = queue_depths;
+
+	return d;
+}
+
+bool FileCacheManager::has_page(const RID rid, size_t offset) const {
+
+	MutexLock ml(mutex);
 
 	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
 
-	ERR_FAIL_COND_V_MSG(!elem, CS_MEM_VAL_BAD, "No such file");
+	ERR_FAIL_COND_V_MSG(!elem, false, "No such file");
 
-	DescriptorInfo *desc_info = *elem;
+	return get_page_guid(*elem, offset, true) != (page_id)CS_MEM_VAL_BAD;
+}
+
+size_t FileCacheManager::get_position(const RID rid) const {
+
+	DescriptorInfo *desc_info = get_descriptor(rid);
+
+	ERR_FAIL_COND_V_MSG(!desc_info, CS_MEM_VAL_BAD, "No such file");
+
+	return desc_info->offset;
+}
+
+size_t FileCacheManager::get_len(const RID rid) const {
+
+	DescriptorInfo *desc_info = get_descriptor(rid);
+
+	ERR_FAIL_COND_V_MSG(!desc_info, CS_MEM_VAL_BAD, "No such file");
 
 	size_t size = desc_info->internal_data_source->get_len();
 	if (size > desc_info->total_size) {
@@ -760,6 +1589,14 @@ size_t FileCacheManager::get_len(const RID rid) const {
 	return size;
 }
 
+Error FileCacheManager::get_error(const RID rid) const {
+
+	MutexLock ml(mutex);
+
+	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	return elem ? (*elem)->store_error : OK;
+}
+
 bool FileCacheManager::file_exists(const String &p_name) const {
 	FileAccess *f = FileAccess::create(FileAccess::ACCESS_FILESYSTEM);
 	bool exists = f->file_exists(p_name);
@@ -769,178 +1606,358 @@ bool FileCacheManager::file_exists(const String &p_name) const {
 
 bool FileCacheManager::eof_reached(const RID rid) const {
 
-	DescriptorInfo *const *elem = files.getptr(RID_REF_TO_DD);
+	DescriptorInfo *desc_info = get_descriptor(rid);
 
-	ERR_FAIL_COND_V_MSG(!elem, true, "No such file");
+	ERR_FAIL_COND_V_MSG(!desc_info, true, "No such file");
 
-	return (*elem)->internal_data_source->eof_reached();
+	return desc_info->internal_data_source->eof_reached();
 }
 
 void FileCacheManager::rmp_lru(page_id curr_page) {
 	//  WARN_PRINTS("Removing LRU page " + itoh(curr_page));
-	if (lru_cached_pages.find(curr_page) != NULL)
-		lru_cached_pages.erase(curr_page);
+	lru_list.remove(frames, page_frame_map[curr_page]);
 }
 
 void FileCacheManager::rmp_fifo(page_id curr_page) {
 	//  WARN_PRINTS("Removing FIFO page " + itoh(curr_page));
-	if (fifo_cached_pages.find(curr_page) != NULL)
-		fifo_cached_pages.erase(curr_page);
+	fifo_list.remove(frames, page_frame_map[curr_page]);
 }
 
 void FileCacheManager::rmp_keep(page_id curr_page) {
 	//  WARN_PRINTS("Removing permanent page " + itoh(curr_page));
-	if (permanent_cached_pages.find(curr_page) != NULL)
-		permanent_cached_pages.erase(curr_page);
+	keep_list.remove(frames, page_frame_map[curr_page]);
+}
+
+void FileCacheManager::rmp_clock(page_id curr_page) {
+	//  WARN_PRINTS("Removing CLOCK page " + itoh(curr_page));
+	clock_list.remove(frames, page_frame_map[curr_page]);
+}
+
+void FileCacheManager::rmp_arc(page_id curr_page) {
+	//  WARN_PRINTS("Removing ARC page " + itoh(curr_page));
+	frame_id curr_frame = page_frame_map[curr_page];
+	arc_t1.remove(frames, curr_frame);
+	arc_t2.remove(frames, curr_frame);
 }
 
 void FileCacheManager::ip_lru(page_id curr_page) {
 	//  WARN_PRINT("LRU cached.");
-	lru_cached_pages.insert(curr_page);
+	lru_list.push_front(frames, page_frame_map[curr_page]);
 }
 
 void FileCacheManager::ip_fifo(page_id curr_page) {
 	//  WARN_PRINT("FIFO cached.");
-	fifo_cached_pages.push_front(curr_page);
+	fifo_list.push_front(frames, page_frame_map[curr_page]);
 }
 
 void FileCacheManager::ip_keep(page_id curr_page) {
 	//  WARN_PRINT("Permanent cached.");
-	permanent_cached_pages.insert(curr_page);
+	keep_list.push_front(frames, page_frame_map[curr_page]);
+}
+
+void FileCacheManager::ip_clock(page_id curr_page) {
+	//  WARN_PRINT("CLOCK cached.");
+	// New pages start with a clear reference bit, so a page that is only touched once
+	// is evicted the first time the hand reaches it.
+	frame_id curr_frame = page_frame_map[curr_page];
+	frames[curr_frame]->set_referenced(false);
+	clock_list.push_front(frames, curr_frame);
+}
+
+void FileCacheManager::ip_arc(page_id curr_page) {
+	//  WARN_PRINT("ARC cached.");
+	frame_id curr_frame = page_frame_map[curr_page];
+
+	if (erase_arc_ghost(arc_b1, arc_b1_pages, curr_page)) {
+
+		// The page was evicted from T1 too early, so T1 should be allowed to grow.
+		uint32_t delta = MAX(1u, (uint32_t)(arc_b2.size() / (arc_b1.size() + 1)));
+		arc_target = MIN(arc_target + delta, (uint32_t)CS_NUM_FRAMES);
+		arc_t2.push_front(frames, curr_frame);
+
+	} else if (erase_arc_ghost(arc_b2, arc_b2_pages, curr_page)) {
+
+		// The page was evicted from T2 too early, so T2 should be allowed to grow.
+		uint32_t delta = MAX(1u, (uint32_t)(arc_b1.size() / (arc_b2.size() + 1)));
+		arc_target = arc_target > delta ? arc_target - delta : 0;
+		arc_t2.push_front(frames, curr_frame);
+
+	} else {
+		// Pages seen for the first time go to T1, so a long scan only ever displaces other T1 pages.
+		arc_t1.push_front(frames, curr_frame);
+	}
 }
 
 void FileCacheManager::up_lru(page_id curr_page) {
 	//  WARN_PRINTS("Updating LRU page " + itoh(curr_page));
-	lru_cached_pages.erase(curr_page);
-	frames[page_frame_map[curr_page]]->set_last_use(step).set_ready_true(files[curr_page >> 40]->ready_sem);
-	lru_cached_pages.insert(curr_page);
+	frame_id curr_frame = page_frame_map[curr_page];
+	frames[curr_frame]->set_last_use(step);
+	lru_list.move_to_front(frames, curr_frame);
 }
+
 void FileCacheManager::up_fifo(page_id curr_page) {
 	//  WARN_PRINTS("Updating FIFO page " + itoh(curr_page));
-	frames[page_frame_map[curr_page]]->set_last_use(step).set_ready_true(files[curr_page >> 40]->ready_sem);
+	frames[page_frame_map[curr_page]]->set_last_use(step);
 }
+
 void FileCacheManager::up_keep(page_id curr_page) {
 	//  WARN_PRINTS("Updating Permanent page " + itoh(curr_page));
-	permanent_cached_pages.erase(curr_page);
-	frames[page_frame_map[curr_page]]->set_last_use(step).set_ready_true(files[curr_page >> 40]->ready_sem);
-	permanent_cached_pages.insert(curr_page);
+	frame_id curr_frame = page_frame_map[curr_page];
+	frames[curr_frame]->set_last_use(step);
+	keep_list.move_to_front(frames, curr_frame);
 }
 
-/**
- * LRU replacement policy.
- */
-page_id FileCacheManager::rp_lru(DescriptorInfo *desc_info) {
+void FileCacheManager::up_clock(page_id curr_page) {
+	//  WARN_PRINTS("Updating CLOCK page " + itoh(curr_page));
+	// A hit only sets the reference bit, the page doesn't move until the hand reaches it.
+	frames[page_frame_map[curr_page]]->set_last_use(step).set_referenced(true);
+}
 
-	page_id page_to_evict = CS_MEM_VAL_BAD;
+void FileCacheManager::up_arc(page_id curr_page) {
+	//  WARN_PRINTS("Updating ARC page " + itoh(curr_page));
+	// Any hit makes the page frequent.
+	frame_id curr_frame = page_frame_map[curr_page];
+	frames[curr_frame]->set_last_use(step);
+	arc_t1.remove(frames, curr_frame);
+	arc_t2.move_to_front(frames, curr_frame);
+}
+
+bool FileCacheManager::erase_arc_ghost(List<page_id> &ghosts, HashMap<page_id, List<page_id>::Element *> &ghost_pages, page_id curr_page) {
+
+	List<page_id>::Element **e = ghost_pages.getptr(curr_page);
+	if (!e) {
+		return false;
+	}
+
+	ghosts.erase(*e);
+	ghost_pages.erase(curr_page);
+	return true;
+}
+
+page_id FileCacheManager::evict_arc_page() {
+
+	CRASH_COND(arc_t1.empty() && arc_t2.empty());
+
+	page_id page_to_evict;
+
+	if (!arc_t1.empty() && (arc_t1.size() > arc_target || arc_t2.empty())) {
+
+		page_to_evict = frames[pop_victim(arc_t1)]->get_owning_page();
+		arc_b1_pages[page_to_evict] = arc_b1.push_front(page_to_evict);
+
+	} else {
+
+		page_to_evict = frames[pop_victim(arc_t2)]->get_owning_page();
+		arc_b2_pages[page_to_evict] = arc_b2.push_front(page_to_evict);
+	}
+
+	// Each ghost list remembers at most as many pages as the cache can hold.
+	while (arc_b1.size() > (int)CS_NUM_FRAMES) {
+		arc_b1_pages.erase(arc_b1.back()->get());
+		arc_b1.pop_back();
+	}
+
+	while (arc_b2.size() > (int)CS_NUM_FRAMES) {
+		arc_b2_pages.erase(arc_b2.back()->get());
+		arc_b2.pop_back();
+	}
 
-	bool cond_flag = false;
+	return page_to_evict;
+}
 
-	if (lru_cached_pages.size() > CS_LRU_THRESH_DEFAULT) {
+frame_id FileCacheManager::pop_victim(FrameList &list) {
 
-		Frame *f = frames[page_frame_map[lru_cached_pages.back()->get()]];
+	// The oldest dirty frame without readers, taken if no clean one turns up.
+	frame_id dirty_frame = CS_MEM_VAL_BAD;
 
-		if (step - f->get_last_use() > CS_LRU_THRESH_DEFAULT) {
+	frame_id curr_frame = list.tail;
+	for (int i = 0; i < CS_EVICT_SCAN_MAX && curr_frame != (frame_id)CS_MEM_VAL_BAD; ++i) {
+		// Someone is copying data out of the frame, evicting it would wait for them.
+		if (frames[curr_frame]->has_readers()) {
+			curr_frame = list.newer(frames, curr_frame);
+			continue;
+		}
 
-			page_to_evict = (rng.randi() % 2) ? lru_cached_pages.back()->get() : lru_cached_pages.back()->prev()->get();
+		if (!frames[curr_frame]->get_dirty()) {
+			list.remove(frames, curr_frame);
+			return curr_frame;
+		}
 
-			lru_cached_pages.erase(page_to_evict);
+		// Get its store going, so it is clean by the next time the scan reaches it.
+		enqueue_write_back(curr_frame);
+		if (dirty_frame == (frame_id)CS_MEM_VAL_BAD) {
+			dirty_frame = curr_frame;
+		}
+		curr_frame = list.newer(frames, curr_frame);
+	}
 
-		} else
-			cond_flag = true;
+	// Every frame looked at is dirty or being read. Evicting a dirty one waits for its write-back in untrack_page(),
+	// and evicting one with readers waits for them in wait_no_readers().
+	if (dirty_frame != (frame_id)CS_MEM_VAL_BAD) {
+		list.remove(frames, dirty_frame);
+		return dirty_frame;
 	}
+	return list.pop_back(frames);
+}
 
-	if (cond_flag) {
+page_id FileCacheManager::rp_fallback() {
 
-		if (fifo_cached_pages.size() > CS_FIFO_THRESH_DEFAULT) {
+	if (!fifo_list.empty()) {
+		return frames[pop_victim(fifo_list)]->get_owning_page();
+	}
 
-			page_to_evict = fifo_cached_pages.back()->get();
+	if (!clock_list.empty()) {
+		return evict_clock_page();
+	}
 
-			fifo_cached_pages.erase(fifo_cached_pages.back());
+	if (!arc_t1.empty() || !arc_t2.empty()) {
+		return evict_arc_page();
+	}
 
-		} else if (lru_cached_pages.size() > 2) {
+	if (!lru_list.empty()) {
+		return frames[pop_victim(lru_list)]->get_owning_page();
+	}
 
-			page_to_evict = lru_cached_pages.back()->get();
+	if (!keep_list.empty()) {
+		return frames[pop_victim(keep_list)]->get_owning_page();
+	}
 
-			lru_cached_pages.erase(page_to_evict);
+	CRASH_NOW_MSG("CANNOT ADD PAGE TO CACHE; INSUFFICIENT SPACE.");
+	return CS_MEM_VAL_BAD;
+}
 
+page_id FileCacheManager::evict_clock_page() {
+
+	CRASH_COND(clock_list.empty());
+
+	// The tail of the list is where the hand points. Each referenced frame gets a second chance:
+	// its bit is cleared and it goes back around. So does each dirty frame, with its write-back queued.
+	// After one full turn every bit is clear, and only dirty frames are left to stop the hand, so the
+	// second turn takes the first frame whose bit is clear even if it is dirty.
+	// Frames with readers are passed over for both turns, so that the eviction doesn't wait for them.
+	uint32_t turn = clock_list.size();
+	for (uint32_t i = 0;; ++i) {
+		frame_id curr_frame = clock_list.tail;
+
+		if (frames[curr_frame]->get_referenced()) {
+			frames[curr_frame]->set_referenced(false);
+			clock_list.move_to_front(frames, curr_frame);
+		} else if (i < 2 * turn && frames[curr_frame]->has_readers()) {
+			clock_list.move_to_front(frames, curr_frame);
+		} else if (i < turn && frames[curr_frame]->get_dirty()) {
+			enqueue_write_back(curr_frame);
+			clock_list.move_to_front(frames, curr_frame);
 		} else {
-			CRASH_NOW_MSG("CANNOT ADD LRU PAGE TO CACHE; INSUFFICIENT SPACE.")
+			clock_list.remove(frames, curr_frame);
+			return frames[curr_frame]->get_owning_page();
 		}
 	}
+}
 
-	return page_to_evict;
+/**
+ * LRU replacement policy.
+ */
+page_id FileCacheManager::rp_lru(DescriptorInfo *desc_info) {
+
+	// The tail of the LRU list is always the least recently used page.
+	if (lru_list.size() > CS_LRU_THRESH_DEFAULT && step - frames[lru_list.tail]->get_last_use() > CS_LRU_THRESH_DEFAULT) {
+
+		return frames[pop_victim(lru_list)]->get_owning_page();
+
+	} else if (fifo_list.size() > CS_FIFO_THRESH_DEFAULT) {
+
+		return frames[pop_victim(fifo_list)]->get_owning_page();
+
+	} else if (clock_list.size() > CS_CLOCK_THRESH_DEFAULT) {
+
+		return evict_clock_page();
+
+	} else if (lru_list.size() > 2) {
+
+		return frames[pop_victim(lru_list)]->get_owning_page();
+	}
+
+	return rp_fallback();
 }
 
 page_id FileCacheManager::rp_keep(DescriptorInfo *desc_info) {
 
-	page_id page_to_evict = CS_MEM_VAL_BAD;
+	if (fifo_list.size() > CS_FIFO_THRESH_DEFAULT) {
+
+		return frames[pop_victim(fifo_list)]->get_owning_page();
 
-	if (fifo_cached_pages.size() > CS_FIFO_THRESH_DEFAULT) {
+	} else if (clock_list.size() > CS_CLOCK_THRESH_DEFAULT) {
 
-		page_to_evict = fifo_cached_pages.back()->get();
+		return evict_clock_page();
 
-		fifo_cached_pages.erase(fifo_cached_pages.back());
+	} else if (lru_list.size() > CS_LRU_THRESH_DEFAULT) {
 
-	} else if (lru_cached_pages.size() > CS_LRU_THRESH_DEFAULT) {
+		return frames[pop_victim(lru_list)]->get_owning_page();
 
-		Frame *f = frames[page_frame_map[lru_cached_pages.back()->get()]];
+	} else if (keep_list.size() > CS_KEEP_THRESH_DEFAULT / 2) {
 
-		// The difference between the step and the last_use value of a frame gives us the frame's age.
-		if (step - f->get_last_use() > CS_LRU_THRESH_DEFAULT) {
+		return frames[pop_victim(keep_list)]->get_owning_page();
+	}
 
-			page_to_evict = (rng.randi() % 2) ? lru_cached_pages.back()->get() : permanent_cached_pages.back()->prev()->get();
+	return rp_fallback();
+}
 
-			lru_cached_pages.erase(page_to_evict);
+page_id FileCacheManager::rp_fifo(DescriptorInfo *desc_info) {
 
-		} else {
-			page_to_evict = lru_cached_pages.back()->get();
-			lru_cached_pages.erase(page_to_evict);
-		}
+	if (fifo_list.size() > CS_FIFO_THRESH_DEFAULT) {
 
-	} else if (permanent_cached_pages.size() > CS_KEEP_THRESH_DEFAULT / 2) {
+		return frames[pop_victim(fifo_list)]->get_owning_page();
 
-		page_to_evict = (rng.randi() % 2) ? permanent_cached_pages.back()->get() : permanent_cached_pages.back()->prev()->get();
+	} else if (lru_list.size() > CS_LRU_THRESH_DEFAULT && step - frames[lru_list.tail]->get_last_use() > CS_LRU_THRESH_DEFAULT) {
 
-		permanent_cached_pages.erase(page_to_evict);
+		return frames[pop_victim(lru_list)]->get_owning_page();
 
-	} else {
-		CRASH_NOW_MSG("CANNOT ADD PERMANENT PAGE TO CACHE; INSUFFICIENT SPACE.")
+	} else if (fifo_list.size() > CS_FIFO_THRESH_DEFAULT / 2) {
+
+		return frames[pop_victim(fifo_list)]->get_owning_page();
 	}
 
-	return page_to_evict;
+	return rp_fallback();
 }
 
-page_id FileCacheManager::rp_fifo(DescriptorInfo *desc_info) {
+page_id FileCacheManager::rp_clock(DescriptorInfo *desc_info) {
 
-	page_id page_to_evict = CS_MEM_VAL_BAD;
+	if (clock_list.size() > CS_CLOCK_THRESH_DEFAULT) {
 
-	if (fifo_cached_pages.size() > CS_FIFO_THRESH_DEFAULT) {
+		return evict_clock_page();
 
-		page_to_evict = fifo_cached_pages.back()->get();
+	} else if (fifo_list.size() > CS_FIFO_THRESH_DEFAULT) {
 
-		fifo_cached_pages.back()->erase();
+		return frames[pop_victim(fifo_list)]->get_owning_page();
 
-	} else if (lru_cached_pages.size() > CS_LRU_THRESH_DEFAULT) {
+	} else if (lru_list.size() > CS_LRU_THRESH_DEFAULT && step - frames[lru_list.tail]->get_last_use() > CS_LRU_THRESH_DEFAULT) {
 
-		Frame *f = frames.operator[](page_frame_map.operator[](lru_cached_pages.back()->get()));
+		return frames[pop_victim(lru_list)]->get_owning_page();
+	}
 
-		if (step - f->get_last_use() > CS_LRU_THRESH_DEFAULT) {
+	return rp_fallback();
+}
 
-			page_to_evict = (rng.randi() % 2) ? lru_cached_pages.back()->get() : lru_cached_pages.back()->prev()->get();
+page_id FileCacheManager::rp_arc(DescriptorInfo *desc_info) {
 
-			lru_cached_pages.erase(page_to_evict);
-		}
-	} else if (fifo_cached_pages.size() > CS_FIFO_THRESH_DEFAULT / 2) {
+	if (arc_t1.size() + arc_t2.size() > CS_ARC_THRESH_DEFAULT) {
 
-		page_to_evict = fifo_cached_pages.back()->get();
+		return evict_arc_page();
 
-		fifo_cached_pages.back()->erase();
+	} else if (fifo_list.size() > CS_FIFO_THRESH_DEFAULT) {
 
-	} else {
-		CRASH_NOW_MSG("CANNOT ADD FIFO PAGE TO CACHE; INSUFFICIENT SPACE.")
+		return frames[pop_victim(fifo_list)]->get_owning_page();
+
+	} else if (clock_list.size() > CS_CLOCK_THRESH_DEFAULT) {
+
+		return evict_clock_page();
+
+	} else if (lru_list.size() > CS_LRU_THRESH_DEFAULT && step - frames[lru_list.tail]->get_last_use() > CS_LRU_THRESH_DEFAULT) {
+
+		return frames[pop_victim(lru_list)]->get_owning_page();
 	}
 
-	return page_to_evict;
+	return rp_fallback();
 }
 
 bool FileCacheManager::get_page_or_do_paging_op(DescriptorInfo *desc_info, size_t offset) {
@@ -952,39 +1969,23 @@ bool FileCacheManager::get_page_or_do_paging_op(DescriptorInfo *desc_info, size_
 
 	if (curr_page == (page_id)CS_MEM_VAL_BAD) {
 
+		atomic_increment(&stats.misses);
 		curr_page = get_page_guid(desc_info, offset, false);
 		//  WARN_PRINTS("Adding page : " + itoh(curr_page));
 
-		// Find a free frame. last_used is only ever updated here, that could change...
-		// TODO: change this to something more efficient.
-		for (
-				int i = ((last_used + 1) % CS_NUM_FRAMES);
-				i != last_used;
-				i = (i + 1) % 16) {
-
-			if (frames[i]->get_used() == false) {
-
-				// This is the only place where a frame's owning_page value is used, that could change.
-				DescriptorInfo **old_desc_info = files.getptr(frames[i]->get_owning_page() >> 40);
+		// Take a free frame if there is one. Frames are only put on the free list once they are clean.
+		curr_frame = free_frames.pop_back(frames);
+		if (curr_frame != (frame_id)CS_MEM_VAL_BAD) {
 
-				if (old_desc_info)
-					frames[i]->wait_clean((*old_desc_info)->dirty_sem);
+			frames[curr_frame]->set_ready_false().set_used(true).set_last_use(step).set_used_size(0).set_read_ahead(false).set_prefetched(false).set_owning_page(curr_page);
 
-				frames[i]->set_ready_false().set_used(true).set_last_use(step).set_used_size(0).set_owning_page(curr_page);
+			CRASH_COND(!page_frame_map.insert(curr_page, curr_frame));
 
-				curr_frame = i;
-				last_used = i;
-
-				CRASH_COND(curr_frame == (frame_id)CS_MEM_VAL_BAD);
-				CRASH_COND(page_frame_map.insert(curr_page, curr_frame) == NULL);
-
-				//WARN_PRINTS(itoh(curr_page) + " mapped to " + itoh(curr_frame));
-				CS_GET_CACHE_POLICY_FN(
-						cache_insertion_policies,
-						desc_info->cache_policy)
-				(curr_page);
-				break;
-			}
+			//WARN_PRINTS(itoh(curr_page) + " mapped to " + itoh(curr_frame));
+			CS_GET_CACHE_POLICY_FN(
+					cache_insertion_policies,
+					desc_info->cache_policy)
+			(curr_page);
 		}
 
 		// If there are no free frames, we evict an old one according to the paging/caching algo.
@@ -993,28 +1994,50 @@ bool FileCacheManager::get_page_or_do_paging_op(DescriptorInfo *desc_info, size_
 
 			//  WARN_PRINTS("Cache policy: " + String(Dictionary(desc_info->to_variant(*this)).get("cache_policy", "-1")));
 
-			// Call the appropriate replacement policy function for our caching policy.
-			page_id page_to_evict = CS_GET_CACHE_POLICY_FN(cache_replacement_policies, desc_info->cache_policy)(desc_info);
+			// Pages that were read ahead but never used are evicted before anything else.
+			page_id page_to_evict = get_unused_read_ahead_page();
+
+			if (page_to_evict == (page_id)CS_MEM_VAL_BAD) {
+				// Call the appropriate replacement policy function for our caching policy.
+				page_to_evict = CS_GET_CACHE_POLICY_FN(cache_replacement_policies, desc_info->cache_policy)(desc_info);
+			} else {
+				atomic_increment(&stats.read_ahead_evictions);
+			}
+
+			atomic_increment(&stats.evictions[files[page_to_evict >> 40]->cache_policy]);
 
 			frame_id frame_to_evict = page_frame_map[page_to_evict];
 
 			CRASH_COND(frame_to_evict == (frame_id)CS_MEM_VAL_BAD);
 
+			// The policies pass over dirty frames while they can, see pop_victim(). When they couldn't,
+			// the store is queued interactive and untrack_page() waits for it. No IO worker takes the mutex,
+			// so waiting here can't deadlock, but it does hold up the other users of the cache.
 			if (frames[frame_to_evict]->get_dirty()) {
 				enqueue_store(files[page_to_evict >> 40], frame_to_evict, CS_GET_FILE_OFFSET_FROM_GUID(page_to_evict));
 			}
 
+			// Only pages that finished loading have data worth keeping.
+			bool keep_compressed = compressed_tier.is_enabled() && frames[frame_to_evict]->get_ready();
+			uint32_t evicted_size = frames[frame_to_evict]->get_used_size();
+
 			untrack_page(files[page_to_evict >> 40], page_to_evict);
+			free_frames.remove(frames, frame_to_evict);
+
+			// The frame is clean and has no readers now, and its data stays intact until it is reused below.
+			if (keep_compressed && compressed_tier.store(page_to_evict, frames[frame_to_evict]->memory_region, evicted_size)) {
+				atomic_increment(&stats.compressed_stores);
+			}
 
 			// Set up flags and values for the new mapping.
-			frames[frame_to_evict]->set_used(true).set_last_use(step).set_used_size(0).set_owning_page(curr_page);
+			frames[frame_to_evict]->set_used(true).set_last_use(step).set_used_size(0).set_read_ahead(false).set_prefetched(false).set_owning_page(curr_page);
 
 			// We reuse the page holder we evicted.
 			curr_frame = frame_to_evict;
 
 			//  WARN_PRINTS("evicted page under " + String(desc_info->cache_policy == _FileCacheManager::LRU ? "LRU " : (desc_info->cache_policy == _FileCacheManager::KEEP ? "KEEP " : "FIFO ")) + itoh(page_to_evict));
 
-			CRASH_COND_MSG(page_frame_map.insert(curr_page, curr_frame) == NULL, "Could not insert new page in page-frame map.");
+			CRASH_COND_MSG(!page_frame_map.insert(curr_page, curr_frame), "Could not insert new page in page-frame map.");
 
 			CS_GET_CACHE_POLICY_FN(cache_insertion_policies, desc_info->cache_policy)
 			(curr_page);
@@ -1022,14 +2045,46 @@ bool FileCacheManager::get_page_or_do_paging_op(DescriptorInfo *desc_info, size_
 			//  WARN_PRINTS("curr_page : " + itoh(curr_page) + " mapped to curr_frame: " + itoh(curr_frame));
 		}
 
-		desc_info->pages.ordered_insert(curr_page);
+		frames[curr_frame]->set_page_index(desc_info->pages.size());
+		desc_info->pages.push_back(curr_page);
+		desc_info->set_page_tracked(offset, true);
 
 		ret = false;
 
+		// A page held by the compressed tier is decompressed into its new frame rather than loaded from the file.
+		if (compressed_tier.is_enabled()) {
+			int used_size = compressed_tier.take(curr_page, frames[curr_frame]->memory_region);
+			if (used_size >= 0) {
+				frames[curr_frame]->set_used_size(used_size).set_ready_true(&desc_info->ready_signal);
+				atomic_increment(&stats.compressed_hits);
+				ret = true;
+			}
+		}
+
 	} else {
-		// Update cache related details...
-		CS_GET_CACHE_POLICY_FN(cache_update_policies, desc_info->cache_policy)
-		(curr_page);
+		curr_frame = page_frame_map[curr_page];
+
+		// The read a page was prefetched for is the access its miss already counted.
+		// Counting it again would make every page loaded by check_cache() look reused to ARC.
+		if (frames[curr_frame]->get_prefetched()) {
+			frames[curr_frame]->set_prefetched(false);
+		} else {
+			atomic_increment(&stats.hits);
+			frames[curr_frame]->add_access();
+
+			// The page has been used, so it is no longer a read-ahead eviction candidate.
+			if (frames[curr_frame]->get_read_ahead()) {
+				atomic_increment(&stats.read_ahead_hits);
+				frames[curr_frame]->set_read_ahead(false);
+			}
+
+			// Update cache related details...
+			// Pinned pages are out of the policy lists until they are unpinned.
+			if (!frames[curr_frame]->get_pinned()) {
+				CS_GET_CACHE_POLICY_FN(cache_update_policies, desc_info->cache_policy)
+				(curr_page);
+			}
+		}
 		ret = true;
 	}
 
@@ -1049,55 +2104,495 @@ FileCacheManager *FileCacheManager::get_singleton() {
 }
 
 void FileCacheManager::unlock() {
-	if (!thread || !mutex) {
+	if (io_workers.empty()) {
 		return;
 	}
 
-	mutex->unlock();
+	mutex.unlock();
 }
 
 void FileCacheManager::lock() {
-	if (!thread || !mutex) {
+	if (io_workers.empty()) {
 		return;
 	}
 
-	mutex->lock();
+	mutex.lock();
 }
 
-Error FileCacheManager::init() {
+void FileCacheManager::alloc_arena(size_t p_size) {
+#if defined(UNIX_ENABLED)
+	void *region = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+	// Explicit huge pages only exist if the system reserved some, so this often fails.
+	if (use_huge_pages) {
+		size_t huge_size = (p_size + CS_HUGE_PAGE_SIZE - 1) & ~((size_t)CS_HUGE_PAGE_SIZE - 1);
+		region = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (region != MAP_FAILED) {
+			memory_region = (uint8_t *)region;
+			memory_region_size = huge_size;
+			arena_type = ARENA_HUGE_PAGES;
+			return;
+		}
+	}
+#endif
+
+	// A mapping is aligned to the system page size, which direct IO needs.
+	region = mmap(NULL, p_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region != MAP_FAILED) {
+		memory_region = (uint8_t *)region;
+		memory_region_size = p_size;
+		arena_type = ARENA_MAPPED;
+#if defined(MADV_HUGEPAGE)
+		if (use_huge_pages && madvise(region, p_size, MADV_HUGEPAGE) == 0) {
+			arena_type = ARENA_TRANSPARENT_HUGE_PAGES;
+		}
+#endif
+		return;
+	}
+#endif
+
+	memory_region = memnew_arr(uint8_t, p_size);
+	memory_region_size = p_size;
+	arena_type = ARENA_HEAP;
+}
+
+void FileCacheManager::free_arena() {
+	if (!memory_region) {
+		return;
+	}
+
+#if defined(UNIX_ENABLED)
+	if (arena_type != ARENA_HEAP) {
+		munmap(memory_region, memory_region_size);
+	} else
+#endif
+	{
+		memdelete_arr(memory_region);
+	}
+
+	memory_region = NULL;
+	memory_region_size = 0;
+}
+
+Error FileCacheManager::init(size_t p_page_size, size_t p_cache_size, uint32_t p_io_threads) {
+
+	ERR_FAIL_COND_V_MSG(memory_region != NULL, ERR_ALREADY_IN_USE, "The file cache manager is already initialized.");
+
+	if (p_page_size < CS_PAGE_SIZE_MIN || p_page_size > CS_PAGE_SIZE_MAX || (p_page_size & (p_page_size - 1)) != 0) {
+		ERR_PRINTS("Invalid cache page size " + itoh(p_page_size) + ", it must be a power of 2 between " + itoh(CS_PAGE_SIZE_MIN) + " and " + itoh(CS_PAGE_SIZE_MAX) + ". Using the default page size.");
+		p_page_size = CS_PAGE_SIZE_DEFAULT;
+	}
+
+	// The cache size is rounded down to a whole number of pages.
+	p_cache_size -= p_cache_size % p_page_size;
+
+	if (p_cache_size / p_page_size < CS_NUM_FRAMES_MIN) {
+		ERR_PRINTS("Cache size " + itoh(p_cache_size) + " is too small to hold " + itos(CS_NUM_FRAMES_MIN) + " pages. Using the minimum cache size.");
+		p_cache_size = p_page_size * CS_NUM_FRAMES_MIN;
+	}
+
+	cs_page_size = p_page_size;
+	cs_cache_size = p_cache_size;
+
+	alloc_arena(CS_CACHE_SIZE);
+	ERR_FAIL_COND_V_MSG(!memory_region, ERR_OUT_OF_MEMORY, "Could not allocate " + itoh(CS_CACHE_SIZE) + " bytes for the file cache.");
+
+	available_space = CS_CACHE_SIZE;
+	used_space = 0;
+	total_space = CS_CACHE_SIZE;
+
+	frames.resize(CS_NUM_FRAMES);
+	page_frame_map.reserve(CS_NUM_FRAMES);
+
+	if (compressed_tier.init(compressed_tier_size, compressed_tier_mode) != OK) {
+		ERR_PRINTS("Could not set up a compressed tier of " + itoh(compressed_tier_size) + " bytes, it is disabled.");
+	}
+	for (size_t i = 0; i < CS_NUM_FRAMES; ++i) {
+		frames.write[i] = memnew(Frame(memory_region + i * CS_PAGE_SIZE));
+		free_frames.push_front(frames, i);
+	}
+
+	if (p_io_threads < 1) {
+		p_io_threads = 1;
+	}
+
+	op_queue.init(p_io_threads, CS_CTRL_QUEUE_SIZE);
+
 	exit_thread = false;
-	thread = Thread::create(FileCacheManager::thread_func, this);
+	for (uint32_t i = 0; i < p_io_threads; ++i) {
+		IOWorker *worker = memnew(IOWorker);
+		worker->fcm = this;
+		worker->shard = i;
+#if defined(UNIX_ENABLED)
+		worker->aio.init(CS_IO_BATCH_MAX, use_io_uring);
+#endif
+		worker->thread = Thread::create(FileCacheManager::thread_func, worker);
+		io_workers.push_back(worker);
+	}
+
+	async_read_thread = Thread::create(FileCacheManager::async_read_func, this);
 
-	// th2 = Thread::create(FileCacheManager::th2_fn, this);
+	if (dirty_high_watermark > 0) {
+		flusher_stop = false;
+		flusher_thread = Thread::create(FileCacheManager::flusher_func, this);
+	}
+
+	if (!warm_start_manifest.empty() && FileAccess::exists(warm_start_manifest)) {
+		warm_start_stop = false;
+		warm_start_thread = Thread::create(FileCacheManager::warm_start_func, this);
+	}
 
 	return OK;
 }
 
+struct WarmStartPage {
+	String path;
+	uint64_t offset;
+	uint32_t access_count;
+	int cache_policy;
+
+	// Hottest pages first.
+	bool operator<(const WarmStartPage &p_other) const { return access_count > p_other.access_count; }
+};
+
+Error FileCacheManager::save_manifest(const String &p_path) {
+
+	MutexLock ml(mutex);
+
+	Vector<DescriptorInfo *> saved;
+	const data_descriptor *key = NULL;
+	for (key = files.next(NULL); key; key = files.next(key)) {
+		DescriptorInfo *desc_info = files[*key];
+		if ((desc_info->cache_policy == _FileCacheManager::KEEP || desc_info->cache_policy == _FileCacheManager::LRU) &&
+				!desc_info->mapped_region && !desc_info->pages.empty() && FileAccess::exists(desc_info->path)) {
+			saved.push_back(desc_info);
+		}
+	}
+
+	Error err;
+	FileAccess *f = FileAccess::open(p_path, FileAccess::WRITE, &err);
+	ERR_FAIL_COND_V_MSG(!f, err, "Could not write the warm-start manifest " + p_path + ".");
+
+	f->store_32(CS_MANIFEST_MAGIC);
+	f->store_32(CS_MANIFEST_VERSION);
+	f->store_32(saved.size());
+
+	for (int i = 0; i < saved.size(); ++i) {
+		DescriptorInfo *desc_info = saved[i];
+
+		// A file that changed by the next run is skipped, rather than loading pages of the old contents.
+		f->store_pascal_string(desc_info->path);
+		f->store_64(FileAccess::get_modified_time(desc_info->path));
+		f->store_64(desc_info->total_size);
+		f->store_32(desc_info->cache_policy);
+		f->store_32(desc_info->pages.size());
+
+		for (int j = 0; j < desc_info->pages.size(); ++j) {
+			f->store_64(CS_GET_FILE_OFFSET_FROM_GUID(desc_info->pages[j]));
+			f->store_32(frames[page_frame_map[desc_info->pages[j]]]->get_access_count());
+		}
+	}
+
+	err = f->get_error();
+	f->close();
+	memdelete(f);
+
+	return err;
+}
+
+void FileCacheManager::warm_start_func(void *p_udata) {
+	FileCacheManager &fcm = *static_cast<FileCacheManager *>(p_udata);
+
+	FileAccess *f = FileAccess::open(fcm.warm_start_manifest, FileAccess::READ);
+	ERR_FAIL_COND_MSG(!f, "Could not read the warm-start manifest " + fcm.warm_start_manifest + ".");
+
+	if (f->get_32() != CS_MANIFEST_MAGIC || f->get_32() != CS_MANIFEST_VERSION) {
+		ERR_PRINTS("The warm-start manifest " + fcm.warm_start_manifest + " is invalid or from another version, ignoring it.");
+		memdelete(f);
+		return;
+	}
+
+	Vector<WarmStartPage> pages;
+	uint32_t file_count = f->get_32();
+
+	for (uint32_t i = 0; i < file_count && !f->eof_reached(); ++i) {
+		WarmStartPage page;
+		page.path = f->get_pascal_string();
+		uint64_t modified_time = f->get_64();
+		uint64_t size = f->get_64();
+		page.cache_policy = f->get_32();
+		uint32_t page_count = f->get_32();
+
+		bool unchanged = page.cache_policy >= 0 && page.cache_policy < CS_CACHE_POLICY_COUNT &&
+						 FileAccess::exists(page.path) &&
+						 FileAccess::get_modified_time(page.path) == modified_time;
+
+		for (uint32_t j = 0; j < page_count && !f->eof_reached(); ++j) {
+			page.offset = f->get_64();
+			page.access_count = f->get_32();
+			if (unchanged && page.offset < size) {
+				pages.push_back(page);
+			}
+		}
+	}
+
+	memdelete(f);
+
+	pages.sort();
+
+	// The files the warm start opened itself.
+	Vector<RID> opened;
+
+	for (int i = 0; i < pages.size() && !fcm.warm_start_stop; ++i) {
+
+		// Only queue a load when the IO workers have little else to do.
+		while (fcm.op_queue.size() >= CS_WARM_START_QUEUE_DEPTH && !fcm.warm_start_stop) {
+			OS::get_singleton()->delay_usec(1000);
+		}
+
+		MutexLock ml(fcm.mutex);
+
+		const WarmStartPage &page = pages[i];
+		RID rid;
+
+		if (fcm.rids.has(page.path)) {
+			rid = fcm.rids[page.path];
+		} else {
+			// Opening the file doesn't cache anything, the pages are only loaded below.
+			rid = fcm.open_file(page.path, FileAccess::READ, page.cache_policy, false, false);
+			if (!rid.is_valid()) {
+				continue;
+			}
+			fcm.files[RID_REF_TO_DD]->warm_start = true;
+			opened.push_back(rid);
+		}
+
+		DescriptorInfo *desc_info = fcm.files[RID_REF_TO_DD];
+
+		// Closed files have no data source to load from.
+		if (!desc_info->valid || desc_info->mapped_region) {
+			continue;
+		}
+
+		// The warm start only fills free frames, it never evicts pages.
+		if (get_page_guid(desc_info, page.offset, true) == (page_id)CS_MEM_VAL_BAD && fcm.page_frame_map.size() >= CS_NUM_FRAMES) {
+			break;
+		}
+
+		if (!fcm.get_page_or_do_paging_op(desc_info, CS_GET_PAGE(page.offset))) {
+			fcm.enqueue_load(desc_info, fcm.page_frame_map[get_page_guid(desc_info, page.offset, false)], CS_GET_PAGE(page.offset), CtrlOp::PRIORITY_PREFETCH);
+		}
+	}
+
+	// The files opened by the warm start are closed once their loads are done, so that they don't hold a descriptor
+	// until someone opens them. Their pages stay cached, and are found again when they are opened.
+	// A file someone opened in the meantime has been handed over, and is left alone.
+	for (int i = 0; i < opened.size(); ++i) {
+		const RID rid = opened[i];
+
+		while (!fcm.warm_start_stop) {
+			DescriptorInfo *desc_info = fcm.get_descriptor(rid);
+			// The descriptor holds one count of its own while it is in the cache.
+			if (!desc_info || !desc_info->warm_start || desc_info->pending_ops <= 1) {
+				break;
+			}
+			OS::get_singleton()->delay_usec(1000);
+		}
+
+		{
+			MutexLock ml(fcm.mutex);
+
+			DescriptorInfo *const *elem = fcm.files.getptr(RID_REF_TO_DD);
+			if (!elem || !(*elem)->warm_start) {
+				continue;
+			}
+			(*elem)->warm_start = false;
+		}
+
+		fcm.close(rid);
+	}
+}
+
+void FileCacheManager::stop_warm_start() {
+	if (!warm_start_thread) {
+		return;
+	}
+
+	warm_start_stop = true;
+	Thread::wait_to_finish(warm_start_thread);
+	memdelete(warm_start_thread);
+	warm_start_thread = NULL;
+}
+
+void FileCacheManager::set_dirty_watermarks(float p_high, float p_low) {
+	ERR_FAIL_COND_MSG(p_high < 0 || p_high > 1 || p_low < 0 || p_low > p_high, "The dirty watermarks must be fractions, with the low one no higher than the high one.");
+
+	dirty_high_watermark = p_high;
+	dirty_low_watermark = p_low;
+}
+
+void FileCacheManager::flusher_func(void *p_udata) {
+	FileCacheManager &fcm = *static_cast<FileCacheManager *>(p_udata);
+
+	while (!fcm.flusher_stop) {
+		OS::get_singleton()->delay_usec(CS_FLUSHER_INTERVAL_USEC);
+		fcm.write_back_dirty_frames();
+	}
+}
+
+void FileCacheManager::stop_flusher() {
+	if (!flusher_thread) {
+		return;
+	}
+
+	flusher_stop = true;
+	Thread::wait_to_finish(flusher_thread);
+	memdelete(flusher_thread);
+	flusher_thread = NULL;
+}
+
+struct DirtyFrameLastUse {
+	const Vector<Frame *> *frames;
+
+	_FORCE_INLINE_ bool operator()(frame_id a, frame_id b) const {
+		return (*frames)[a]->get_last_use() < (*frames)[b]->get_last_use();
+	}
+};
+
+struct DirtyFramePage {
+	const Vector<Frame *> *frames;
+
+	_FORCE_INLINE_ bool operator()(frame_id a, frame_id b) const {
+		return (*frames)[a]->get_owning_page() < (*frames)[b]->get_owning_page();
+	}
+};
+
+void FileCacheManager::write_back_dirty_frames() {
+	// Most checks find the cache mostly clean, and don't need the lock or a scan to tell.
+	if (dirty_frames <= dirty_high_watermark * CS_NUM_FRAMES) {
+		return;
+	}
+
+	MutexLock ml(mutex);
+
+	// Frames with a write-back already queued are as good as clean.
+	Vector<frame_id> dirty;
+	for (size_t i = 0; i < CS_NUM_FRAMES; ++i) {
+		if (frames[i]->get_used() && frames[i]->get_dirty() && !frames[i]->get_write_back_queued()) {
+			dirty.push_back(i);
+		}
+	}
+
+	if (dirty.size() <= dirty_high_watermark * CS_NUM_FRAMES) {
+		return;
+	}
+
+	// The least recently used frames are the next to be evicted.
+	int count = dirty.size() - (int)(dirty_low_watermark * CS_NUM_FRAMES);
+	SortArray<frame_id, DirtyFrameLastUse> lru_sort;
+	lru_sort.compare.frames = &frames;
+	lru_sort.sort(dirty.ptrw(), dirty.size());
+	dirty.resize(count);
+
+	// A page's GUID starts with its file's prefix, so this groups the frames by file, in offset order.
+	SortArray<frame_id, DirtyFramePage> page_sort;
+	page_sort.compare.frames = &frames;
+	page_sort.sort(dirty.ptrw(), dirty.size());
+
+	for (int i = 0; i < dirty.size(); ++i) {
+		enqueue_write_back(dirty[i]);
+	}
+}
+
+void FileCacheManager::enqueue_write_back(frame_id frame) {
+	Frame *f = frames[frame];
+	if (!f->get_dirty() || f->get_write_back_queued()) {
+		return;
+	}
+
+	page_id curr_page = f->get_owning_page();
+	DescriptorInfo **desc_info = files.getptr(curr_page >> 40);
+	if (!desc_info || !(*desc_info)->valid) {
+		return;
+	}
+
+	f->set_write_back_queued(true).set_store_failed(false, &(*desc_info)->dirty_signal);
+	op_queue.push(CtrlOp(*desc_info, frame, CS_GET_FILE_OFFSET_FROM_GUID(curr_page), CtrlOp::STORE, CtrlOp::PRIORITY_WRITE_BACK));
+	atomic_increment(&stats.background_write_backs);
+}
+
 void FileCacheManager::thread_func(void *p_udata) {
-	FileCacheManager &fcs = *static_cast<FileCacheManager *>(p_udata);
+	IOWorker &worker = *static_cast<IOWorker *>(p_udata);
+	FileCacheManager &fcs = *worker.fcm;
+	CtrlOp batch[CS_IO_BATCH_MAX];
+	CtrlOp l;
+	// Set when the last batch ended on an op that still has to be processed.
+	bool have_op = false;
 
 	do {
 
-		// ERR_PRINTS("Thread" + itoh(fcs.thread->get_id()) + "Waiting for message.");
-		CtrlOp l = fcs.op_queue.pop();
-		//ERR_PRINT("got message");
+		if (!have_op) {
+			// ERR_PRINTS("Thread" + itoh(worker.thread->get_id()) + "Waiting for message.");
+			l = fcs.op_queue.pop(worker.shard);
+			//ERR_PRINT("got message");
+		}
+		have_op = false;
+
 		if (l.type == CtrlOp::QUIT)
 			break;
 
-		ERR_FAIL_COND_MSG(l.di == NULL, "Null file handle.")
-		if(l.di->valid == false) {
-			// ERR_PRINTS("Invalid file");
-			fcs.untrack_page(l.di, get_page_guid(l.di, l.offset, false));
+		ERR_FAIL_COND_MSG(l.di == NULL, "Null file handle.");
+
+		// Closing a file cancels its loads and writes back its dirty pages, so the loads and stores
+		// still queued for a closed file have nothing left to do.
+		// All stores of a file are run by the worker of its shard, so once a store is current here,
+		// its frame can't be cleaned and given to another page before the store is done.
+		// Loads are checked again under the file's lock, as their page can be evicted at any time.
+		if (fcs.is_cancelled(l) || ((l.type == CtrlOp::LOAD || l.type == CtrlOp::STORE) && (!l.di->valid || !fcs.is_frame_current(l)))) {
+			if (l.type == CtrlOp::LOAD) {
+				atomic_increment(&fcs.stats.cancelled_loads);
+			}
+			fcs.finish_op(l);
+			continue;
+		}
+
+		// Loads and stores on files with a descriptor are gathered while they keep coming,
+		// and sent to the kernel together.
+		if ((l.type == CtrlOp::LOAD || l.type == CtrlOp::STORE) && l.di->async_fd >= 0) {
+			int count = 0;
+			batch[count++] = l;
+
+			while (count < CS_IO_BATCH_MAX && fcs.op_queue.try_pop(worker.shard, l)) {
+				if (l.di == batch[0].di && (l.type == CtrlOp::LOAD || l.type == CtrlOp::STORE)) {
+					batch[count++] = l;
+				} else {
+					have_op = true;
+					break;
+				}
+			}
+
+			uint64_t start_usec = OS::get_singleton()->get_ticks_usec();
+			fcs.do_io_batch(worker, batch, count);
+			uint64_t batch_usec = OS::get_singleton()->get_ticks_usec() - start_usec;
+
+			for (int i = 0; i < count; ++i) {
+				fcs.stats.record_latency(batch[i].type == CtrlOp::LOAD ? CacheStats::LATENCY_LOAD : CacheStats::LATENCY_STORE, batch_usec);
+				fcs.finish_op(batch[i]);
+			}
 			continue;
 		}
 
 		page_id curr_page = get_page_guid(l.di, l.offset, false);
-		frame_id curr_frame = fcs.page_frame_map[curr_page];
+		// Load and store ops carry their frame, so the worker never has to look at the page table,
+		// which other threads may be modifying.
+		frame_id curr_frame = l.frame;
+		uint64_t start_usec = OS::get_singleton()->get_ticks_usec();
 
 		switch (l.type) {
 			case CtrlOp::LOAD: {
 				// ERR_PRINTS("file: " + l.di->path + " Performing load for offset " + itoh(l.offset) + "\nIn pages: " + itoh(CS_GET_PAGE(l.offset)) + "\nCurr page: " + itoh(curr_page) + "\nCurr frame: " + itoh(curr_frame));
-				fcs.do_load_op(l.di, curr_page, curr_frame, l.offset);
+				fcs.do_load_op(l);
 				break;
 			}
 			case CtrlOp::STORE: {
@@ -1117,23 +2612,48 @@ void FileCacheManager::thread_func(void *p_udata) {
 			}
 			default: CRASH_NOW();
 		}
-	} while (!fcs.exit_thread);
+
+		uint64_t op_usec = OS::get_singleton()->get_ticks_usec() - start_usec;
+		fcs.stats.record_latency(l.type == CtrlOp::LOAD ? CacheStats::LATENCY_LOAD : l.type == CtrlOp::STORE ? CacheStats::LATENCY_STORE : CacheStats::LATENCY_FLUSH, op_usec);
+		fcs.finish_op(l);
+	} while (have_op || !fcs.exit_thread);
 }
 
 void FileCacheManager::check_cache(const RID rid, size_t length) {
 
+	DescriptorInfo *desc_info = get_descriptor(rid);
+	ERR_FAIL_COND_MSG(!desc_info, "No such file");
+
+	check_cache_at(rid, desc_info->offset, length);
+}
+
+void FileCacheManager::check_cache_at(const RID rid, size_t offset, size_t length) {
+
+	MutexLock ml(mutex);
+
 	DescriptorInfo *desc_info = files[RID_REF_TO_DD];
 
+	// Mapped files have no pages to load.
+	if (desc_info->mapped_region) return;
+
 	if (length == CS_LEN_UNSPECIFIED) length = 8 * CS_PAGE_SIZE;
 
-	for (page_id curr_page = CS_GET_PAGE(desc_info->offset); curr_page < CS_GET_PAGE(desc_info->offset + length) + CS_PAGE_SIZE; curr_page += CS_PAGE_SIZE) {
+	for (page_id curr_page = CS_GET_PAGE(offset); curr_page < CS_GET_PAGE(offset + length) + CS_PAGE_SIZE; curr_page += CS_PAGE_SIZE) {
 		//  WARN_PRINTS("Checking cache for file " + desc_info->path + " with offset " + itoh(curr_page));
 
+		// Pages that are already tracked are either cached or being loaded. The read that follows counts as their access.
+		if (get_page_guid(desc_info, curr_page, true) != (page_id)CS_MEM_VAL_BAD) {
+			continue;
+		}
+
+		// The page may be taken from the compressed tier, then it is ready already.
 		if (!get_page_or_do_paging_op(desc_info, curr_page)) {
 			// TODO: reduce inconsistency here.
 			//  WARN_PRINTS("get_page_or_do_paging_op result: curr_page: " + itoh(curr_page) + " curr_frame: " + itoh(page_frame_map[desc_info->guid_prefix | curr_page]))
 			enqueue_load(desc_info, page_frame_map[desc_info->guid_prefix | curr_page], curr_page);
 		}
+
+		frames[page_frame_map[desc_info->guid_prefix | curr_page]]->set_prefetched(true);
 	}
 }
 
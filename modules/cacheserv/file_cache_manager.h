@@ -38,14 +38,21 @@
 #include "core/os/mutex.h"
 #include "core/os/thread.h"
 #include "core/rid.h"
+#include "core/rid_owner.h"
+#include "core/safe_refcount.h"
 #include "core/set.h"
 #include "core/variant.h"
 #include "core/vector.h"
 
 #include "cacheserv_defines.h"
+#include "compressed_tier.h"
 #include "control_queue.h"
 #include "data_helpers.h"
 
+#if defined(UNIX_ENABLED)
+#include "async_io_unix.h"
+#endif
+
 //  A page is identified with a 64 bit GUID where the 24 most significant bits act as the
 //  differenciator. The 40 least significant bits represent the offset of the referred page
 //  in its associated data source.
@@ -69,38 +76,203 @@
 // CS_MEM_VAL_BAD if we are making a query and the current page is not tracked.
 _FORCE_INLINE_ page_id get_page_guid(const DescriptorInfo *di, size_t offset, bool query) {
 	page_id x = di->guid_prefix | CS_GET_PAGE(offset);
-	if (query && di->pages.find(x) < 0) {
+	if (query && !di->has_page(offset)) {
 		return CS_MEM_VAL_BAD;
 	}
 	return x;
 }
 
-struct LRUComparator;
+// Counters for sizing the cache and picking policies. They only ever grow.
+// The IO workers update some of them, so all of them are updated atomically.
+struct CacheStats {
+	enum LatencyOp {
+		LATENCY_LOAD,
+		LATENCY_STORE,
+		LATENCY_FLUSH,
+		LATENCY_MAX
+	};
+
+	// Page lookups that found the page in the cache, and the ones that had to map it.
+	volatile uint64_t hits;
+	volatile uint64_t misses;
+	// Evictions, indexed by the cache policy of the file the evicted page belonged to.
+	volatile uint64_t evictions[CS_CACHE_POLICY_COUNT];
+	// Pages loaded by read-ahead, the ones that were used, and the ones evicted without being used.
+	volatile uint64_t read_ahead_loads;
+	volatile uint64_t read_ahead_hits;
+	volatile uint64_t read_ahead_evictions;
+	// Dirty pages written back to their file, and the write-backs the background flusher queued.
+	volatile uint64_t write_backs;
+	volatile uint64_t background_write_backs;
+	// Dirty pages whose write-back failed or was short. They stay dirty, and are stored again by the next flush.
+	volatile uint64_t failed_stores;
+	// Evicted pages kept by the compressed tier, and misses it served without going to the file.
+	volatile uint64_t compressed_stores;
+	volatile uint64_t compressed_hits;
+	// Loads skipped by the IO workers because their file cancelled them, or their page was evicted or loaded already.
+	volatile uint64_t cancelled_loads;
+	// Reads made with read_async() that are done.
+	volatile uint64_t async_reads;
+	// Batched load and store ops, and the vectored requests they were submitted as.
+	// Adjacent ops merged into one request share it, so (io_loads + io_stores - io_requests) ops were merged.
+	volatile uint64_t io_loads;
+	volatile uint64_t io_stores;
+	volatile uint64_t io_requests;
+	// Time spent by the IO workers on each op. Bucket 0 counts ops that took less than 1 microsecond,
+	// bucket i > 0 the ones that took at least 2^(i-1) and less than 2^i. The last bucket counts everything slower.
+	// Batched ops are counted with the time of the whole batch.
+	volatile uint64_t latency[LATENCY_MAX][CS_LATENCY_BUCKETS];
+
+	_FORCE_INLINE_ void record_latency(LatencyOp p_op, uint64_t p_usec, uint64_t p_count = 1) {
+		uint32_t bucket = 0;
+		while (bucket < CS_LATENCY_BUCKETS - 1 && ((uint64_t)1 << bucket) <= p_usec) {
+			bucket += 1;
+		}
+		atomic_add(&latency[p_op][bucket], p_count);
+	}
+
+	CacheStats() {
+		memset((void *)this, 0, sizeof(*this));
+	}
+};
 
 class FileCacheManager : public Object {
 	GDCLASS(FileCacheManager, Object);
 
 	friend class _FileCacheManager;
 
+public:
+	// Called on the async reader thread once a read made with read_async() is done, with the number of bytes read,
+	// which is less than requested at the end of the file. p_error is OK, or ERR_FILE_CANT_READ if the file could not be read.
+	typedef void (*AsyncReadCallback)(void *p_udata, Error p_error, size_t p_length);
+
+	// A read-only view of part of a file, pointing straight into the cache frames.
+	// The pages behind it stay in the cache until it is passed to unpin().
+	struct PinnedRange {
+		struct Span {
+			const uint8_t *ptr;
+			size_t size;
+		};
+
+		RID rid;
+		Vector<page_id> pages;
+		// The data of the range, in file order. Frames that are next to each other in memory share a span.
+		Vector<Span> spans;
+		// The total size of the spans.
+		size_t length;
+
+		PinnedRange() :
+				length(0) {}
+	};
+
+private:
+
 	static FileCacheManager *singleton;
 	RandomNumberGenerator rng;
-	RID_Owner<CachedResourceHandle> handle_owner;
+	RID_PtrOwner<CachedResourceHandle> handle_owner;
 	CtrlQueue op_queue;
-	Thread *thread, *th2;
-	Mutex *mutex;
+	Mutex mutex;
+
+	// Each IO worker drains one shard of the operation queue.
+	struct IOWorker {
+		FileCacheManager *fcm;
+		Thread *thread;
+		uint32_t shard;
+#if defined(UNIX_ENABLED)
+		// Runs the batched load and store ops of files that expose a descriptor.
+		AsyncIOUnix aio;
+#endif
+	};
+	Vector<IOWorker *> io_workers;
+	bool use_io_uring;
+	bool use_direct_io;
+	bool use_huge_pages;
+
+	// How the memory of the frames was allocated.
+	enum ArenaType {
+		// From the heap, where huge pages and direct IO aren't available.
+		ARENA_HEAP,
+		// An anonymous mapping, aligned for direct IO.
+		ARENA_MAPPED,
+		// An anonymous mapping that the kernel backs with transparent huge pages.
+		ARENA_TRANSPARENT_HUGE_PAGES,
+		// A mapping of explicit huge pages.
+		ARENA_HUGE_PAGES,
+	};
+	ArenaType arena_type;
+	size_t memory_region_size;
+	CacheStats stats;
+
+	// Compressed copies of evicted pages. Sized by set_compressed_tier_size() before init().
+	CompressedTier compressed_tier;
+	size_t compressed_tier_size;
+	Compression::Mode compressed_tier_mode;
+
+	// The warm-start manifest, and the thread that loads the pages it lists after init().
+	String warm_start_manifest;
+	Thread *warm_start_thread;
+	volatile bool warm_start_stop;
+
+	// The background flusher, and its watermarks as fractions of the frame count. See set_dirty_watermarks().
+	Thread *flusher_thread;
+	volatile bool flusher_stop;
+	float dirty_high_watermark;
+	float dirty_low_watermark;
+	// The number of dirty frames. Updated by Frame::set_dirty_true() and Frame::set_dirty_false(),
+	// so the flusher can check it without scanning the frames.
+	volatile uint32_t dirty_frames;
+	// Broadcast when the last reader of a frame releases it. See wait_no_readers().
+	StateSignal readers_signal;
+
+	// The reads made with read_async() that the async reader thread has yet to copy, oldest first.
+	struct AsyncRead {
+		DescriptorInfo *di;
+		RID rid;
+		size_t offset;
+		void *buffer;
+		size_t length;
+		AsyncReadCallback callback;
+		void *udata;
+	};
+	List<AsyncRead> async_reads;
+	Mutex async_read_mutex;
+	Semaphore async_read_sem;
+	// Broadcast each time an async read is done. See wait_async_reads().
+	StateSignal async_read_signal;
+	Thread *async_read_thread;
 
 public:
 	Vector<Frame *> frames;
 	HashMap<String, RID> rids;
 	HashMap<uint32_t, DescriptorInfo *> files;
-	Map<page_id, frame_id> page_frame_map;
-	Set<page_id, LRUComparator> lru_cached_pages;
-	List<page_id> fifo_cached_pages;
-	Set<page_id, LRUComparator> permanent_cached_pages;
+	PageTable page_frame_map;
+	// The frames that hold no page, taken before anything is evicted. Filled by untrack_page() and remove_data_source().
+	FrameList free_frames;
+	// Replacement policy lists. Every used frame is in exactly one of these.
+	FrameList lru_list;
+	FrameList fifo_list;
+	FrameList keep_list;
+	FrameList clock_list;
+
+	// ARC state. T1 holds pages seen once recently, T2 pages seen at least twice.
+	// B1 and B2 remember the IDs of pages recently evicted from T1 and T2, without their data.
+	// arc_target is the adaptive target size of T1, in pages.
+	FrameList arc_t1;
+	FrameList arc_t2;
+	List<page_id> arc_b1;
+	List<page_id> arc_b2;
+	HashMap<page_id, List<page_id>::Element *> arc_b1_pages;
+	HashMap<page_id, List<page_id>::Element *> arc_b2_pages;
+	uint32_t arc_target;
+	// Pages brought in by read-ahead, oldest first. Entries are dropped lazily once the page is accessed or untracked.
+	List<page_id> read_ahead_pages;
+	uint32_t read_ahead_max_pages;
+
+	// The number of frames with at least one pin.
+	uint32_t pinned_frames;
 
 	uint8_t *memory_region = NULL;
 	uint64_t step = 0;
-	size_t last_used = 0;
 	size_t available_space;
 	size_t used_space;
 	size_t total_space;
@@ -109,47 +281,212 @@ public:
 private:
 	static void thread_func(void *p_udata);
 
+	// Allocates the memory of the frames, with huge pages if enabled and available, and sets memory_region.
+	// Leaves memory_region NULL if the memory can't be allocated.
+	void alloc_arena(size_t p_size);
+	void free_arena();
+
+	// Direct IO only applies to files opened for reading, and needs frames aligned to the file system's blocks.
+	_FORCE_INLINE_ bool use_direct_io_for(int p_mode, bool p_use_mmap) const {
+		return use_direct_io && p_mode == FileAccess::READ && !p_use_mmap && arena_type != ARENA_HEAP;
+	}
+
+	// Reads the warm-start manifest and loads the pages it lists, hottest first, into free frames.
+	// The files are opened as they are needed and left open for the first open() on their path to take over.
+	static void warm_start_func(void *p_udata);
+	void stop_warm_start();
+
+	// Periodically writes back dirty frames ahead of eviction, so that evicting a page rarely has to wait for its write-back.
+	static void flusher_func(void *p_udata);
+	void stop_flusher();
+
+	// If more frames than the high watermark are dirty, queues write-backs for the least recently used dirty
+	// frames until no more than the low watermark would be left. The stores of each file are queued in offset
+	// order, so that the IO workers merge adjacent pages into one request.
+	// Only scans the frames when the dirty count is over the high watermark.
+	void write_back_dirty_frames();
+
+	// Queues a background write-back of a dirty frame, unless one is already queued or its file is closing.
+	// Must be called with the mutex held.
+	void enqueue_write_back(frame_id frame);
+
+	// The value of one of the single-value entries of get_stats(), by its index in the list of them.
+	Variant _get_stat(int p_stat) const;
+
+	// Copies the data of the async reads in the order they were made, waiting for their pages to be loaded,
+	// and calls their callbacks. Stops once the reads queued before stop_async_reads() are done.
+	static void async_read_func(void *p_udata);
+	void stop_async_reads();
+
+	// Waits until the async reads of the file are done. They don't keep the file open, so closing it has to wait for them.
+	void wait_async_reads(DescriptorInfo *desc_info);
+
 	// Register a file handle with the cache manager. This function takes a pointer to a FileAccess object, so anything that implements the FileAccess API (from the file system or anywhere else) can act as a data source.
-	RID add_data_source(RID rid, FileAccess *data_source, int cache_policy);
+	// If the data source is backed by a file descriptor, pass it as async_fd so that the IO workers can batch their ops on it.
+	// If use_mmap is true, the file is served through a read-only mapping of async_fd when possible.
+	// If p_prefill is true, the first pages of the file are cached right away, evicting other pages if needed.
+	RID add_data_source(RID rid, FileAccess *data_source, int cache_policy, int async_fd = -1, bool use_mmap = false, bool p_prefill = true);
+
+	// Does what open() does. The warm start opens files with p_prefill false, so that opening them doesn't evict anything.
+	RID open_file(const String &path, int p_mode, int cache_policy, bool use_mmap, bool p_prefill);
+
+	// Maps the file of the descriptor read-only and advises the kernel according to its cache policy.
+	// Returns false if the file can't be mapped, in which case it keeps going through the frames.
+	bool map_data_source(DescriptorInfo *desc_info);
+	void unmap_data_source(DescriptorInfo *desc_info);
+	// Drops the pages of a closed file and forgets the file. Doesn't wait for the IO workers to skip its
+	// remaining ops: the descriptor is freed by whoever finishes with it last. See finish_op().
 	void remove_data_source(RID rid);
 
+	// Moves the pages of the file to the lists of another cache policy.
+	void set_cache_policy(DescriptorInfo *desc_info, int cache_policy);
+
+	// Waits until no thread is copying data out of the frame. Called with the lock held, before the frame is reused.
+	// Readers never take the lock while they hold a frame, so this can't deadlock. Eviction passes over frames
+	// with readers while it can, so this mostly waits when a whole file is dropped.
+	void wait_no_readers(frame_id curr_frame);
+
 	void untrack_page(DescriptorInfo *desc_info, page_id curr_page) {
 		frame_id curr_frame = page_frame_map[curr_page];
+		wait_no_readers(curr_frame);
 		// WARN_PRINTS("Untracking page: " + itoh(curr_page) + " mapped to frame: " + itoh(curr_frame) + " in file:  " + desc_info->path)
 
 		CS_GET_CACHE_POLICY_FN(cache_removal_policies, desc_info->cache_policy)(curr_page);
 
+		// The last page of the file takes the place of this one, so the other pages don't have to be moved.
+		uint32_t index = frames[curr_frame]->get_page_index();
+		page_id last_page = desc_info->pages[desc_info->pages.size() - 1];
+		desc_info->pages.write[index] = last_page;
+		frames[page_frame_map[last_page]]->set_page_index(index);
+		desc_info->pages.resize(desc_info->pages.size() - 1);
+
 		page_frame_map.erase(curr_page);
-		desc_info->pages.erase(curr_page);
-		frames[curr_frame]->wait_clean(desc_info->dirty_sem).set_used(false).set_ready_false().set_owning_page(0).set_used_size(0);
+		desc_info->set_page_tracked(CS_GET_FILE_OFFSET_FROM_GUID(curr_page), false);
+
+		Frame *f = frames[curr_frame];
+		desc_info->dirty_signal.wait_until([f]() { return !f->get_dirty() || f->get_store_failed(); });
+
+		// The write-back of the page failed, and it can't be kept in the cache any longer.
+		if (f->get_dirty()) {
+			ERR_PRINTS("Dropping page " + itoh(curr_page) + " of " + desc_info->path + ", it could not be written back.");
+			f->set_dirty_false(&desc_info->dirty_signal, &dirty_frames);
+		}
+
+		if (!f->get_ready()) {
+			// A load may have claimed the frame. See claim_load_frame(). Loads claim frames under the file's write lock,
+			// and only frames that are in use, so once the frame is released under the lock no load can claim it anymore,
+			// and the one that did is waited for.
+			desc_info->lock->write_lock();
+			f->set_used(false);
+			desc_info->lock->write_unlock();
+			f->wait_not_loading(&desc_info->ready_signal);
+		}
+
+		f->set_used(false).set_ready_false().set_owning_page(0).set_used_size(0);
+		free_frames.push_front(frames, curr_frame);
 	}
 
-	void do_load_op(DescriptorInfo *desc_info, page_id curr_page, frame_id curr_frame, size_t offset);
+	// Returns the descriptor of the file, or NULL if the RID is not tracked.
+	DescriptorInfo *get_descriptor(RID rid) const;
+
+	// Finds the frame holding the page at offset, enqueueing a load if the page isn't cached,
+	// and registers the calling thread as a reader of the frame. The frame can't be evicted until
+	// the reader is released with Frame::release_reader(). Writers register as readers too.
+	frame_id acquire_frame(DescriptorInfo *desc_info, size_t offset);
+
+	// Skips the load unless it can claim its frame. See claim_load_frame().
+	void do_load_op(const CtrlOp &op);
 	void do_store_op(DescriptorInfo *desc_info, page_id curr_page, frame_id curr_frame, size_t offset);
 
+	// Performs a batch of load and store ops on one file with a single submission to the kernel.
+	// AsyncIOUnix::submit_and_wait() reaps the completions before it returns, so the batch is done when this returns.
+	// Only the frames being loaded are held during the IO, the file's lock is not, and the file's other pages can be read.
+	// A store that fails or is short leaves the pages it didn't write dirty, marks their frames, and sets the file's store_error.
+	//
+	// Expects every op to be for the same file, and the file to have a valid async_fd.
+	void do_io_batch(IOWorker &worker, const CtrlOp *ops, int count);
+
 	// Returns true if the page at the current offset is already tracked.
 	// Adds the current page to the tracked list, maps it to a frame and returns false if not.
 	// Also sets the values of the given page and frame id args.
 	bool get_page_or_do_paging_op(DescriptorInfo *desc_info, size_t offset);
 
 	// Expects that the page at the given offset is in the cache.
-	void enqueue_load(DescriptorInfo *desc_info, frame_id curr_frame, size_t offset);
+	// The load is queued in the given CtrlOp::Priority class, or in the file's class if none is given.
+	void enqueue_load(DescriptorInfo *desc_info, frame_id curr_frame, size_t offset, uint8_t priority);
+	void enqueue_load(DescriptorInfo *desc_info, frame_id curr_frame, size_t offset) { enqueue_load(desc_info, curr_frame, offset, desc_info->io_priority); }
 
 	// Expects that the page at the given offset is in the cache.
 	void enqueue_store(DescriptorInfo *desc_info, frame_id curr_frame, size_t offset);
 
+	// Enqueues a store for every page of the file that is dirty now. Called with the lock held.
+	// The page list and the page table are only read under the lock, so it is the thread asking for
+	// the flush that collects the dirty pages, and the IO workers never need the lock.
+	void enqueue_dirty_stores(DescriptorInfo *desc_info);
+
+	// Expects the stores of the file's dirty pages to be queued before. See enqueue_dirty_stores().
 	void enqueue_flush(DescriptorInfo *desc_info);
 
+	// Tracks sequential reads on the file and, once a stream is detected,
+	// enqueues loads for the pages ahead of the read cursor.
+	// The read-ahead window grows each time the reader catches up with it.
+	void do_read_ahead(DescriptorInfo *desc_info, size_t start_offset, size_t end_offset);
+
+	// Returns the oldest page that was read ahead but never accessed, and stops tracking it in the read-ahead list.
+	// Returns CS_MEM_VAL_BAD if there is no such page.
+	page_id get_unused_read_ahead_page();
+
+	// Expects the stores of the file's dirty pages to be queued before. See enqueue_dirty_stores().
 	void enqueue_flush_close(DescriptorInfo *desc_info);
 
-	// Flushes dirty pages of the file. Removes any pending store ops for the file from the operation queue.
+	// Cancels the loads queued for the file. Called with the lock held.
+	// Pages that a thread is waiting for are queued again as interactive loads, the others are untracked.
+	void cancel_loads(DescriptorInfo *desc_info);
+
+	// Returns true if the op is a load that was cancelled after it was queued.
+	_FORCE_INLINE_ bool is_cancelled(const CtrlOp &op) const {
+		return op.type == CtrlOp::LOAD && op.generation != op.di->load_generation;
+	}
+
+	// Called by the IO workers once they are done with an op, whether it was performed or skipped.
+	// The last op of a file that was removed from the cache frees its descriptor. See remove_data_source().
+	_FORCE_INLINE_ void finish_op(const CtrlOp &op) {
+		if (op.type == CtrlOp::STORE && op.priority == CtrlOp::PRIORITY_WRITE_BACK) {
+			frames[op.frame]->set_write_back_queued(false);
+		}
+		if (atomic_decrement(&op.di->pending_ops) == 0) {
+			memdelete(op.di);
+		}
+	}
+
+	// Marks the frame of a load as being loaded, unless the load was cancelled, or its page was evicted or is loaded already.
+	// Called by the IO workers with the file's write lock held. The frame is then read into without the lock:
+	// nobody else touches the data of a frame that isn't ready.
+	_FORCE_INLINE_ bool claim_load_frame(const CtrlOp &op) {
+		Frame *f = frames[op.frame];
+		if (is_cancelled(op) || !f->get_used() || f->get_ready() || !is_frame_current(op)) {
+			return false;
+		}
+		f->set_loading_true();
+		return true;
+	}
+
+	// Returns true if the frame of a load or store op still holds the page the op was queued for.
+	// A background write-back can outlive its page, and a queued load can outlive its page when the page
+	// is evicted before it finished loading, after which the frame may hold another page.
+	_FORCE_INLINE_ bool is_frame_current(const CtrlOp &op) {
+		return frames[op.frame]->get_owning_page() == get_page_guid(op.di, op.offset, false);
+	}
+
+	// Flushes the data source of the file. The stores of its dirty pages were queued before the flush,
+	// so they are done by the time this runs.
 	//
 	// Expects the file pointer to be valid.
 	//
 	// Leaves the file pointer valid.
 	void do_flush_op(DescriptorInfo *desc_info);
 
-	// Flushes dirty pages of the file. Removes all pending ops for the file from the operation queue.
+	// Closes the data source of the file once the stores of its dirty pages are done.
 	//
 	// Expects the file pointer to be valid.
 	//
@@ -163,44 +500,75 @@ public:
 	typedef void (FileCacheManager::*update_policy_fn)(page_id);
 	typedef void (FileCacheManager::*removal_policy_fn)(page_id);
 
+	// Evicts the oldest page of the first non-empty policy list.
+	// Used when the policy of the file that needs a frame can't find a victim on its own.
+	page_id rp_fallback();
+	// Removes and returns an eviction victim from the old end of a policy list. Prefers the oldest clean frame among
+	// the last CS_EVICT_SCAN_MAX, queuing write-backs for the dirty ones it passes over, so that eviction doesn't
+	// have to wait for a store. Only if all of them are dirty is the oldest one returned.
+	frame_id pop_victim(FrameList &list);
+	// Runs the CLOCK hand until it finds a clean page whose reference bit is clear, and removes that page from the CLOCK list.
+	// Dirty pages get a second chance like referenced ones; after a full turn the hand takes the page it points at.
+	page_id evict_clock_page();
+	// Evicts a page from T1 or T2 depending on the ARC target size, and remembers it in the matching ghost list.
+	page_id evict_arc_page();
+	// Removes a page from an ARC ghost list. Returns false if the page was not in it.
+	bool erase_arc_ghost(List<page_id> &ghosts, HashMap<page_id, List<page_id>::Element *> &ghost_pages, page_id curr_page);
+
 	page_id rp_lru(DescriptorInfo *desc_info);
 	page_id rp_fifo(DescriptorInfo *desc_info);
 	page_id rp_keep(DescriptorInfo *desc_info);
+	page_id rp_clock(DescriptorInfo *desc_info);
+	page_id rp_arc(DescriptorInfo *desc_info);
 
 	void rmp_lru(page_id curr_page);
 	void rmp_fifo(page_id curr_page);
 	void rmp_keep(page_id curr_page);
+	void rmp_clock(page_id curr_page);
+	void rmp_arc(page_id curr_page);
 
 	void ip_lru(page_id curr_page);
 	void ip_fifo(page_id curr_page);
 	void ip_keep(page_id curr_page);
+	void ip_clock(page_id curr_page);
+	void ip_arc(page_id curr_page);
 
 	void up_lru(page_id curr_page);
 	void up_fifo(page_id curr_page);
 	void up_keep(page_id curr_page);
+	void up_clock(page_id curr_page);
+	void up_arc(page_id curr_page);
 
-	insertion_policy_fn cache_insertion_policies[3] = {
+	insertion_policy_fn cache_insertion_policies[5] = {
 		&FileCacheManager::ip_keep,
 		&FileCacheManager::ip_lru,
-		&FileCacheManager::ip_fifo
+		&FileCacheManager::ip_fifo,
+		&FileCacheManager::ip_clock,
+		&FileCacheManager::ip_arc
 	};
 
-	replacement_policy_fn cache_replacement_policies[3] = {
+	replacement_policy_fn cache_replacement_policies[5] = {
 		&FileCacheManager::rp_keep,
 		&FileCacheManager::rp_lru,
-		&FileCacheManager::rp_fifo
+		&FileCacheManager::rp_fifo,
+		&FileCacheManager::rp_clock,
+		&FileCacheManager::rp_arc
 	};
 
-	update_policy_fn cache_update_policies[3] = {
+	update_policy_fn cache_update_policies[5] = {
 		&FileCacheManager::up_keep,
 		&FileCacheManager::up_lru,
-		&FileCacheManager::up_fifo
+		&FileCacheManager::up_fifo,
+		&FileCacheManager::up_clock,
+		&FileCacheManager::up_arc
 	};
 
-	removal_policy_fn cache_removal_policies[3] = {
+	removal_policy_fn cache_removal_policies[5] = {
 		&FileCacheManager::rmp_keep,
 		&FileCacheManager::rmp_lru,
-		&FileCacheManager::rmp_fifo
+		&FileCacheManager::rmp_fifo,
+		&FileCacheManager::rmp_clock,
+		&FileCacheManager::rmp_arc
 	};
 
 	FileCacheManager();
@@ -218,17 +586,67 @@ public:
 	//
 	// Returns an invalid RID if the file is currently already open. Only one FileAccessCached instance can hold the RID for one file.
 	// Returns an invalid RID if the file cannot be opened; this is similar to the normal FileAccess API.
-	RID open(const String &path, int p_mode, int cache_policy);
+	//
+	// If use_mmap is true, the file must be opened for reading only. It is then served from a mapping of the file
+	// instead of the cache frames, with madvise hints taken from the cache policy: FIFO files are read sequentially,
+	// and KEEP files are prefetched. Files that can't be mapped, like the ones inside a pack, are cached as usual.
+	//
+	// If p_prefill is false, nothing is cached until the file is read.
+	RID open(const String &path, int p_mode, int cache_policy, bool use_mmap = false, bool p_prefill = true);
 
 	// Close the file but keep its contents in the cache. None of the state information (like current offset) is invalidated.
+	// Loads still queued for the file are cancelled.
 	void close(RID rid);
 
+	// Cancels the loads queued for the file, for example after a seek made the read-ahead useless.
+	// Pages that another thread is waiting for are still loaded.
+	void cancel_loads(RID rid);
+
+	// Sets the CtrlOp::Priority class that loads of the file are queued with. Read-ahead always uses PRIORITY_PREFETCH.
+	// Files that are read continuously, like audio streams, can use PRIORITY_STREAMING so that bulk loads don't delay them,
+	// and files loaded in the background PRIORITY_PREFETCH so that they don't delay anything else.
+	void set_io_priority(RID rid, int priority);
+	int get_io_priority(RID rid) const;
+
 	// Invalidates the RID. The associated file will no longer be tracked.
 	void permanent_close(RID rid);
 
 
 	size_t read(RID rid, void *const buffer, size_t length);
+
+	// Reads length bytes of the file from offset, without using or changing the file position.
+	// Pages that aren't cached are loaded, so check_cache() doesn't have to be called first.
+	//
+	// Several threads can read the same file at once: the cache manager's lock is only held while
+	// each page is looked up, and the data is copied under the file's read lock.
+	// Returns the number of bytes read, which is less than length at the end of the file.
+	size_t read_at(RID rid, size_t offset, void *const buffer, size_t length);
+
+	// Pins the pages holding length bytes of the file from offset, loading them if needed, and fills
+	// r_range with spans over their data. The range is cut short at the end of the file.
+	// The file position is not changed.
+	//
+	// Pinned pages are taken out of the replacement policy lists, so they can't be evicted.
+	// At most half of the frames can be pinned at once.
+	// The spans stay valid until unpin() is called. Writes to the file show up in them.
+	Error pin(RID rid, size_t offset, size_t length, PinnedRange &r_range);
+
+	// Releases the pages of a pinned range, and clears the range.
+	void unpin(PinnedRange &r_range);
+
+	// Reads length bytes of the file from offset into buffer, like read_at(), but returns right away and calls
+	// callback on the async reader thread once the read is done.
+	//
+	// The loads of the pages that aren't cached are queued before returning, in the file's IO priority class,
+	// so that the IO of several async reads overlaps. The data is copied in the order the reads were made.
+	// The buffer must stay valid until the callback is called. Closing the file waits for its async reads,
+	// so the callback must not close it.
+	Error read_async(RID rid, size_t offset, void *buffer, size_t length, AsyncReadCallback callback, void *udata);
 	size_t write(RID rid, const void *const data, size_t length);
+
+	// Writes length bytes of data to the file at offset, without using or changing the file position.
+	// The pages should be queued with check_cache_at() first. Returns the number of bytes written.
+	size_t write_at(RID rid, size_t offset, const void *const data, size_t length);
 	size_t seek(RID rid, int64_t new_offset, int mode);
 
 	// utility method to dump the cache manager's current state as a variant.
@@ -248,10 +666,67 @@ public:
 
 	static FileCacheManager *get_singleton();
 
-	Error init();
+	// Allocates the frames of the cache and starts the IO workers.
+	// p_page_size must be a power of 2, and p_cache_size is rounded down to a multiple of it.
+	// Invalid values are reported and replaced with the defaults.
+	Error init(size_t p_page_size = CS_PAGE_SIZE_DEFAULT, size_t p_cache_size = CS_CACHE_SIZE_DEFAULT, uint32_t p_io_threads = CS_IO_THREADS_DEFAULT);
 
 	// Checks that all required pages are loaded and enqueues uncached pages for loading.
 	void check_cache(RID rid, size_t length);
+	// Like check_cache(), from offset instead of the file position, for handles that keep their own position.
+	void check_cache_at(RID rid, size_t offset, size_t length);
+
+	// Returns true if the page holding the given offset of the file is currently tracked by the cache.
+	bool has_page(RID rid, size_t offset) const;
+
+	// Sets the largest read-ahead window, in pages. 0 disables read-ahead.
+	void set_read_ahead_max_pages(uint32_t p_pages) { read_ahead_max_pages = p_pages; }
+	uint32_t get_read_ahead_max_pages() const { return read_ahead_max_pages; }
+
+	// Lets the IO workers submit batches through io_uring where the kernel supports it.
+	// Only takes effect if called before init().
+	void set_use_io_uring(bool p_enable) { use_io_uring = p_enable; }
+	bool get_use_io_uring() const { return use_io_uring; }
+
+	// Opens files for reading with direct IO, so that their data is cached by the frames only and not
+	// by the kernel as well. The kernel doesn't read ahead for these files either, which the cache's own
+	// read-ahead makes up for. Files opened afterwards are affected.
+	void set_use_direct_io(bool p_enable) { use_direct_io = p_enable; }
+	bool get_use_direct_io() const { return use_direct_io; }
+
+	// Backs the frames with huge pages where available, which cuts TLB misses on large caches.
+	// Explicit huge pages are tried first, then transparent huge pages. Only takes effect if called before init().
+	void set_use_huge_pages(bool p_enable) { use_huge_pages = p_enable; }
+	bool get_use_huge_pages() const { return use_huge_pages; }
+
+	// Sets when the background flusher starts and stops writing back dirty frames, as fractions of the frame count.
+	// A high watermark of 0 disables the flusher. Only takes effect if called before init().
+	void set_dirty_watermarks(float p_high, float p_low);
+	float get_dirty_high_watermark() const { return dirty_high_watermark; }
+	float get_dirty_low_watermark() const { return dirty_low_watermark; }
+
+	// Sets the size of the compressed tier in bytes, and how its pages are compressed. 0 disables the tier.
+	// Only takes effect if called before init(). See CompressedTier.
+	void set_compressed_tier_size(size_t p_size) { compressed_tier_size = p_size; }
+	size_t get_compressed_tier_size() const { return compressed_tier_size; }
+	void set_compressed_tier_mode(Compression::Mode p_mode) { compressed_tier_mode = p_mode; }
+	Compression::Mode get_compressed_tier_mode() const { return compressed_tier_mode; }
+
+	// Sets the path of the warm-start manifest. If a manifest exists there, init() loads the pages it lists
+	// in the background. The manifest is saved there again when the cache manager is destroyed.
+	// An empty path disables the warm start. Only takes effect if called before init().
+	void set_warm_start_manifest(const String &p_path) { warm_start_manifest = p_path; }
+	String get_warm_start_manifest() const { return warm_start_manifest; }
+
+	// Saves the cached pages of KEEP and LRU files, with how often each was accessed, so that a later run
+	// can load them before they are needed. Files that are memory mapped or not on disk are left out.
+	Error save_manifest(const String &p_path);
+
+	// Returns the cache counters (see CacheStats), along with rates derived from them, and the current
+	// depth of the operation queue.
+	Dictionary get_stats() const;
+	// Returns a single entry of get_stats(). The single values are read directly, without building the rest.
+	Variant get_stat(const String &p_name) const;
 
 	bool is_open() const; ///< true when file is open
 
@@ -261,8 +736,9 @@ public:
 	_FORCE_INLINE_ void seek(RID rid, size_t p_position) { seek(rid, p_position, SEEK_SET); } ///< seek to a given position
 	_FORCE_INLINE_ void seek_end(RID rid, int64_t p_position) { seek(rid, p_position, SEEK_END); } ///< seek from the end of file
 
-	size_t get_position(RID rid) const { return files[rid.get_id()]->offset; } ///< get position in the file
+	size_t get_position(RID rid) const; ///< get position in the file
 	size_t get_len(RID rid) const; ///< get size of the file
+	Error get_error(RID rid) const; ///< ERR_FILE_CANT_WRITE if a page of the file could not be written back
 
 	bool eof_reached(RID rid) const; ///< reading passed EOF
 
@@ -286,46 +762,45 @@ class _FileCacheManager : public Object {
 protected:
 	static void _bind_methods() {
 		ClassDB::bind_method(D_METHOD("get_state"), &_FileCacheManager::get_state);
+		ClassDB::bind_method(D_METHOD("get_stats"), &_FileCacheManager::get_stats);
+		ClassDB::bind_method(D_METHOD("get_stat", "name"), &_FileCacheManager::get_stat);
 		BIND_ENUM_CONSTANT(KEEP);
 		BIND_ENUM_CONSTANT(LRU);
 		BIND_ENUM_CONSTANT(FIFO);
+		BIND_ENUM_CONSTANT(CLOCK);
+		BIND_ENUM_CONSTANT(ARC);
+
+		BIND_ENUM_CONSTANT(IO_PRIORITY_INTERACTIVE);
+		BIND_ENUM_CONSTANT(IO_PRIORITY_STREAMING);
+		BIND_ENUM_CONSTANT(IO_PRIORITY_PREFETCH);
+		BIND_ENUM_CONSTANT(IO_PRIORITY_WRITE_BACK);
 	}
 
 public:
 	enum CachePolicy {
 		KEEP,
 		LRU,
-		FIFO
+		FIFO,
+		CLOCK,
+		ARC
+	};
+
+	enum IOPriority {
+		IO_PRIORITY_INTERACTIVE = CtrlOp::PRIORITY_INTERACTIVE,
+		IO_PRIORITY_STREAMING = CtrlOp::PRIORITY_STREAMING,
+		IO_PRIORITY_PREFETCH = CtrlOp::PRIORITY_PREFETCH,
+		IO_PRIORITY_WRITE_BACK = CtrlOp::PRIORITY_WRITE_BACK
 	};
 
 	_FileCacheManager();
 	static _FileCacheManager *get_singleton();
 	Variant get_state() { return FileCacheManager::get_singleton()->_get_state(); }
+	Dictionary get_stats() { return FileCacheManager::get_singleton()->get_stats(); }
+	// Returns a single entry of get_stats(). Used by the performance monitors.
+	Variant get_stat(const String &p_name) { return FileCacheManager::get_singleton()->get_stat(p_name); }
 };
 
 VARIANT_ENUM_CAST(_FileCacheManager::CachePolicy);
-
-
-// A comparator functor to sort page IDs according to the LRU paging algorithm.
-struct LRUComparator {
-	const FileCacheManager *const fcm;
-
-	LRUComparator() :
-			fcm(FileCacheManager::get_singleton()) {}
-
-	_FORCE_INLINE_ bool operator()(page_id p1, page_id p2) {
-		page_id a = fcm->frames[fcm->page_frame_map[p1]]->get_last_use();
-
-		page_id b = fcm->frames[fcm->page_frame_map[p2]]->get_last_use();
-
-		// Older pages have lower last_use values.
-		// This means that to sort by longest age we must compare for the least value of last_use.
-		// if x == false: page p1 is younger than p2.
-		// else: page p1 is older than p2.
-		bool x = a > b;
-
-		return x;
-	}
-};
+VARIANT_ENUM_CAST(_FileCacheManager::IOPriority);
 
 #endif // !FILE_CACHE_MANAGER_H
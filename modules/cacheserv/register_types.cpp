@@ -3,19 +3,98 @@
 #include "core/class_db.h"
 #include "core/engine.h"
 #include "core/project_settings.h"
+#include "main/performance.h"
 
 static FileCacheManager *file_cache_manager = NULL;
 static _FileCacheManager *_file_cache_server = NULL;
+
+// The stats shown as custom monitors in Performance, under "cacheserv/".
+static const char *monitored_stats[] = {
+	"hits",
+	"misses",
+	"hit_rate",
+	"total_evictions",
+	"read_ahead_usefulness",
+	"write_backs",
+	"dirty_frames",
+	"compressed_hit_rate",
+	"queue_depth",
+	NULL
+};
+
 void register_cacheserv_types() {
+	GLOBAL_DEF("cacheserv/page_size", CS_PAGE_SIZE_DEFAULT);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/page_size", PropertyInfo(Variant::INT, "cacheserv/page_size", PROPERTY_HINT_RANGE, itos(CS_PAGE_SIZE_MIN) + "," + itos(CS_PAGE_SIZE_MAX) + ",1"));
+	GLOBAL_DEF("cacheserv/cache_size", CS_CACHE_SIZE_DEFAULT);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/cache_size", PropertyInfo(Variant::INT, "cacheserv/cache_size", PROPERTY_HINT_RANGE, "0,1073741824,1,or_greater"));
+	GLOBAL_DEF("cacheserv/io_threads", CS_IO_THREADS_DEFAULT);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/io_threads", PropertyInfo(Variant::INT, "cacheserv/io_threads", PROPERTY_HINT_RANGE, "1,64,1"));
+	GLOBAL_DEF("cacheserv/read_ahead_max_pages", CS_READ_AHEAD_MAX_PAGES_DEFAULT);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/read_ahead_max_pages", PropertyInfo(Variant::INT, "cacheserv/read_ahead_max_pages", PROPERTY_HINT_RANGE, "0,1024,1,or_greater"));
+	GLOBAL_DEF("cacheserv/use_io_uring", true);
+	GLOBAL_DEF("cacheserv/use_direct_io", false);
+	GLOBAL_DEF("cacheserv/use_huge_pages", true);
+	GLOBAL_DEF("cacheserv/dirty_high_watermark", CS_DIRTY_HIGH_WATERMARK_DEFAULT);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/dirty_high_watermark", PropertyInfo(Variant::FLOAT, "cacheserv/dirty_high_watermark", PROPERTY_HINT_RANGE, "0,1,0.01"));
+	GLOBAL_DEF("cacheserv/dirty_low_watermark", CS_DIRTY_LOW_WATERMARK_DEFAULT);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/dirty_low_watermark", PropertyInfo(Variant::FLOAT, "cacheserv/dirty_low_watermark", PROPERTY_HINT_RANGE, "0,1,0.01"));
+	GLOBAL_DEF("cacheserv/compressed_tier_size", 0);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/compressed_tier_size", PropertyInfo(Variant::INT, "cacheserv/compressed_tier_size", PROPERTY_HINT_RANGE, "0,1073741824,1,or_greater"));
+	GLOBAL_DEF("cacheserv/compressed_tier_mode", Compression::MODE_ZSTD);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/compressed_tier_mode", PropertyInfo(Variant::INT, "cacheserv/compressed_tier_mode", PROPERTY_HINT_ENUM, "FastLZ,Deflate,Zstd,GZip"));
+	GLOBAL_DEF("cacheserv/warm_start_manifest", "");
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/warm_start_manifest", PropertyInfo(Variant::STRING, "cacheserv/warm_start_manifest", PROPERTY_HINT_SAVE_FILE, "*.csm"));
+	GLOBAL_DEF("cacheserv/cache_resources", false);
+	GLOBAL_DEF("cacheserv/resource_cache_policy", _FileCacheManager::LRU);
+	ProjectSettings::get_singleton()->set_custom_property_info("cacheserv/resource_cache_policy", PropertyInfo(Variant::INT, "cacheserv/resource_cache_policy", PROPERTY_HINT_ENUM, "Keep,LRU,FIFO,Clock,ARC"));
+	// Streams are read once from start to end, so their pages are the first to go.
+	Dictionary resource_cache_policies;
+	resource_cache_policies["oggstr"] = _FileCacheManager::FIFO;
+	resource_cache_policies["mp3str"] = _FileCacheManager::FIFO;
+	resource_cache_policies["ogv"] = _FileCacheManager::FIFO;
+	resource_cache_policies["webm"] = _FileCacheManager::FIFO;
+	GLOBAL_DEF("cacheserv/resource_cache_policies", resource_cache_policies);
+
 	file_cache_manager = memnew(FileCacheManager);
-	file_cache_manager->init();
+	file_cache_manager->set_read_ahead_max_pages((int)GLOBAL_GET("cacheserv/read_ahead_max_pages"));
+	file_cache_manager->set_use_io_uring(GLOBAL_GET("cacheserv/use_io_uring"));
+	file_cache_manager->set_use_direct_io(GLOBAL_GET("cacheserv/use_direct_io"));
+	file_cache_manager->set_use_huge_pages(GLOBAL_GET("cacheserv/use_huge_pages"));
+	file_cache_manager->set_dirty_watermarks(GLOBAL_GET("cacheserv/dirty_high_watermark"), GLOBAL_GET("cacheserv/dirty_low_watermark"));
+	file_cache_manager->set_compressed_tier_size((uint64_t)GLOBAL_GET("cacheserv/compressed_tier_size"));
+	file_cache_manager->set_compressed_tier_mode((Compression::Mode)(int)GLOBAL_GET("cacheserv/compressed_tier_mode"));
+	file_cache_manager->set_warm_start_manifest(GLOBAL_GET("cacheserv/warm_start_manifest"));
+	file_cache_manager->init((uint64_t)GLOBAL_GET("cacheserv/page_size"), (uint64_t)GLOBAL_GET("cacheserv/cache_size"), (int)GLOBAL_GET("cacheserv/io_threads"));
+	if (GLOBAL_GET("cacheserv/cache_resources")) {
+		FileAccessCached::set_resource_caching(true, GLOBAL_GET("cacheserv/resource_cache_policies"), GLOBAL_GET("cacheserv/resource_cache_policy"));
+	}
 	_file_cache_server = memnew(_FileCacheManager);
 	ClassDB::register_class<_FileCacheManager>();
 	ClassDB::register_class<_FileAccessCached>();
+	ClassDB::register_class<CachedReadRequest>();
 	Engine::get_singleton()->add_singleton(Engine::Singleton("FileCacheManager", _FileCacheManager::get_singleton()));
+
+	if (Performance::get_singleton()) {
+		for (int i = 0; monitored_stats[i]; ++i) {
+			Array args;
+			args.push_back(monitored_stats[i]);
+			Performance::get_singleton()->add_custom_monitor(String("cacheserv/") + monitored_stats[i], Callable(_file_cache_server, "get_stat"), args);
+		}
+	}
 }
 
 void unregister_cacheserv_types() {
+	if (Performance::get_singleton()) {
+		for (int i = 0; monitored_stats[i]; ++i) {
+			String id = String("cacheserv/") + monitored_stats[i];
+			if (Performance::get_singleton()->has_custom_monitor(id)) {
+				Performance::get_singleton()->remove_custom_monitor(id);
+			}
+		}
+	}
+
+	FileAccessCached::set_resource_caching(false);
+
 	if (file_cache_manager) memdelete(file_cache_manager);
 	if (_file_cache_server) memdelete(_file_cache_server);
 }
@@ -30,7 +30,6 @@
 
 #include "voxelizer.h"
 #include "core/os/os.h"
-#include "core/os/threaded_array_processor.h"
 
 #include <stdlib.h>
 
@@ -31,6 +31,7 @@
 #include "scene_tree.h"
 
 #include "core/debugger/engine_debugger.h"
+#include "core/frame_allocator.h"
 #include "core/input/input.h"
 #include "core/io/marshalls.h"
 #include "core/io/resource_loader.h"
@@ -242,7 +243,7 @@ void SceneTree::call_group_flags(uint32_t p_call_flags, const StringName &p_grou
 
 	_update_group_order(g);
 
-	Vector<Node *> nodes_copy = g.nodes;
+	FrameVector<Node *> nodes_copy(g.nodes);
 	Node **nodes = nodes_copy.ptrw();
 	int node_count = nodes_copy.size();
 
@@ -297,7 +298,7 @@ void SceneTree::notify_group_flags(uint32_t p_call_flags, const StringName &p_gr
 
 	_update_group_order(g);
 
-	Vector<Node *> nodes_copy = g.nodes;
+	FrameVector<Node *> nodes_copy(g.nodes);
 	Node **nodes = nodes_copy.ptrw();
 	int node_count = nodes_copy.size();
 
@@ -346,7 +347,7 @@ void SceneTree::set_group_flags(uint32_t p_call_flags, const StringName &p_group
 
 	_update_group_order(g);
 
-	Vector<Node *> nodes_copy = g.nodes;
+	FrameVector<Node *> nodes_copy(g.nodes);
 	Node **nodes = nodes_copy.ptrw();
 	int node_count = nodes_copy.size();
 
@@ -819,9 +820,9 @@ void SceneTree::_notify_group_pause(const StringName &p_group, int p_notificatio
 
 	_update_group_order(g, p_notification == Node::NOTIFICATION_PROCESS || p_notification == Node::NOTIFICATION_INTERNAL_PROCESS || p_notification == Node::NOTIFICATION_PHYSICS_PROCESS || p_notification == Node::NOTIFICATION_INTERNAL_PHYSICS_PROCESS);
 
-	//copy, so copy on write happens in case something is removed from process while being called
-	//performance is not lost because only if something is added/removed the vector is copied.
-	Vector<Node *> nodes_copy = g.nodes;
+	//copy, in case something is removed from process while being called
+	//the copy comes from the frame allocator, so it doesn't touch the heap.
+	FrameVector<Node *> nodes_copy(g.nodes);
 
 	int node_count = nodes_copy.size();
 	Node **nodes = nodes_copy.ptrw();
@@ -870,9 +871,9 @@ void SceneTree::_call_input_pause(const StringName &p_group, const StringName &p
 
 	_update_group_order(g);
 
-	//copy, so copy on write happens in case something is removed from process while being called
-	//performance is not lost because only if something is added/removed the vector is copied.
-	Vector<Node *> nodes_copy = g.nodes;
+	//copy, in case something is removed from process while being called
+	//the copy comes from the frame allocator, so it doesn't touch the heap.
+	FrameVector<Node *> nodes_copy(g.nodes);
 
 	int node_count = nodes_copy.size();
 	Node **nodes = nodes_copy.ptrw();
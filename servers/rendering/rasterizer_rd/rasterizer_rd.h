@@ -32,7 +32,6 @@
 #define RASTERIZER_RD_H
 
 #include "core/os/os.h"
-#include "core/thread_work_pool.h"
 #include "servers/rendering/rasterizer.h"
 #include "servers/rendering/rasterizer_rd/rasterizer_canvas_rd.h"
 #include "servers/rendering/rasterizer_rd/rasterizer_scene_high_end_rd.h"
@@ -87,8 +86,6 @@ public:
 
 	virtual bool is_low_end() const { return false; }
 
-	static ThreadWorkPool thread_work_pool;
-
 	RasterizerRD();
 	~RasterizerRD() {}
 };